@@ -7,278 +7,1043 @@
 
 #include <iostream>
 #include <string>
-#include <list>
 #include <stack>
 #include <stdexcept>
 #include <cstdlib>
+#include <cstring>
+#include <thread>
+#include <chrono>
 using namespace std ;
 
+#include <fcntl.h>
+
 #include "Sally.h"
+#include "SallyArray.h"
+#include "SallyCompileCache.h"
+#include "SallyPrefetch.h"
+
+
+// for SallyMetrics' times
+//
+static uint64_t clockNs() {
+   return chrono::duration_cast<chrono::nanoseconds>(
+      chrono::steady_clock::now().time_since_epoch()).count() ;
+}
 
 
 // Basic Token constructor. Just assigns values.
 //
-Token::Token(TokenKind kind, int val, string txt) {
-   m_kind = kind ;
-   m_value = val ;
-   m_text = txt ;
+Token::Token(TokenKind kind, Cell val, const SallyText& txt) :
+   m_kind(kind), m_slot(SYMTAB_NONE), m_value(val), m_text(txt),
+   m_hash(symHash(txt.data(), txt.size())), m_line(0), m_stamp(0)
+{
 }
 
 
 // Basic SymTabEntry constructor. Just assigns values.
 //
-SymTabEntry::SymTabEntry(TokenKind kind, int val, operation_t fptr) {
+SymTabEntry::SymTabEntry(TokenKind kind, Cell val, operation_t fptr) {
    m_kind = kind ;
    m_value = val ;
    m_dothis = fptr ;
 }
 
 
+// deepest nesting of word calls before we give up
+//
+const size_t MAX_RSTACK = 65536 ;
+
+// what nextToken() returns at the end of the input
+//
+static const Token noToken ;
+
+// mainLoop()'s messages
+//
+static const char UNDERFLOW_MESSAGE[] = "Parameter stack underflow??" ;
+
+// words with bodies at most this long and without control flow
+// are copied into the words that use them instead of called
+//
+const size_t INLINE_MAX = 8 ;
+
+
+// Handlers for the builtin words, in Opcode order
+// (see opTable in SallyOps.h).
+//
+struct SallyBuiltins {
+   static constexpr operation_t handlers[NUM_OPS] = {
+      &Sally::doDUMP,
+
+      &Sally::doPlus,
+      &Sally::doMinus,
+      &Sally::doTimes,
+      &Sally::doDivide,
+      &Sally::doMod,
+      &Sally::doNEG,
+
+      &Sally::doDot,
+      &Sally::doSP,
+      &Sally::doCR,
+
+      &Sally::doDUP,
+      &Sally::doDROP,
+      &Sally::doSWAP,
+      &Sally::doROT,
+
+      &Sally::checkEE,
+      &Sally::checkNE,
+      &Sally::checkLT,
+      &Sally::checkLTE,
+      &Sally::checkGT,
+      &Sally::checkGTE,
+
+      &Sally::doSET,
+      &Sally::doAT,
+      &Sally::doEX,
+
+      &Sally::doARRAY,
+      &Sally::doAAT,
+      &Sally::doAEX,
+      &Sally::doALEN,
+      &Sally::doASUM,
+      &Sally::doAMIN,
+      &Sally::doAMAX,
+      &Sally::doAFILL,
+      &Sally::doACOPY,
+      &Sally::doAPLUS,
+      &Sally::doATIMES,
+
+      &Sally::doAND,
+      &Sally::doOR,
+      &Sally::doNOT,
+
+      &Sally::doIFTHEN,
+      &Sally::doELSE,
+      &Sally::doENDIF,
+
+      &Sally::doDO,
+      &Sally::doUNTIL,
+
+      &Sally::doFOR,
+      &Sally::doLOOP,
+      &Sally::doPLUSLOOP,
+      &Sally::doI,
+      &Sally::doJ,
+
+      &Sally::doCOLON,
+      &Sally::doSEMI
+   } ;
+} ;
+
+constexpr operation_t SallyBuiltins::handlers[] ;
+
+
+// -------------------------------------------------------
+
+
+atomic<uint64_t> SymTab::stamps(0) ;
+
+
+SymTab::SymTab() : m_refs(1), m_index(16, -1), m_mask(15) {
+   m_stamp = ++stamps ;
+}
+
+
+// a copy lays its entries out the same way, but forks make
+// their own changes to it, so it needs a stamp of its own
+//
+SymTab::SymTab(const SymTab& other) :
+   m_refs(other.m_refs), m_entries(other.m_entries),
+   m_index(other.m_index), m_mask(other.m_mask)
+{
+   m_stamp = ++stamps ;
+}
+
+
+// entry number of name, -1 if it is not in the table
+//
+int SymTab::findEntry(const SallyText& name, uint32_t hash) const {
+   uint32_t i = hash & m_mask ;
+   int e ;
+
+   while ( (e = m_index[i]) >= 0 ) {
+      const Slot& s = m_entries[e] ;
+      if (s.m_hash == hash && s.m_name == name) {
+         return e ;
+      }
+      i = (i + 1) & m_mask ;
+   }
+   return -1 ;
+}
+
+
+SymTabEntry *SymTab::find(const SallyText& name, uint32_t hash) {
+   int e = findEntry(name, hash) ;
+   return e < 0 ? NULL : &m_entries[e].m_entry ;
+}
+
+
+SymTabEntry *SymTab::findAndCache(const Token& name) {
+   int e = findEntry(name.m_text, name.m_hash) ;
+
+   name.m_slot = e < 0 ? SYMTAB_NONE : (uint32_t) e ;
+   name.m_stamp = m_stamp ;
+   return e < 0 ? NULL : &m_entries[e].m_entry ;
+}
+
+
+SymTabEntry& SymTab::insert(const SallyText& name, uint32_t hash, const SymTabEntry& entry) {
+   SymTabEntry *old = find(name, hash) ;
+
+   if (old != NULL) {
+      *old = entry ;
+      return *old ;
+   }
+
+   // keep the index at most half full
+   //
+   if (2 * (m_entries.size() + 1) > m_index.size()) {
+      grow() ;
+   }
+
+   uint32_t i = hash & m_mask ;
+   while (m_index[i] >= 0) {
+      i = (i + 1) & m_mask ;
+   }
+
+   m_index[i] = m_entries.size() ;
+   m_entries.push_back(Slot()) ;
+   m_stamp = ++stamps ;
+   Slot& s = m_entries.back() ;
+   s.m_name = name ;
+   s.m_hash = hash ;
+   s.m_entry = entry ;
+   return s.m_entry ;
+}
+
+
+// only the slots that are in use are touched
+//
+void SymTab::clear() {
+   for (size_t e = 0 ; e < m_entries.size() ; e++) {
+      uint32_t i = m_entries[e].m_hash & m_mask ;
+      while (m_index[i] != (int) e) {
+         i = (i + 1) & m_mask ;
+      }
+      m_index[i] = -1 ;
+   }
+   m_entries.clear() ;
+   m_stamp = ++stamps ;
+}
+
+
+void SymTab::grow() {
+   m_index.assign(2 * m_index.size(), -1) ;
+   m_mask = m_index.size() - 1 ;
+
+   for (size_t e = 0 ; e < m_entries.size() ; e++) {
+      uint32_t i = m_entries[e].m_hash & m_mask ;
+      while (m_index[i] >= 0) {
+         i = (i + 1) & m_mask ;
+      }
+      m_index[i] = e ;
+   }
+}
+
+
+// -------------------------------------------------------
+
+
 // Constructor for Sally Forth interpreter.
-// Adds built-in functions to the symbol table.
+// Builtin functions are in SallyBuiltins, so the symbol table
+// starts out empty.
+//
+Sally::Sally(istream& input_stream, ostream& output_stream, ostream& error_stream) :
+   streamInput(input_stream),
+   input(&streamInput),
+   ostrm(&output_stream),
+   estrm(&error_stream)
+{
+   symtab = new SymTab ;
+   pc = 0 ;
+   jit = NULL ;
+   memo = NULL ;
+   timeLimit = 0 ;
+   prefetch = NULL ;
+   trace = NULL ;
+   cache = NULL ;
+   lineNo = 0 ;
+   status = SALLY_OK ;
+   error.m_status = SALLY_OK ;
+   error.m_line = 0 ;
+}
+
+
+Sally::Sally(SallyInput& input_source, ostream& output_stream, ostream& error_stream) :
+   Sally(cin, output_stream, error_stream)
+{
+   input = &input_source ;
+}
+
+
+// Drop our reference to the symbol table.
+//
+Sally::~Sally() {
+   if ( --symtab->m_refs == 0 ) {
+      delete symtab ;
+   }
+   delete jit ;
+   delete memo ;
+   delete prefetch ;
+   delete trace ;
+}
+
+
+void Sally::setJit(bool on) {
+   if (on && jit == NULL) {
+      jit = new SallyJit ;
+   } else if (!on) {
+      delete jit ;
+      jit = NULL ;
+   }
+}
+
+
+void Sally::setMemo(bool on) {
+   if (on && memo == NULL) {
+      memo = new SallyMemo ;
+   } else if (!on) {
+      delete memo ;
+      memo = NULL ;
+   }
+}
+
+
+void Sally::setPrefetch(bool on) {
+   if (on && prefetch == NULL) {
+      prefetch = new SallyPrefetch ;
+   } else if (!on) {
+      delete prefetch ;
+      prefetch = NULL ;
+   }
+}
+
+
+bool Sally::setTrace(const char *path, size_t records) {
+   delete trace ;
+   trace = NULL ;
+   if (path == NULL) return true ;
+
+   int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_APPEND, 0644) ;
+   if (fd < 0) return false ;
+
+   trace = new SallyTrace(fd, records) ;
+   return true ;
+}
+
+
+// Make sure no snapshot or fork shares our symbol table,
+// copying it if needed, and return it for modification.
 //
-Sally::Sally(istream& input_stream) :
-   istrm(input_stream)  // use member initializer to bind reference
+SymTab& Sally::ownSymtab() {
+   if ( symtab->m_refs > 1 ) {
+      SymTab *copy = new SymTab(*symtab) ;
+      stats.allocations.add(1) ;
+      copy->m_refs = 1 ;
+      symtab->m_refs-- ;
+      symtab = copy ;
+   }
+   return *symtab ;
+}
+
+
+vector<Cell> *Sally::findArray(const Token& name, bool forWrite) {
+   SymTabEntry *entry = symtab->find(name) ;
+
+   if (entry == NULL || entry->m_kind != ARRAY) {
+      *ostrm << "array not found" << endl ;
+      return NULL ;
+   }
+   if (forWrite) {
+      if (symtab->m_refs > 1) {
+         entry = ownSymtab().find(name) ;
+      }
+      if (entry->m_cells.use_count() > 1) {
+         entry->m_cells = make_shared< vector<Cell> >(*entry->m_cells) ;
+         stats.allocations.add(1) ;
+      }
+   }
+   return entry->m_cells.get() ;
+}
+
+
+// Put the interpreter back into its just-constructed state.
+//
+void Sally::reset(istream& input_stream, ostream& output_stream, ostream& error_stream) {
+   streamInput.attach(input_stream) ;
+   reset(streamInput, output_stream, error_stream) ;
+}
+
+
+void Sally::reset(SallyInput& input_source, ostream& output_stream, ostream& error_stream) {
+
+   input = &input_source ;
+   ostrm = &output_stream ;
+   estrm = &error_stream ;
+
+   while ( !params.empty() ) {
+      params.pop() ;
+   }
+
+   // a shared table belongs to a snapshot, just let go of it
+   //
+   if ( symtab->m_refs > 1 ) {
+      symtab->m_refs-- ;
+      symtab = new SymTab ;
+   } else {
+      symtab->clear() ;
+   }
+
+   tkBuffer.clear() ;
+   pc = 0 ;
+   lineNo = 0 ;
+   rstack.clear() ;
+   loops.clear() ;
+   cloops.clear() ;
+
+   if (jit != NULL) jit->forgetAll() ;
+}
+
+
+SallySnapshot::SallySnapshot() : symtab(NULL), pc(0) {
+}
+
+
+SallySnapshot::SallySnapshot(const SallySnapshot& other) :
+   params(other.params), symtab(other.symtab), tkBuffer(other.tkBuffer),
+   pc(other.pc), loops(other.loops), cloops(other.cloops)
 {
+   if (symtab != NULL) symtab->m_refs++ ;
+}
 
-   symtab["DUMP"]    =  SymTabEntry(KEYWORD,0,&doDUMP) ;
 
-   symtab["+"]    =  SymTabEntry(KEYWORD,0,&doPlus) ;
-   symtab["-"]    =  SymTabEntry(KEYWORD,0,&doMinus) ;
-   symtab["*"]    =  SymTabEntry(KEYWORD,0,&doTimes) ;
-   symtab["/"]    =  SymTabEntry(KEYWORD,0,&doDivide) ;
-   symtab["%"]    =  SymTabEntry(KEYWORD,0,&doMod) ;
-   symtab["NEG"]  =  SymTabEntry(KEYWORD,0,&doNEG) ;
+SallySnapshot& SallySnapshot::operator=(const SallySnapshot& other) {
+   if (other.symtab != NULL) other.symtab->m_refs++ ;
+   if (symtab != NULL && --symtab->m_refs == 0) delete symtab ;
 
-   symtab["."]    =  SymTabEntry(KEYWORD,0,&doDot) ;
-   symtab["SP"]   =  SymTabEntry(KEYWORD,0,&doSP) ;
-   symtab["CR"]   =  SymTabEntry(KEYWORD,0,&doCR) ;
+   params = other.params ;
+   symtab = other.symtab ;
+   tkBuffer = other.tkBuffer ;
+   pc = other.pc ;
+   loops = other.loops ;
+   cloops = other.cloops ;
+   return *this ;
+}
 
-   symtab["DUP"] = SymTabEntry(KEYWORD, 0, &doDUP);
-   symtab["DROP"] = SymTabEntry(KEYWORD, 0, &doDROP);
-   symtab["SWAP"] = SymTabEntry(KEYWORD, 0, &doSWAP);
-   symtab["ROT"] = SymTabEntry(KEYWORD, 0, &doROT);
 
-   symtab["=="] = SymTabEntry(KEYWORD, 0, &checkEE);
-   symtab["!="] = SymTabEntry(KEYWORD, 0, &checkNE);
-   symtab["<"] = SymTabEntry(KEYWORD, 0, &checkLT);
-   symtab["<="] = SymTabEntry(KEYWORD, 0, &checkLTE);
-   symtab[">"] = SymTabEntry(KEYWORD, 0, &checkGT);
-   symtab[">="] = SymTabEntry(KEYWORD, 0, &checkGTE);
+SallySnapshot::~SallySnapshot() {
+   if (symtab != NULL && --symtab->m_refs == 0) delete symtab ;
+}
+
+
+// Save everything needed to continue from this point.
+// The symbol table is shared, not copied.
+// Only meaningful between runs of mainLoop(), when no word
+// is being called.
+//
+void Sally::snapshot(SallySnapshot& snap) const {
+   symtab->m_refs++ ;
+   if (snap.symtab != NULL && --snap.symtab->m_refs == 0) delete snap.symtab ;
+
+   snap.params = params ;
+   snap.symtab = symtab ;
+   snap.tkBuffer = tkBuffer ;
+   snap.pc = pc ;
+   snap.loops = loops ;
+   snap.cloops = cloops ;
+}
 
-   symtab["SET"] = SymTabEntry(KEYWORD, 0, &doSET);
-   symtab["@"] = SymTabEntry(KEYWORD, 0, &doAT);
-   symtab["!"] = SymTabEntry(KEYWORD, 0, &doEX);
 
-   symtab["AND"] = SymTabEntry(KEYWORD, 0, &doAND);
-   symtab["OR"] = SymTabEntry(KEYWORD, 0, &doOR);
-   symtab["NOT"] = SymTabEntry(KEYWORD, 0, &doNOT);
+// Continue from a saved state with new streams.
+//
+void Sally::fork(const SallySnapshot& snap, istream& input_stream,
+                 ostream& output_stream, ostream& error_stream) {
+   streamInput.attach(input_stream) ;
+   fork(snap, streamInput, output_stream, error_stream) ;
+}
+
+
+void Sally::fork(const SallySnapshot& snap, SallyInput& input_source,
+                 ostream& output_stream, ostream& error_stream) {
+   if (snap.symtab == NULL) {     // empty snapshot
+      reset(input_source, output_stream, error_stream) ;
+      return ;
+   }
 
-   symtab["IFTHEN"] = SymTabEntry(KEYWORD, 0, &doIFTHEN);
-   symtab["ELSE"] = SymTabEntry(KEYWORD, 0, &doELSE);
-   symtab["ENDIF"] = SymTabEntry(KEYWORD, 0, &doENDIF);
+   input = &input_source ;
+   ostrm = &output_stream ;
+   estrm = &error_stream ;
 
-   symtab["DO"] = SymTabEntry(KEYWORD, 0, &doDO);
-   symtab["UNTIL"] = SymTabEntry(KEYWORD, 0, &doUNTIL);
+   snap.symtab->m_refs++ ;
+   if ( --symtab->m_refs == 0 ) delete symtab ;
+   symtab = snap.symtab ;
 
-   recorder = false;
+   params = snap.params ;
+   tkBuffer = snap.tkBuffer ;
+   pc = snap.pc ;
+   lineNo = 0 ;
+   rstack.clear() ;
+   loops = snap.loops ;
+   cloops = snap.cloops ;
+
+   if (jit != NULL) jit->forgetAll() ;
 }
 
 
 
-// This function should be called when tkBuffer is empty.
-// It adds tokens to tkBuffer.
+// This function should be called when all of tkBuffer has been run.
+// It adds tokens to the end of tkBuffer.
 //
 // This function returns when an empty line was entered 
 // or if the end-of-file has been reached.
 //
 // This function returns false when the end-of-file was encountered.
-// 
-// Processing done by fillBuffer()
-//   - detects and ignores comments.
-//   - detects string literals and combines as 1 token
-//   - detetcs base 10 numbers
-// 
+//
+// With prefetch on, the lines have been read and lexed already
+// by the prefetch thread, which hands them over in batches.
 //
 bool Sally::fillBuffer() {
-   string line ;     // single line of input
-   int pos ;         // current position in the line
-   int len ;         // # of char in current token
-   long int n ;      // int value of token
-   char *endPtr ;    // used with strtol()
+   const char *line ;     // single line of input
+   size_t len ;
+
+   if (prefetch != NULL) {
+      return prefetch->fill(*input, lineNo, tkBuffer) ;
+   }
 
+   if (cache != NULL) {
+      return fillFromCache() ;
+   }
 
    while(true) {    // keep reading until empty line read or eof
 
-      // get one line from standard in
+      // get one line of input. if eof encountered, return to
+      // mainLoop, but say no more input available
       //
-      getline(istrm, line) ;   
+      if ( !input->line(line, len) ) {
+         return false ;
+      }
+      lineNo++ ;
 
       // if "normal" empty line encountered, return to mainLoop
       //
-      if ( line.empty() && !istrm.eof() ) {
+      if ( len == 0 ) {
          return true ;
       }
 
-      // if eof encountered, return to mainLoop, but say no more
-      // input available
-      //
-      if ( istrm.eof() )  {
-         return false ;
-      }
+      lexLine(line, len, lineNo, tkBuffer) ;
+   }
+}
 
 
-      // Process line read
+// fillBuffer() with a compile cache: read the whole paragraph,
+// then take its tokens from the cache.
+//
+bool Sally::fillFromCache() {
+   const char *line ;
+   size_t len ;
+   bool more ;
+
+   paragraph.clear() ;
+   while ( (more = input->line(line, len)) && len != 0 ) {
+      paragraph.append(line, len) ;
+      paragraph.push_back('\n') ;
+   }
+
+   if ( !paragraph.empty() ) {
+      bool hit ;
+      lineNo += cache->lex(paragraph.data(), paragraph.size(), lineNo, tkBuffer, hit, cacheCursor) ;
+      (hit ? stats.cacheHits : stats.cacheMisses).add(1) ;
+   }
+   if (more) lineNo++ ;      // the empty line
+   return more ;
+}
 
-      pos = 0 ;                      // start from the beginning
 
-      // skip over initial spaces & tabs
+// Split one line into tokens, appending them to tokens.
+// 
+// Processing done by lexLine()
+//   - detects and ignores comments.
+//   - detects string literals and combines as 1 token
+//   - detetcs base 10 numbers
+//   - recognizes builtin words
+// 
+//
+void Sally::lexLine(const char *line, size_t size, int lineNo, vector<Token>& tokens) {
+   int pos ;         // current position in the line
+   int len ;         // # of char in current token
+   long long n ;     // int value of token
+   char *endPtr ;    // used with strtoll()
+   size_t first = tokens.size() ;   // first token from this line
+   SallyText whole ;              // the line, once a long token needs it
+
+   // line[i], or '\0' past its end
+   //
+   auto at = [&](int i) { return (size_t) i < size ? line[i] : '\0' ; } ;
+
+   // text of line[p] .. line[p+n-1]. Long ones are slices
+   // of one shared copy of the line.
+   //
+   auto text = [&](int p, int n) {
+      if ((size_t) n <= TEXT_INLINE) return SallyText(line + p, n) ;
+      if (whole.empty()) whole = SallyText(line, size) ;
+      return whole.substr(p, n) ;
+   } ;
+
+   pos = 0 ;                      // start from the beginning
+
+   // skip over initial spaces & tabs
+   //
+   while( at(pos) != '\0' && (at(pos) == ' ' || at(pos) == '\t') ) {
+      pos++ ; 
+   }
+
+   // Keep going until end of line
+   //
+   while (at(pos) != '\0') {
+
+      // is it a comment?? skip rest of line.
       //
-      while( line[pos] != '\0' && (line[pos] == ' ' || line[pos] == '\t') ) {
-         pos++ ; 
-      }
+      if (at(pos) == '/' && at(pos+1) == '/') break ;
 
-      // Keep going until end of line
+      // is it a string literal? 
       //
-      while (line[pos] != '\0') {
+      if (at(pos) == '.' && at(pos+1) == '"') {
+
+         pos += 2 ;  // skip over the ."
+         len = 0 ;   // track length of literal
 
-         // is it a comment?? skip rest of line.
+         // look for matching quote or end of line
          //
-         if (line[pos] == '/' && line[pos+1] == '/') break ;
+         while(at(pos+len) != '\0' && at(pos+len) != '"') {
+            len++ ;
+         }
 
-         // is it a string literal? 
+         // Add to token list, its text being characters
+         // line[pos] to line[pos+len-1]
          //
-         if (line[pos] == '.' && line[pos+1] == '"') {
+         tokens.push_back( Token(STRING,0,text(pos,len)) ) ;
 
-            pos += 2 ;  // skip over the ."
-            len = 0 ;   // track length of literal
+         // Different update if end reached or " found
+         //
+         if (at(pos+len) == '\0') {
+            pos = pos + len ;
+         } else {
+            pos = pos + len + 1 ;
+         }
 
-            // look for matching quote or end of line
-            //
-            while(line[pos+len] != '\0' && line[pos+len] != '"') {
-               len++ ;
-            }
+      } else {  // otherwise "normal" token
 
-            // make new string with characters from
-            // line[pos] to line[pos+len-1]
-            string literal(line,pos,len) ;  // copy from pos for len chars
+         len = 0 ;  // track length of token
 
-            // Add to token list
-            //
-            tkBuffer.push_back( Token(STRING,0,literal) ) ;  
+         // line[pos] should be an non-white space character
+         // look for end of line or space or tab
+         //
+         while(at(pos+len) != '\0' && at(pos+len) != ' ' && at(pos+len) != '\t') {
+            len++ ;
+         }
+
+         string literal(line + pos, len) ;   // copy form pos for len chars
 
-            // Different update if end reached or " found
+         // Try to convert to a number
+         //
+         n = strtoll(literal.c_str(), &endPtr, 10) ;
+
+         if (*endPtr == '\0') {
+            tokens.push_back( Token(INTEGER,n,text(pos,len)) ) ;
+         } else {
+            // builtin words are recognized here, once,
+            // so mainLoop() can dispatch on the opcode
             //
-            if (line[pos+len] == '\0') {
-               pos = pos + len ;
-            } else {
-               pos = pos + len + 1 ;
+            Token tk(UNKNOWN,0,text(pos,len)) ;
+            int op = findOp(tk.m_text.data(), tk.m_text.size(), tk.m_hash) ;
+            if (op >= 0) {
+               tk.m_kind = KEYWORD ;
+               tk.m_value = op ;
             }
+            tokens.push_back(tk) ;
+         }
+         pos = pos + len ;
+      }
 
-         } else {  // otherwise "normal" token
+      // skip over trailing spaces & tabs
+      //
+      while( at(pos) != '\0' && (at(pos) == ' ' || at(pos) == '\t') ) {
+         pos++ ; 
+      }
 
-            len = 0 ;  // track length of token
+   }
 
-            // line[pos] should be an non-white space character
-            // look for end of line or space or tab
-            //
-            while(line[pos+len] != '\0' && line[pos+len] != ' ' && line[pos+len] != '\t') {
-               len++ ;
-            }
+   // remember where they came from, for error reports
+   //
+   for (size_t i = first ; i < tokens.size() ; i++) {
+      tokens[i].m_line = lineNo ;
+   }
+}
 
-            string literal(line,pos,len) ;   // copy form pos for len chars
-            pos = pos + len ;
 
-            // Try to convert to a number
-            //
-            n = strtol(literal.c_str(), &endPtr, 10) ;
 
-            if (*endPtr == '\0') {
-               tkBuffer.push_back( Token(INTEGER,n,literal) ) ;
-            } else {
-               tkBuffer.push_back( Token(UNKNOWN,0,literal) ) ;
-            }
-         }
+// preload() gives each thread at least this many bytes
+//
+const size_t LEX_CHUNK_MIN = 1 << 20 ;
 
-         // skip over trailing spaces & tabs
-         //
-         while( line[pos] != '\0' && (line[pos] == ' ' || line[pos] == '\t') ) {
-            pos++ ; 
-         }
 
+// one thread's share of preload()
+//
+struct LexChunk {
+   const char *m_begin ;    // whole lines, each ending in '\n'
+   const char *m_end ;
+   int m_lines ;            // number of the last line lexed
+   vector<Token> m_tokens ;
+   SallyCompileCache *m_cache ;   // NULL to lex every line
+   SallyCacheCursor m_cursor ;
+   uint64_t m_hits ;              // paragraphs m_cache had
+   uint64_t m_misses ;            // and did not
+} ;
+
+
+// lex the lines of a chunk, appending to its tokens, a
+// paragraph at a time through the cache if there is one
+//
+static void lexChunk(LexChunk& chunk) {
+   const char *p = chunk.m_begin ;
+
+   while (p < chunk.m_end) {
+      const char *nl = (const char *) memchr(p, '\n', chunk.m_end - p) ;
+
+      if (chunk.m_cache != NULL && nl != p) {
+         const char *end = nl + 1 ;
+         while (end < chunk.m_end && *end != '\n') {
+            end = (const char *) memchr(end, '\n', chunk.m_end - end) + 1 ;
+         }
+         bool hit ;
+         chunk.m_lines += chunk.m_cache->lex(p, end - p, chunk.m_lines, chunk.m_tokens, hit, chunk.m_cursor) ;
+         (hit ? chunk.m_hits : chunk.m_misses)++ ;
+         p = end ;
+         continue ;
       }
+
+      chunk.m_lines++ ;
+      Sally::lexLine(p, nl - p, chunk.m_lines, chunk.m_tokens) ;
+      p = nl + 1 ;
+   }
+}
+
+
+// where a chunk that should end at text[at] does end: after the
+// next '\n', or with a cache the next empty line, so the same
+// paragraphs are looked up however the text is split
+//
+static size_t chunkEnd(const char *text, size_t at, size_t size, bool paragraphs) {
+   while (at < size) {
+      const char *nl = (const char *) memchr(text + at, '\n', size - at) ;
+      at = nl - text + 1 ;
+      if (!paragraphs || at == size || text[at] == '\n') return at ;
    }
+   return size ;
 }
 
 
+// run f(0) .. f(n-1) at the same time, f(0) on this thread
+//
+template <class F>
+static void onThreads(size_t n, F f) {
+   vector<thread> workers ;
+
+   for (size_t i = 1 ; i < n ; i++) workers.push_back(thread(f, i)) ;
+   f(0) ;
+   for (size_t i = 0 ; i < workers.size() ; i++) workers[i].join() ;
+}
+
+
+// Lex the rest of the input into tkBuffer in parallel.
+//
+// The text is split into one chunk per thread at line
+// boundaries. Nothing in the grammar spans lines: ." strings
+// and // comments end with their line at the latest, so each
+// chunk lexes on its own exactly as fillBuffer() would have.
+// IFTHEN ... ELSE ... ENDIF and DO ... UNTIL are matched when
+// they run, by walking tkBuffer, so once the chunks' tokens are
+// put back in order it does not matter where the seams were.
+//
+void Sally::preload(unsigned threads) {
+   string storage ;
+   const char *text, *end ;
+   uint64_t t0 = clockNs() ;
+
+   // a file or buffer in memory is lexed where it is
+   //
+   input->rest(text, end, storage) ;
+
+   // like fillBuffer(), ignore a last line with no newline
+   //
+   size_t size = end - text ;
+   while (size > 0 && text[size - 1] != '\n') size-- ;
+
+   if (threads == 0) threads = thread::hardware_concurrency() ;
+   size_t n = min((size_t) threads, size / LEX_CHUNK_MIN) ;
+   if (n == 0) n = 1 ;
+
+   vector<LexChunk> chunks(n) ;
+   size_t from = 0 ;
+
+   for (size_t i = 0 ; i < n ; i++) {
+      size_t to = size ;
+      if (i + 1 < n && from < size) {
+         to = chunkEnd(text, max(from, size / n * (i + 1)), size, cache != NULL) ;
+      }
+      chunks[i].m_begin = text + from ;
+      chunks[i].m_end = text + to ;
+      chunks[i].m_lines = 0 ;
+      chunks[i].m_cache = cache ;
+      chunks[i].m_hits = 0 ;
+      chunks[i].m_misses = 0 ;
+      from = to ;
+   }
+
+   // the first chunk goes straight onto the end of tkBuffer.
+   // the others number their lines from 1, fixed up below
+   //
+   size_t had = tkBuffer.size() ;
+   chunks[0].m_tokens.swap(tkBuffer) ;
+   chunks[0].m_lines = lineNo ;
+
+   onThreads(n, [&chunks](size_t i) { lexChunk(chunks[i]) ; }) ;
+
+   chunks[0].m_tokens.swap(tkBuffer) ;
+   int lines = chunks[0].m_lines ;
+
+   // stitch the rest on in order
+   //
+   size_t total = tkBuffer.size() ;
+   for (size_t i = 1 ; i < n ; i++) total += chunks[i].m_tokens.size() ;
+   stats.allocations.add(n) ;
+   tkBuffer.reserve(total) ;
+
+   for (size_t i = 1 ; i < n ; i++) {
+      vector<Token>& tokens = chunks[i].m_tokens ;
+      for (size_t j = 0 ; j < tokens.size() ; j++) {
+         tokens[j].m_line += lines ;
+         tkBuffer.push_back(std::move(tokens[j])) ;
+      }
+      vector<Token>().swap(tokens) ;
+      lines += chunks[i].m_lines ;
+   }
+
+   for (size_t i = 0 ; i < n ; i++) {
+      stats.cacheHits.add(chunks[i].m_hits) ;
+      stats.cacheMisses.add(chunks[i].m_misses) ;
+   }
+
+   lineNo = lines ;
+   stats.tokensLexed.add(total - had) ;
+   stats.lexNs.add(clockNs() - t0) ;
+}
+
 
 // Return next token from tkBuffer.
 // Call fillBuffer() if needed.
-// Checks for end-of-file and throws exception 
+// At end-of-file sets status and returns noToken.
 //
-Token Sally::nextToken() {
-      Token tk ;
-      bool more = true ;
+const Token& Sally::nextToken() {
 
-      
+   while (true) {
 
-      while(more && tkBuffer.empty() ) {
-         more = fillBuffer() ;
+      // inside a word, run its code. falling off the
+      // end returns to the caller.
+      //
+      if ( !rstack.empty() ) {
+         Frame& f = rstack.back() ;
+         if (f.m_pc < f.m_code->size()) {
+            return (*f.m_code)[f.m_pc++] ;
+         }
+         popFrame() ;
+         continue ;
       }
 
-      if ( !more && tkBuffer.empty() ) {
-         throw EOProgram("End of Program") ;
+      if (pc < tkBuffer.size()) {
+         return tkBuffer[pc++] ;
       }
 
-      
-      tk = tkBuffer.front() ;
-      
-      if(recorder ==true){
-	toDoList[toDoList.size()-1].push_back(tk);
+      if ( !readMore() ) {
+         status = SALLY_END ;
+         return noToken ;
       }
+   }
+}
+
+
+// Lex more input onto tkBuffer, dropping what has been run if
+// no loop can jump back into it. False at end of input.
+// Kept out of nextToken() so its fast path stays small.
+//
+bool Sally::readMore() {
+   // everything read so far has been run. keep it only
+   // if a loop might jump back into it.
+   //
+   if ( loops.empty() && cloops.empty() ) {
+      if (jit != NULL) jit->forget(&tkBuffer) ;
+      tkBuffer.clear() ;
+      pc = 0 ;
+   }
 
-      tkBuffer.pop_front() ;
-      return tk ;
+   size_t had = tkBuffer.size() ;
+   size_t room = tkBuffer.capacity() ;
+   bool more = true ;
+   uint64_t t0 = clockNs() ;
+
+   while(more && tkBuffer.size() == had) {
+      more = fillBuffer() ;
+   }
+
+   uint64_t t = clockNs() - t0 ;
+   stats.lexNs.add(t) ;
+   stats.lexBatchNs.add(t) ;
+   stats.tokensLexed.add(tkBuffer.size() - had) ;
+   if (tkBuffer.capacity() != room) stats.allocations.add(1) ;
+
+   return tkBuffer.size() != had ;
 }
 
 
+// the vector under a parameter stack, which std::stack keeps
+// in its protected member c
+//
+struct StackContents : stack<Token, vector<Token> > {
+   static const vector<Token>& of(const stack<Token, vector<Token> >& s) {
+      return s.*&StackContents::c ;
+   }
+} ;
+
+
 // The main interpreter loop of the Sally Forth interpreter.
 // It gets a token and either push the token onto the parameter
 // stack or looks for it in the symbol table.
 //
+// Errors come back as status rather than exceptions. The
+// catch blocks are for what still throws: checked arithmetic,
+// running out of memory.
 //
 void Sally::mainLoop() {
 
-   Token tk ;
-   map<string,SymTabEntry>::iterator it ;
+   SymTabEntry *entry ;
+   string word ;       // word being run when the program stopped
+   int line = 0 ;      // and its line
+   int op = -1 ;
+
+   status = SALLY_OK ;
+
+   uint64_t t0 = clockNs() ;
+   uint64_t deadline = timeLimit > 0 ? t0 + timeLimit : 0 ;
+   uint64_t lexed = stats.lexNs.get() ;
+   size_t peak = stats.peakDepth.get() ;
+   size_t room = StackContents::of(params).capacity() ;
+   uint64_t ran = 0 ;     // tokens run, not yet in stats
+   stats.runs.add(1) ;
+
+   // a new deepest stack, and did the stack's storage grow
+   // to hold it
+   //
+   auto notePeak = [&]() {
+      peak = params.size() ;
+      stats.peakDepth.set(peak) ;
+      if (StackContents::of(params).capacity() != room) {
+         room = StackContents::of(params).capacity() ;
+         stats.allocations.add(1) ;
+      }
+   } ;
 
    try {
       while( 1 ) {
-         tk = nextToken() ;
+         const Token& tk = nextToken() ;
+         if (status != SALLY_OK) break ;   // end of input
+
+         if ((++ran & (METRIC_BATCH - 1)) == 0) {
+            stats.instructions.add(METRIC_BATCH) ;
+            if (deadline != 0 && clockNs() > deadline) {
+               fail(SALLY_ERROR, "Time limit exceeded??") ;
+               op = -1 ;
+               word = tk.m_text.str() ;
+               line = tk.m_line ;
+               break ;
+            }
+         }
+         if (params.size() > peak) notePeak() ;
+
          if (tk.m_kind == INTEGER || tk.m_kind == STRING) {
 
             // if INTEGER or STRING just push onto stack
+            if (trace != NULL) trace->record(TRACE_PUSH, tk.m_line, tk.m_value, rstack.size()) ;
             params.push(tk) ;
 
+         } else if (tk.m_kind == KEYWORD) {
+
+            // check the stack effect, then
+            // invoke the function for this operation
+            //
+            op = tk.m_value ;
+            line = tk.m_line ;
+            if (trace != NULL) {
+               trace->record(op, line, params.empty() ? 0 : params.top().m_value, rstack.size()) ;
+            }
+            if ( (int) params.size() < opTable[op].m_pops ) {
+               fail(SALLY_UNDERFLOW, UNDERFLOW_MESSAGE) ;
+               break ;
+            }
+            SallyBuiltins::handlers[op](this) ;
+            if (status != SALLY_OK) break ;
+
          } else { 
-            it = symtab.find(tk.m_text) ;
+            entry = symtab->find(tk) ;
+
+            if (trace != NULL && (entry == NULL || entry->m_kind != WORD)) {
+               trace->record(TRACE_PUSH, tk.m_line, tk.m_value, rstack.size()) ;
+            }
             
-            if ( it == symtab.end() )  {   // not in symtab
+            if ( entry == NULL )  {   // not in symtab
 
                params.push(tk) ;
 
-            } else if (it->second.m_kind == KEYWORD)  {
-
-               // invoke the function for this operation
-               //
-               it->second.m_dothis(this) ;   
-               
-            } else if (it->second.m_kind == VARIABLE) {
+            } else if (entry->m_kind == VARIABLE) {
 
                // variables are pushed as tokens
                //
-               tk.m_kind = VARIABLE ;
                params.push(tk) ;
+               params.top().m_kind = VARIABLE ;
+
+            } else if (entry->m_kind == WORD) {
+
+               // call a word: run its code until it falls off the end.
+               // a word that has nothing left to run is done
+               // already, so a call at its very end replaces it.
+               //
+               if ( !rstack.empty() && rstack.back().m_pc == rstack.back().m_code->size() ) {
+                  popFrame() ;
+               }
+               if (rstack.size() >= MAX_RSTACK) {
+                  fail(SALLY_ERROR, "Return stack overflow??") ;
+                  op = -1 ;
+                  word = tk.m_text.str() ;
+                  line = tk.m_line ;
+                  break ;
+               }
+               if (trace != NULL) {
+                  trace->call(tk.m_text.data(), tk.m_text.size(), tk.m_hash, tk.m_line,
+                              params.empty() ? 0 : params.top().m_value, rstack.size()) ;
+               }
+               Frame f = { entry->m_code.get(), 0, loops.size(), cloops.size() } ;
+               if (rstack.size() == rstack.capacity()) stats.allocations.add(1) ;
+               rstack.push_back(f) ;
+               stats.wordCalls.add(1) ;
 
             } else {
 
@@ -290,40 +1055,133 @@ void Sally::mainLoop() {
          }
       }
 
-   } catch (EOProgram& e) {
+   } catch (out_of_range& e) {
+      fail(SALLY_UNDERFLOW, UNDERFLOW_MESSAGE) ;
+   } catch (runtime_error& e) {
+      fail(SALLY_ERROR, e.what()) ;
+   } catch (...) {
+      fail(SALLY_ERROR, "Unexpected exception caught") ;
+   }
+
+   // take back whatever the reader read ahead, so a later run
+   // carries on from there and the stream is left alone until then
+   //
+   if (prefetch != NULL) {
+      size_t had = tkBuffer.size() ;
+      prefetch->stop(lineNo, tkBuffer) ;
+      stats.tokensLexed.add(tkBuffer.size() - had) ;
+   }
+
+   if (params.size() > peak) notePeak() ;
+   stats.instructions.add(ran & (METRIC_BATCH - 1)) ;
+   SallyMetrics::processInstructions.fetch_add(ran, memory_order_relaxed) ;
+
+   uint64_t t = clockNs() - t0 ;
+   stats.execNs.add(t - (stats.lexNs.get() - lexed)) ;
+   stats.runNs.add(t) ;
+   stats.symtabSize.set(symtab->size()) ;
+   if (status != SALLY_END) stats.errors.add(1) ;
+
+   if (op >= 0) word = opTable[op].m_name ;
+   stopped(word, line) ;
+
+   if (trace != NULL && status != SALLY_END) trace->dump(TRACE_ON_ERROR) ;
+
+   // the program is over, forget any words and loops it was in
+   //
+   rstack.clear() ;
+   dropLoops(0, 0) ;
+}
 
-      cerr << "End of Program\n" ;
+
+
+
+void Sally::fail(SallyStatus why, const char *message) {
+   status = why ;
+   error.m_message = message ;
+}
+
+
+// Record how the program ended in error and report it
+// on estrm the way mainLoop() always has.
+//
+void Sally::stopped(const string& word, int line) {
+   error.m_status = status ;
+   error.m_stack.clear() ;
+
+   if (status == SALLY_END) {
+      error.m_message = "End of Program" ;
+      error.m_word.clear() ;
+      error.m_line = 0 ;
+
+      *estrm << "End of Program\n" ;
       if ( params.size() == 0 ) {
-         cerr << "Parameter stack empty.\n" ;
+         *estrm << "Parameter stack empty.\n" ;
       } else {
-         cerr << "Parameter stack has " << params.size() << " token(s).\n" ;
+         *estrm << "Parameter stack has " << params.size() << " token(s).\n" ;
       }
+      return ;
+   }
 
-   } catch (out_of_range& e) {
+   error.m_word = word ;
+   error.m_line = line ;
 
-      cerr << "Parameter stack underflow??\n" ;
+   // the top of the stack, without disturbing it
+   //
+   const vector<Token>& all = StackContents::of(params) ;
+   for (size_t i = 0 ; i < all.size() && i < ERROR_STACK ; i++) {
+      error.m_stack.push_back(all[all.size() - 1 - i]) ;
+   }
+
+   *estrm << error.m_message << "\n" ;
+}
+
+
+// Return from a word. Loops it left unfinished are dropped.
+//
+void Sally::dropLoops(size_t keepDo, size_t keepFor) {
+   for (size_t i = keepDo ; i < loops.size() ; i++) {
+      stats.loopIterations(loops[i].m_line, loops[i].m_runs) ;
+   }
+   loops.resize(keepDo) ;
+
+   for (size_t i = keepFor ; i < cloops.size() ; i++) {
+      stats.loopIterations(cloops[i].m_line, cloops[i].m_runs) ;
+   }
+   cloops.resize(keepFor) ;
+}
 
-   } catch (...) {
 
-      cerr << "Unexpected exception caught\n" ;
+void Sally::endLoop() {
+   if (memo != NULL) memo->loopExit(this) ;
+   dropLoops(loops.size() - 1, cloops.size()) ;
+}
 
+
+void Sally::popFrame() {
+   if (trace != NULL) {
+      trace->record(TRACE_RETURN, 0, params.empty() ? 0 : params.top().m_value, rstack.size()) ;
    }
+   dropLoops(rstack.back().m_loopBase, rstack.back().m_cloopBase) ;
+   rstack.pop_back() ;
 }
 
 // -------------------------------------------------------
+//
+// Handlers for the builtin words. mainLoop() has already checked
+// that the parameter stack holds at least the opTable m_pops
+// parameters for the word.
+//
 
 
 void Sally::doPlus(Sally *Sptr) {
    Token p1, p2 ;
 
-   if ( Sptr->params.size() < 2 ) {
-      throw out_of_range("Need two parameters for +.") ;
-   }
    p1 = Sptr->params.top() ;
    Sptr->params.pop() ;
    p2 = Sptr->params.top() ;
    Sptr->params.pop() ;
-   int answer = p2.m_value + p1.m_value ;
+   Cell answer = applyBinary(OP_PLUS, p2.m_value, p1.m_value) ;
    Sptr->params.push( Token(INTEGER, answer, "") ) ;
 }
 
@@ -331,14 +1189,11 @@ void Sally::doPlus(Sally *Sptr) {
 void Sally::doMinus(Sally *Sptr) {
    Token p1, p2 ;
 
-   if ( Sptr->params.size() < 2 ) {
-      throw out_of_range("Need two parameters for -.") ;
-   }
    p1 = Sptr->params.top() ;
    Sptr->params.pop() ;
    p2 = Sptr->params.top() ;
    Sptr->params.pop() ;
-   int answer = p2.m_value - p1.m_value ;
+   Cell answer = applyBinary(OP_MINUS, p2.m_value, p1.m_value) ;
    Sptr->params.push( Token(INTEGER, answer, "") ) ;
 }
 
@@ -346,14 +1201,11 @@ void Sally::doMinus(Sally *Sptr) {
 void Sally::doTimes(Sally *Sptr) {
    Token p1, p2 ;
 
-   if ( Sptr->params.size() < 2 ) {
-      throw out_of_range("Need two parameters for *.") ;
-   }
    p1 = Sptr->params.top() ;
    Sptr->params.pop() ;
    p2 = Sptr->params.top() ;
    Sptr->params.pop() ;
-   int answer = p2.m_value * p1.m_value ;
+   Cell answer = applyBinary(OP_TIMES, p2.m_value, p1.m_value) ;
    Sptr->params.push( Token(INTEGER, answer, "") ) ;
 }
 
@@ -361,14 +1213,11 @@ void Sally::doTimes(Sally *Sptr) {
 void Sally::doDivide(Sally *Sptr) {
    Token p1, p2 ;
 
-   if ( Sptr->params.size() < 2 ) {
-      throw out_of_range("Need two parameters for /.") ;
-   }
    p1 = Sptr->params.top() ;
    Sptr->params.pop() ;
    p2 = Sptr->params.top() ;
    Sptr->params.pop() ;
-   int answer = p2.m_value / p1.m_value ;
+   Cell answer = applyBinary(OP_DIVIDE, p2.m_value, p1.m_value) ;
    Sptr->params.push( Token(INTEGER, answer, "") ) ;
 }
 
@@ -376,14 +1225,11 @@ void Sally::doDivide(Sally *Sptr) {
 void Sally::doMod(Sally *Sptr) {
    Token p1, p2 ;
 
-   if ( Sptr->params.size() < 2 ) {
-      throw out_of_range("Need two parameters for %.") ;
-   }
    p1 = Sptr->params.top() ;
    Sptr->params.pop() ;
    p2 = Sptr->params.top() ;
    Sptr->params.pop() ;
-   int answer = p2.m_value % p1.m_value ;
+   Cell answer = applyBinary(OP_MOD, p2.m_value, p1.m_value) ;
    Sptr->params.push( Token(INTEGER, answer, "") ) ;
 }
 
@@ -391,53 +1237,65 @@ void Sally::doMod(Sally *Sptr) {
 void Sally::doNEG(Sally *Sptr) {
    Token p ;
 
-   if ( Sptr->params.size() < 1 ) {
-      throw out_of_range("Need one parameter for NEG.") ;
-   }
    p = Sptr->params.top() ;
    Sptr->params.pop() ;
-   Sptr->params.push( Token(INTEGER, -p.m_value, "") ) ;
+   Sptr->params.push( Token(INTEGER, applyUnary(OP_NEG, p.m_value), "") ) ;
+}
+
+
+// characters . prints for n
+//
+static size_t decimalLength(Cell n) {
+   size_t len = n < 0 ? 2 : 1 ;
+   for (Cell rest = n / 10 ; rest != 0 ; rest /= 10) len++ ;
+   return len ;
 }
 
 
 void Sally::doDot(Sally *Sptr) {
 
    Token p ;
-   if ( Sptr->params.size() < 1 ) {
-      throw out_of_range("Need one parameter for .") ;
-   }
 
-   p = Sptr->params.top() ;
+   p = move(Sptr->params.top()) ;
    Sptr->params.pop() ;
 
    if (p.m_kind == INTEGER) {
-      cout << p.m_value ;
+      *Sptr->ostrm << p.m_value ;
+      Sptr->stats.bytesOut.add(decimalLength(p.m_value)) ;
    } else {
-      cout << p.m_text ;
+      *Sptr->ostrm << p.m_text ;
+      Sptr->stats.bytesOut.add(p.m_text.size()) ;
    }
 }
 
 
 void Sally::doSP(Sally *Sptr) {
-   cout << " " ;
+   *Sptr->ostrm << " " ;
+   Sptr->stats.bytesOut.add(1) ;
 }
 
 
 void Sally::doCR(Sally *Sptr) {
-   cout << endl ;
+   *Sptr->ostrm << endl ;
+   Sptr->stats.bytesOut.add(1) ;
 }
 
 void Sally::doDUMP(Sally *Sptr) {
-   // do whatever for debugging
+   // write the trace so far, when tracing
+   if (Sptr->trace != NULL) Sptr->trace->dump(TRACE_ON_DUMP) ;
+
+   // and how the loop memo is doing, when there is one
+   if (Sptr->memo != NULL) {
+      *Sptr->estrm << "Loop memo: " << Sptr->memo->hits() << " hit(s), "
+                   << Sptr->memo->misses() << " miss(es), "
+                   << Sptr->memo->size() << " result(s) kept.\n" ;
+   }
 } 
 
 
 void Sally::doDUP(Sally *Sptr) {
   Token p;
 
-  if (Sptr->params.size() < 1) {
-    throw out_of_range("Need atleast one parameter for DUP");
-  }
 
   p = Sptr->params.top();
   //add a copy of the item on the top of the stack to the top of the stack
@@ -446,9 +1304,6 @@ void Sally::doDUP(Sally *Sptr) {
 
 void Sally::doDROP(Sally *Sptr) {
 
-  if (Sptr->params.size() < 1) {
-    throw out_of_range("Need atleast one parameter for DROP");
-  }
 
   Sptr->params.pop();
 }
@@ -457,21 +1312,18 @@ void Sally::doSWAP(Sally *Sptr) {
   Token p;
   Token q;
 
-  if (Sptr->params.size() < 2) {
-    throw out_of_range("Need atleast two parameters for DUP");
-  }
 
   //take two items off the top of the stack
-  p = Sptr->params.top();
+  p = move(Sptr->params.top());
   Sptr->params.pop();
 
-  q = Sptr->params.top();
+  q = move(Sptr->params.top());
   Sptr->params.pop();
 
   //push them back in, with the first one now.
   //previous: p,q,stack...
-  Sptr->params.push(p);
-  Sptr->params.push(q);
+  Sptr->params.push(move(p));
+  Sptr->params.push(move(q));
   //now: q,p,stack...
 
 }
@@ -481,25 +1333,22 @@ void Sally::doROT(Sally *Sptr) {
   Token q;
   Token r;
 
-  if (Sptr->params.size() < 3) {
-    throw out_of_range("Need atleast three parameters for SWAP");
-  }
 
   //take two items off the top of the stack
-  p = Sptr->params.top();
+  p = move(Sptr->params.top());
   Sptr->params.pop();
 
-  q = Sptr->params.top();
+  q = move(Sptr->params.top());
   Sptr->params.pop();
 
-  r = Sptr->params.top();
+  r = move(Sptr->params.top());
   Sptr->params.pop();
 
   //push them back in, with the first one now.
   //previous: p,q,r,  stack...
-  Sptr->params.push(q);
-  Sptr->params.push(p);
-  Sptr->params.push(r);
+  Sptr->params.push(move(q));
+  Sptr->params.push(move(p));
+  Sptr->params.push(move(r));
 
   //now: q,p,stack...
 
@@ -509,9 +1358,6 @@ void Sally::doROT(Sally *Sptr) {
 void Sally::checkEE(Sally *Sptr) {
   Token p1, p2;
 
-  if (Sptr->params.size() < 2) {
-    throw out_of_range("Need two parameters for ==");
-  }
   p1 = Sptr->params.top();
   Sptr->params.pop();
   p2 = Sptr->params.top();
@@ -519,16 +1365,13 @@ void Sally::checkEE(Sally *Sptr) {
 
   //should i check for text or value here?
   //settling for value since the documentation doesn't mention comparing text
-  int answer = (p2.m_value == p1.m_value);
+  Cell answer = applyBinary(OP_EE, p2.m_value, p1.m_value);
   Sptr->params.push(Token(INTEGER, answer, ""));
 }
 
 void Sally::checkNE(Sally *Sptr) {
   Token p1, p2;
 
-  if (Sptr->params.size() < 2) {
-    throw out_of_range("Need two parameters for !=");
-  }
   p1 = Sptr->params.top();
   Sptr->params.pop();
   p2 = Sptr->params.top();
@@ -536,16 +1379,13 @@ void Sally::checkNE(Sally *Sptr) {
 
   //should i check for text or value here?
   //settling for value since the documentation doesn't mention comparing text
-  int answer = (p2.m_value != p1.m_value);
+  Cell answer = applyBinary(OP_NE, p2.m_value, p1.m_value);
   Sptr->params.push(Token(INTEGER, answer, ""));
 }
 
 void Sally::checkLT(Sally *Sptr) {
   Token p1, p2;
 
-  if (Sptr->params.size() < 2) {
-    throw out_of_range("Need two parameters for <");
-  }
   p1 = Sptr->params.top();
   Sptr->params.pop();
   p2 = Sptr->params.top();
@@ -553,23 +1393,20 @@ void Sally::checkLT(Sally *Sptr) {
 
 
   //settling for value since the documentation doesn't mention comparing text
-  int answer = (p2.m_value < p1.m_value);
+  Cell answer = applyBinary(OP_LT, p2.m_value, p1.m_value);
   Sptr->params.push(Token(INTEGER, answer, ""));
 }
 
 void Sally::checkLTE(Sally *Sptr) {
   Token p1, p2;
 
-  if (Sptr->params.size() < 2) {
-    throw out_of_range("Need two parameters for <=");
-  }
   p1 = Sptr->params.top();
   Sptr->params.pop();
   p2 = Sptr->params.top();
   Sptr->params.pop();
 
   //settling for value since the documentation doesn't mention comparing text
-  int answer = (p2.m_value <= p1.m_value);
+  Cell answer = applyBinary(OP_LTE, p2.m_value, p1.m_value);
   Sptr->params.push(Token(INTEGER, answer, ""));
 }
 
@@ -577,32 +1414,26 @@ void Sally::checkLTE(Sally *Sptr) {
 void Sally::checkGT(Sally *Sptr) {
   Token p1, p2;
 
-  if (Sptr->params.size() < 2) {
-    throw out_of_range("Need two parameters for >");
-  }
   p1 = Sptr->params.top();
   Sptr->params.pop();
   p2 = Sptr->params.top();
   Sptr->params.pop();
 
   //settling for value since the documentation doesn't mention comparing text
-  int answer = (p2.m_value > p1.m_value);
+  Cell answer = applyBinary(OP_GT, p2.m_value, p1.m_value);
   Sptr->params.push(Token(INTEGER, answer, ""));
 }
 
 void Sally::checkGTE(Sally *Sptr) {
   Token p1, p2;
 
-  if (Sptr->params.size() < 2) {
-    throw out_of_range("Need two parameters for >=");
-  }
   p1 = Sptr->params.top();
   Sptr->params.pop();
   p2 = Sptr->params.top();
   Sptr->params.pop();
 
   //settling for value since the documentation doesn't mention comparing text
-  int answer = (p2.m_value >= p1.m_value);
+  Cell answer = applyBinary(OP_GTE, p2.m_value, p1.m_value);
   Sptr->params.push(Token(INTEGER, answer, ""));
 }
 
@@ -610,28 +1441,19 @@ void Sally::checkGTE(Sally *Sptr) {
 void Sally::doSET(Sally *Sptr) {
   Token p1, p2;
 
-  if (Sptr->params.size() < 2) {
-    throw out_of_range("Need two parameters for SET");
-  }
-
-
   p1 = Sptr->params.top();
   Sptr->params.pop();
   p2 = Sptr->params.top();
   Sptr->params.pop();
 
-  map<string,SymTabEntry>::iterator it ;
-  it =  Sptr->symtab.find(p1.m_text);
-
   //if the variable is not already in the symbol table then add it to the symbol table
-  if(it == Sptr->symtab.end()){
-    string newVar = p1.m_text;
-    Sptr->symtab[newVar] = SymTabEntry(VARIABLE,p2.m_value,NULL);
+  if(Sptr->symtab->find(p1) == NULL){
+    Sptr->ownSymtab().insert(p1.m_text, p1.m_hash, SymTabEntry(VARIABLE,p2.m_value,NULL));
   }
   
   //otherwise say that the variable is already defined
   else{
-    cout<< "variable: " << p1.m_text<< "has already been set"<< endl;
+    *Sptr->ostrm << "variable: " << p1.m_text<< "has already been set"<< endl;
   }
 
 }
@@ -640,25 +1462,24 @@ void Sally::doSET(Sally *Sptr) {
 void Sally::doAT(Sally *Sptr) {
   Token p1 ;
 
-  if (Sptr->params.size() < 1) {
-    throw out_of_range("Need atleast one parameters for @");
-  }
 
   //get the variable
   p1 = Sptr->params.top();
   Sptr->params.pop();
 
-  //make an iterator to search for the variable 
-  map<string,SymTabEntry>::iterator it ;
-  it =  Sptr->symtab.find(p1.m_text);
+  //search for the variable 
+  SymTabEntry *entry = Sptr->symtab->find(p1);
   
   //see if the variable is in the symbol table first, if not print error
-  if(it == Sptr->symtab.end()){
-    cout<< "variable not found"<<endl;
+  //and use 0 as its value
+  if(entry == NULL || entry->m_kind != VARIABLE){
+    *Sptr->ostrm << "variable not found"<<endl;
+    Sptr->params.push( Token(INTEGER, 0, "") ) ;
+    return;
   }
 
   //otherwise the item is in the stack and we need to add teh value to the stack
-  Sptr->params.push( Token(INTEGER,it->second.m_value , "") ) ;
+  Sptr->params.push( Token(INTEGER,entry->m_value , "") ) ;
 
 }
 
@@ -667,9 +1488,6 @@ void Sally::doAT(Sally *Sptr) {
 void Sally::doEX(Sally *Sptr) {
   Token p1, p2;
 
-  if (Sptr->params.size() < 2) {
-    throw out_of_range("Need two parameters for !");
-  }
 
   //get teh variable and the value to set it to
   p1 = Sptr->params.top();
@@ -677,57 +1495,260 @@ void Sally::doEX(Sally *Sptr) {
   p2 = Sptr->params.top();
   Sptr->params.pop();
 
-  //create an iterator to search for the variable
-  map<string,SymTabEntry>::iterator it ;
-  it =  Sptr->symtab.find(p1.m_text);
+  //search for the variable
+  SymTabEntry *entry = Sptr->symtab->find(p1);
 
   //if the variable is not already in the symbol table then add it to the symbol table
-  if(it == Sptr->symtab.end()){
-    cout<< "variable has not been declared yet"<< endl;
+  if(entry == NULL || entry->m_kind != VARIABLE){
+    *Sptr->ostrm << "variable has not been declared yet"<< endl;
   }
   
   //otherwise the variable exists and we can redefine its value
+  //(in our own copy of the table if it is shared)
   else{
-    string newVar = p1.m_text;
-    Sptr->symtab[newVar] = SymTabEntry(VARIABLE,p2.m_value,NULL);
+    if(Sptr->symtab->m_refs > 1){
+      entry = Sptr->ownSymtab().find(p1);
+    }
+    entry->m_value = p2.m_value;
+  }
+
+}
+
+
+// n NAME ARRAY makes an array of n zeros called NAME
+//
+void Sally::doARRAY(Sally *Sptr) {
+  Token p1, p2;
+
+  p1 = Sptr->params.top();
+  Sptr->params.pop();
+  p2 = Sptr->params.top();
+  Sptr->params.pop();
 
+  if(p2.m_value < 0){
+    Sptr->fail(SALLY_ERROR, "Array size out of range??");
+    return;
   }
 
+  //same rule as SET: a name can only be given a meaning once
+  if(Sptr->symtab->find(p1) == NULL){
+    SymTabEntry entry(ARRAY, 0, NULL);
+    entry.m_cells = make_shared< vector<Cell> >((size_t) p2.m_value, 0);
+    Sptr->stats.allocations.add(1);
+    Sptr->ownSymtab().insert(p1.m_text, p1.m_hash, entry);
+  }
+  else{
+    *Sptr->ostrm << "array: " << p1.m_text << " has already been set" << endl;
+  }
 }
 
 
-void Sally::doAND(Sally *Sptr) {
+// i NAME A@ pushes element i
+//
+void Sally::doAAT(Sally *Sptr) {
   Token p1, p2;
 
-  //ERRORCHECK
-  if (Sptr->params.size() < 2) {
-    throw out_of_range("Need two parameters for AND");
+  p1 = Sptr->params.top();
+  Sptr->params.pop();
+  p2 = Sptr->params.top();
+  Sptr->params.pop();
+
+  vector<Cell> *cells = Sptr->findArray(p1, false);
+  if(cells == NULL){
+    Sptr->params.push( Token(INTEGER, 0, "") ) ;
+    return;
+  }
+  if(p2.m_value < 0 || (size_t) p2.m_value >= cells->size()){
+    Sptr->fail(SALLY_ERROR, "Array index out of range??");
+    return;
   }
+  Sptr->params.push( Token(INTEGER, (*cells)[p2.m_value], "") ) ;
+}
+
+
+// v i NAME A! stores v as element i
+//
+void Sally::doAEX(Sally *Sptr) {
+  Token p1, p2, p3;
 
   p1 = Sptr->params.top();
   Sptr->params.pop();
   p2 = Sptr->params.top();
   Sptr->params.pop();
+  p3 = Sptr->params.top();
+  Sptr->params.pop();
 
-  //true only if p1 and p2 are true
-  if((p2.m_value == 1) and (p1.m_value == 1)){
-    //push a true onto the stack
-    Sptr->params.push(Token(INTEGER, 1, ""));    
+  vector<Cell> *cells = Sptr->findArray(p1, true);
+  if(cells == NULL) return;
+  if(p2.m_value < 0 || (size_t) p2.m_value >= cells->size()){
+    Sptr->fail(SALLY_ERROR, "Array index out of range??");
+    return;
   }
-  else{
-    //otherwise push a false onto the stack
-      Sptr->params.push(Token(INTEGER, 0, ""));
+  (*cells)[p2.m_value] = p3.m_value;
+}
+
+
+void Sally::doALEN(Sally *Sptr) {
+  Token p1;
+
+  p1 = Sptr->params.top();
+  Sptr->params.pop();
+
+  vector<Cell> *cells = Sptr->findArray(p1, false);
+  Sptr->params.push( Token(INTEGER, cells == NULL ? 0 : (Cell) cells->size(), "") ) ;
+}
+
+
+void Sally::doASUM(Sally *Sptr) {
+  Token p1;
+
+  p1 = Sptr->params.top();
+  Sptr->params.pop();
+
+  vector<Cell> *cells = Sptr->findArray(p1, false);
+  Cell sum = cells == NULL ? 0 : cellSum(cells->data(), cells->size());
+  Sptr->params.push( Token(INTEGER, sum, "") ) ;
+}
+
+
+void Sally::doAMIN(Sally *Sptr) {
+  Token p1;
+
+  p1 = Sptr->params.top();
+  Sptr->params.pop();
+
+  vector<Cell> *cells = Sptr->findArray(p1, false);
+  if(cells == NULL){
+    Sptr->params.push( Token(INTEGER, 0, "") ) ;
+    return;
   }
+  if(cells->empty()){
+    Sptr->fail(SALLY_ERROR, "Array is empty??");
+    return;
+  }
+  Sptr->params.push( Token(INTEGER, cellMin(cells->data(), cells->size()), "") ) ;
+}
+
+
+void Sally::doAMAX(Sally *Sptr) {
+  Token p1;
+
+  p1 = Sptr->params.top();
+  Sptr->params.pop();
+
+  vector<Cell> *cells = Sptr->findArray(p1, false);
+  if(cells == NULL){
+    Sptr->params.push( Token(INTEGER, 0, "") ) ;
+    return;
+  }
+  if(cells->empty()){
+    Sptr->fail(SALLY_ERROR, "Array is empty??");
+    return;
+  }
+  Sptr->params.push( Token(INTEGER, cellMax(cells->data(), cells->size()), "") ) ;
+}
+
+
+// v NAME AFILL sets every element to v
+//
+void Sally::doAFILL(Sally *Sptr) {
+  Token p1, p2;
+
+  p1 = Sptr->params.top();
+  Sptr->params.pop();
+  p2 = Sptr->params.top();
+  Sptr->params.pop();
+
+  vector<Cell> *cells = Sptr->findArray(p1, true);
+  if(cells == NULL) return;
+  cellFill(cells->data(), cells->size(), p2.m_value);
+}
+
+
+// SRC DST ACOPY copies as many elements as the shorter one has
+//
+void Sally::doACOPY(Sally *Sptr) {
+  Token p1, p2;
+
+  p1 = Sptr->params.top();
+  Sptr->params.pop();
+  p2 = Sptr->params.top();
+  Sptr->params.pop();
+
+  //find the destination first: making it our own may move the source
+  vector<Cell> *dst = Sptr->findArray(p1, true);
+  if(dst == NULL) return;
+  vector<Cell> *src = Sptr->findArray(p2, false);
+  if(src == NULL) return;
+
+  size_t n = min(src->size(), dst->size());
+  memmove(dst->data(), src->data(), n * sizeof(Cell));
+}
+
+
+// A B DST A+ and A B DST A* set DST[i] to A[i] + B[i] or A[i] * B[i],
+// for as many elements as the shortest of the three has
+//
+void Sally::doAPLUS(Sally *Sptr) {
+  Token p1, p2, p3;
+
+  p1 = Sptr->params.top();
+  Sptr->params.pop();
+  p2 = Sptr->params.top();
+  Sptr->params.pop();
+  p3 = Sptr->params.top();
+  Sptr->params.pop();
+
+  vector<Cell> *dst = Sptr->findArray(p1, true);
+  if(dst == NULL) return;
+  vector<Cell> *b = Sptr->findArray(p2, false);
+  if(b == NULL) return;
+  vector<Cell> *a = Sptr->findArray(p3, false);
+  if(a == NULL) return;
+
+  size_t n = min(dst->size(), min(a->size(), b->size()));
+  cellAdd(dst->data(), a->data(), b->data(), n);
+}
+
+void Sally::doATIMES(Sally *Sptr) {
+  Token p1, p2, p3;
+
+  p1 = Sptr->params.top();
+  Sptr->params.pop();
+  p2 = Sptr->params.top();
+  Sptr->params.pop();
+  p3 = Sptr->params.top();
+  Sptr->params.pop();
+
+  vector<Cell> *dst = Sptr->findArray(p1, true);
+  if(dst == NULL) return;
+  vector<Cell> *b = Sptr->findArray(p2, false);
+  if(b == NULL) return;
+  vector<Cell> *a = Sptr->findArray(p3, false);
+  if(a == NULL) return;
+
+  size_t n = min(dst->size(), min(a->size(), b->size()));
+  cellMul(dst->data(), a->data(), b->data(), n);
+}
+
+
+void Sally::doAND(Sally *Sptr) {
+  Token p1, p2;
+
+
+  p1 = Sptr->params.top();
+  Sptr->params.pop();
+  p2 = Sptr->params.top();
+  Sptr->params.pop();
+
+  //true only if p1 and p2 are true
+  Sptr->params.push(Token(INTEGER, applyBinary(OP_AND, p2.m_value, p1.m_value), ""));
 
 }
 
 void Sally::doOR(Sally *Sptr) {
   Token p1, p2;
 
-  //ERRORCHECK
-  if (Sptr->params.size() < 2) {
-    throw out_of_range("Need two parameters for OR");
-  }
 
   p1 = Sptr->params.top();
   Sptr->params.pop();
@@ -735,46 +1756,24 @@ void Sally::doOR(Sally *Sptr) {
   Sptr->params.pop();
 
   //false only if p1 and p2 are false
-  if((p2.m_value == 0) and (p1.m_value == 0)){
-    //push a false onto the stack
-    Sptr->params.push(Token(INTEGER, 0, ""));    
-  }
-  else{
-    //otherwise push a true onto the stack
-      Sptr->params.push(Token(INTEGER, 1, ""));
-  }
+  Sptr->params.push(Token(INTEGER, applyBinary(OP_OR, p2.m_value, p1.m_value), ""));
 
 }
 
 void Sally::doNOT(Sally *Sptr) {
   Token p1;
 
-  //ERRORCHECK
-  if (Sptr->params.size() < 1) {
-    throw out_of_range("Need atleast one parameters for NOT");
-  }
 
   p1 = Sptr->params.top();
   Sptr->params.pop();
 
-  //if p1 = 0 , set to 1
-  if((p1.m_value == 0)){
-    //push a 1 onto the stack
-    Sptr->params.push(Token(INTEGER, 1, ""));    
-  }
-  else{
-    //otherwise push a 0 onto the stack
-      Sptr->params.push(Token(INTEGER, 0, ""));
-  }
+  //if p1 = 0 , set to 1, otherwise 0
+  Sptr->params.push(Token(INTEGER, applyUnary(OP_NOT, p1.m_value), ""));
 }
 
 void Sally::doIFTHEN(Sally *Sptr) {
   Token p1;
 
-  //ERRORCHECK
-  if (Sptr->params.size() < 1) {
-    throw out_of_range("Need atleast one parameter for IFTHEN");
-  }
 
   p1 = Sptr->params.top();
   Sptr->params.pop();
@@ -797,11 +1796,14 @@ void Sally::doIFTHEN(Sally *Sptr) {
     while(notDone){
 
       tk = Sptr->nextToken();
+      if(Sptr->status != SALLY_OK){
+        return;
+      }
     
-      if(tk.m_text == "IFTHEN"){
+      if(tk.m_kind == KEYWORD && tk.m_value == OP_IFTHEN){
 	myCounter++;
 	}
-      else if( tk.m_text == "ELSE"){
+      else if(tk.m_kind == KEYWORD && tk.m_value == OP_ELSE){
 	myCounter--;
       }
       if(myCounter<0){
@@ -825,9 +1827,12 @@ void Sally::doELSE(Sally *Sptr) {
   Token tk = Token(INTEGER, 0, "");
     
     //consume tokens until endif
-    while(tk.m_text != "ENDIF"){
+    while(!(tk.m_kind == KEYWORD && tk.m_value == OP_ENDIF)){
       
       tk = Sptr->nextToken();
+      if(Sptr->status != SALLY_OK){
+        return;
+      }
       
     }
  //once the while loop stops running, it means we have consumed a matching endif
@@ -843,16 +1848,18 @@ void Sally::doENDIF(Sally *Sptr) {
 
 
 void Sally::doDO(Sally *Sptr) {
-  //set recording to true and clear the old list in case a previous loop
-  //happened
-
-  Sptr->recorder = true;
+  //remember where the body starts so UNTIL can jump back to it
+  size_t body = Sptr->curPc();
+  DoLoop dl = { body, (*Sptr->curCode())[body-1].m_line, 0 };
+  Sptr->loops.push_back(dl);
 
-  list<Token> anotherList;
-
-  Sptr-> toDoList.push_back(anotherList);
-  
+  if(Sptr->memo != NULL && Sptr->memo->loopEntry(Sptr)){
+    return;
+  }
 
+  if(Sptr->jit != NULL){
+    Sptr->jit->loopEntry(Sptr);
+  }
 }
 
 void Sally::doUNTIL(Sally *Sptr) {
@@ -862,22 +1869,212 @@ void Sally::doUNTIL(Sally *Sptr) {
   t1 = Sptr->params.top();
   Sptr->params.pop();
 
+  //an UNTIL without a DO (in this word) has nowhere to go back to
+  if(Sptr->loops.size() <= Sptr->loopBase()){
+    return;
+  }
+
+  size_t until = Sptr->curPc() - 1;
+  DoLoop& dl = Sptr->loops.back();
+  dl.m_runs++;
+
   //we continue the loop while the previous variable is false
   if(t1.m_value == 0){
+    Sptr->curPc() = dl.m_start;
+
+    if(Sptr->jit != NULL){
+      Sptr->jit->backEdge(Sptr, until);
+    }
+  }
+  else{
+    Sptr->endLoop();
+  }
+
+}
+
+
+// limit start FOR ... LOOP runs the body with I = start,
+// start+1, ..., limit-1. Like FORTH's ?DO the body is skipped
+// if start == limit, otherwise it runs at least once.
+//
+// limit start FOR ... step +LOOP adds step to I instead of 1.
+// With a negative step it counts down while I >= limit.
+//
+void Sally::doFOR(Sally *Sptr) {
+  Token start, limit;
+
+  start = Sptr->params.top();
+  Sptr->params.pop();
+  limit = Sptr->params.top();
+  Sptr->params.pop();
+
+  if(start.m_value != limit.m_value){
+    size_t body = Sptr->curPc();
+    CountedLoop cl = { start.m_value, limit.m_value, body, (*Sptr->curCode())[body - 1].m_line, 0 };
+    Sptr->cloops.push_back(cl);
+    return;
+  }
+
+  //nothing to do: skip to just past the matching LOOP or +LOOP
+  int depth = 0;
+  while(true){
+    const Token& tk = Sptr->nextToken();
+    if(Sptr->status != SALLY_OK){
+      return;
+    }
+    if(tk.m_kind != KEYWORD){
+      continue;
+    }
+    if(tk.m_value == OP_FOR){
+      depth++;
+    }
+    else if(tk.m_value == OP_LOOP || tk.m_value == OP_PLUSLOOP){
+      if(depth-- == 0){
+        break;
+      }
+    }
+  }
+}
+
+
+// bump the index and go around again while it is below the limit
+//
+void Sally::doLOOP(Sally *Sptr) {
+  if(Sptr->cloops.size() <= Sptr->cloopBase()){
+    return;
+  }
+
+  CountedLoop& cl = Sptr->cloops.back();
+  cl.m_runs++;
+  if(++cl.m_index < cl.m_limit){
+    Sptr->curPc() = cl.m_start;
+  }
+  else{
+    Sptr->dropLoops(Sptr->loops.size(), Sptr->cloops.size() - 1);
+  }
+}
 
-    //if we need to do the loop again we put the contents of the list into 
-    //the beginning of the buffer
-    Sptr->tkBuffer.splice(Sptr->tkBuffer.begin(), Sptr->toDoList[Sptr->toDoList.size()-1]);
 
+void Sally::doPLUSLOOP(Sally *Sptr) {
+  Token step;
+
+  step = Sptr->params.top();
+  Sptr->params.pop();
+
+  if(Sptr->cloops.size() <= Sptr->cloopBase()){
+    return;
+  }
+
+  CountedLoop& cl = Sptr->cloops.back();
+  cl.m_index += step.m_value;
+  cl.m_runs++;
+
+  bool again = (step.m_value >= 0) ? (cl.m_index < cl.m_limit) : (cl.m_index >= cl.m_limit);
+  if(again){
+    Sptr->curPc() = cl.m_start;
   }
   else{
+    Sptr->dropLoops(Sptr->loops.size(), Sptr->cloops.size() - 1);
+  }
+}
+
+
+// index of the innermost FOR loop. words see the index of
+// the loop they were called from.
+//
+void Sally::doI(Sally *Sptr) {
+  if(Sptr->cloops.size() < 1){
+    Sptr->fail(SALLY_UNDERFLOW, UNDERFLOW_MESSAGE);
+    return;
+  }
+  Sptr->params.push(Token(INTEGER, Sptr->cloops.back().m_index, ""));
+}
+
 
-    Sptr->toDoList.pop_back();
+// index of the next loop out
+//
+void Sally::doJ(Sally *Sptr) {
+  if(Sptr->cloops.size() < 2){
+    Sptr->fail(SALLY_UNDERFLOW, UNDERFLOW_MESSAGE);
+    return;
+  }
+  Sptr->params.push(Token(INTEGER, Sptr->cloops[Sptr->cloops.size()-2].m_index, ""));
+}
+
+
+// true if a word's body can be copied into its callers:
+// short, and no control flow that depends on where it runs
+//
+static bool canInline(const vector<Token>& code) {
+  if(code.size() > INLINE_MAX){
+    return false;
+  }
+  for(size_t i = 0; i < code.size(); i++){
+    if(code[i].m_kind == KEYWORD && opTable[code[i].m_value].m_flow){
+      return false;
+    }
+  }
+  return true;
+}
+
+
+void Sally::doCOLON(Sally *Sptr) {
+  //the name comes first, then the body up to the matching ;
+  Token name = Sptr->nextToken();
+  shared_ptr<vector<Token> > body(new vector<Token>);
+  if(Sptr->status != SALLY_OK){
+    return;
+  }
+  bool ok = (name.m_kind == UNKNOWN);
+
+  if(name.m_kind == KEYWORD && name.m_value == OP_SEMI){
+    *Sptr->ostrm << "cannot define word: ;" << endl;
+    return;
+  }
+
+  while(true){
+    const Token& tk = Sptr->nextToken();
+    if(Sptr->status != SALLY_OK){
+      return;
+    }
 
-    if(Sptr->toDoList.size() ==0){
-    Sptr->recorder = false;
+    if(tk.m_kind == KEYWORD && tk.m_value == OP_SEMI){
+      break;
+    }
+    if(tk.m_kind == KEYWORD && tk.m_value == OP_COLON){
+      //definitions do not nest
+      ok = false;
+    }
+
+    //small words that are already defined get copied in
+    if(tk.m_kind == UNKNOWN){
+      SymTabEntry *e = Sptr->symtab->find(tk);
+      if(e != NULL && e->m_kind == WORD && canInline(*e->m_code)){
+        body->insert(body->end(), e->m_code->begin(), e->m_code->end());
+        continue;
+      }
     }
+    body->push_back(tk);
   }
 
+  if(!ok){
+    *Sptr->ostrm << "cannot define word: " << name.m_text << endl;
+    return;
+  }
+
+  //like variables, words cannot be redefined
+  if(Sptr->symtab->find(name) != NULL){
+    *Sptr->ostrm << "word: " << name.m_text << " has already been defined" << endl;
+    return;
+  }
+
+  SymTabEntry entry(WORD, 0, NULL);
+  entry.m_code = body;
+  Sptr->stats.allocations.add(1);
+  Sptr->ownSymtab().insert(name.m_text, name.m_hash, entry);
+}
+
 
+void Sally::doSEMI(Sally *Sptr) {
+  //a ; outside of a definition does nothing
 }
@@ -8,25 +8,29 @@
 #ifndef _SALLY_H_
 #define _SALLY_H_
 
+#include <atomic>
 #include <iostream>
 #include <string>
-#include <list>
 #include <stack>
-#include <map>
 #include <stdexcept>
 #include <vector>
+#include <cstdint>
+#include <memory>
 using namespace std ;
 
+#include "SallyOps.h"
+#include "SallyJit.h"
+#include "SallyCompileCache.h"
+#include "SallyInput.h"
+#include "SallyMemo.h"
+#include "SallyMetrics.h"
+#include "SallyText.h"
+#include "SallyTrace.h"
 
-// thrown by lexical parser when end of file reached
-//
-class EOProgram : public runtime_error {
-public:
-   EOProgram(const string& what) : runtime_error(what) { }
-} ;
+class SallyPrefetch ;
 
 
-enum TokenKind { UNKNOWN, KEYWORD, INTEGER, VARIABLE, STRING } ;
+enum TokenKind { UNKNOWN, KEYWORD, INTEGER, VARIABLE, STRING, WORD, ARRAY } ;
 
 
 // lexical parser returns a token 
@@ -36,14 +40,42 @@ class Token {
 
 public:
 
-   Token(TokenKind kind=UNKNOWN, int val=0, string txt="" ) ;
+   Token(TokenKind kind=UNKNOWN, Cell val=0, const SallyText& txt=SallyText() ) ;
    TokenKind m_kind ;
-   int m_value ;      // if it's a known numeric value
-   string m_text ;    // original text that created this token
+   mutable uint32_t m_slot ;    // where SymTab::find() last found m_text
+   Cell m_value ;     // if it's a known numeric value, opcode for KEYWORD
+   SallyText m_text ; // original text that created this token
+   uint32_t m_hash ;  // symHash() of m_text
+   int m_line ;       // input line it was read from, 0 if computed
+   mutable uint64_t m_stamp ;   // SymTab::stamp() when it did, 0 if never
+
+} ;
+
+
+
+// how mainLoop() is getting on. Handlers report errors by
+// setting this with Sally::fail() rather than throwing, and
+// nextToken() sets SALLY_END when the input runs out.
+//
+enum SallyStatus { SALLY_OK, SALLY_END, SALLY_UNDERFLOW, SALLY_ERROR } ;
 
+
+// where and why the last program stopped
+//
+struct SallyError {
+   SallyStatus m_status ;
+   string m_message ;       // what mainLoop() printed for it
+   string m_word ;          // the word being run, empty at end of program
+   int m_line ;             // input line of that word, 0 if not known
+   vector<Token> m_stack ;  // top of the parameter stack, top first
 } ;
 
 
+// tokens of the parameter stack kept in SallyError::m_stack
+//
+const size_t ERROR_STACK = 8 ;
+
+
 
 // type of a C++ function that does the work 
 // of a Sally Forth operation.
@@ -57,10 +89,141 @@ typedef void (* operation_t)(Sally *Sptr) ;
 //
 class SymTabEntry {
 public:
-   SymTabEntry(TokenKind kind=UNKNOWN, int val=0, operation_t fptr=NULL) ;
+   SymTabEntry(TokenKind kind=UNKNOWN, Cell val=0, operation_t fptr=NULL) ;
    TokenKind m_kind ;
-   int m_value ;            // variables' values are stored here
+   Cell m_value ;           // variables' values are stored here
    operation_t m_dothis ;   // pointer to a function that does the work
+   shared_ptr<const vector<Token> > m_code ;   // body of a WORD
+   shared_ptr<vector<Cell> > m_cells ;         // elements of an ARRAY, shared by copies
+} ;
+
+
+
+// Sally Forth symbol table for variables.
+// (builtin words have their own compile time table, see SallyOps.h)
+//
+// Open addressing on the names' cached hashes. Entries are kept
+// densely in insertion order; the index maps hash slots to them.
+// Each name is stored once, in its entry.
+//
+// Forks of one snapshot share a SymTab until one of them
+// changes a variable, which then gets its own copy.
+//
+// Every table has a stamp, taken from a process wide counter,
+// that changes whenever names are added or removed or the table
+// is copied, so no two layouts of any tables ever share one.
+// find(Token) remembers its answer in the token along with the
+// stamp, and while the stamp still matches answers again with a
+// single compare. Tokens of a word's code are run over and over,
+// and a name pushed on the stack brings its answer along to @ and !.
+//
+const uint32_t SYMTAB_NONE = 0xffffffff ;   // m_slot of a name not found
+
+class SymTab {
+
+public:
+
+   SymTab() ;
+   SymTab(const SymTab& other) ;
+
+   // NULL if name is not in the table
+   //
+   SymTabEntry *find(const SallyText& name, uint32_t hash) ;
+
+   // the same, for a token's m_text, cached in the token
+   //
+   SymTabEntry *find(const Token& name) {
+      if (name.m_stamp == m_stamp) {
+         return name.m_slot == SYMTAB_NONE ? NULL : &m_entries[name.m_slot].m_entry ;
+      }
+      return findAndCache(name) ;
+   }
+
+   // add name, or overwrite its entry if already there
+   //
+   SymTabEntry& insert(const SallyText& name, uint32_t hash, const SymTabEntry& entry) ;
+
+   // remove everything, keeping the allocated space
+   //
+   void clear() ;
+
+   size_t size() const { return m_entries.size() ; }
+
+   uint64_t stamp() const { return m_stamp ; }
+
+   int m_refs ;             // number of owners
+
+private:
+
+   struct Slot {
+      SallyText m_name ;
+      uint32_t m_hash ;
+      SymTabEntry m_entry ;
+   } ;
+
+   vector<Slot> m_entries ;
+   vector<int> m_index ;    // entry number, -1 if free
+   uint32_t m_mask ;        // m_index.size() - 1
+   uint64_t m_stamp ;
+
+   static atomic<uint64_t> stamps ;   // last stamp handed out
+
+   int findEntry(const SallyText& name, uint32_t hash) const ;
+   SymTabEntry *findAndCache(const Token& name) ;
+   void grow() ;
+
+   SymTab& operator=(const SymTab&) ;     // no assignment
+
+} ;
+
+
+
+// a FOR ... LOOP being run
+//
+struct CountedLoop {
+   Cell m_index ;           // what I returns
+   Cell m_limit ;           // loop ends when m_index reaches this
+   size_t m_start ;         // where the body starts
+   int m_line ;             // line of the FOR, and times the body
+   uint64_t m_runs ;        // has run, for SallyMetrics
+} ;
+
+
+// a DO ... UNTIL being run
+//
+struct DoLoop {
+   size_t m_start ;         // where the body starts
+   int m_line ;             // line of the DO, and times the body
+   uint64_t m_runs ;        // has run, for SallyMetrics
+} ;
+
+
+
+// Saved interpreter state: parameter stack, symbol table
+// (variables and words) and program position (lexed tokens not
+// yet run plus DO and FOR loops in progress). Copying a snapshot or
+// forking from it does not copy the symbol table.
+//
+class SallySnapshot {
+
+public:
+
+   SallySnapshot() ;
+   SallySnapshot(const SallySnapshot& other) ;
+   SallySnapshot& operator=(const SallySnapshot& other) ;
+   ~SallySnapshot() ;
+
+private:
+
+   friend class Sally ;
+
+   stack<Token, vector<Token> > params ;
+   SymTab *symtab ;
+   vector<Token> tkBuffer ;
+   size_t pc ;
+   vector<DoLoop> loops ;
+   vector<CountedLoop> cloops ;
+
 } ;
 
 
@@ -71,43 +234,270 @@ class Sally {
 
 public:
 
-   Sally(istream& input_stream=cin) ;  // make a Sally Forth interpreter
+   // make a Sally Forth interpreter.
+   // output of . SP CR goes to output_stream, diagnostics
+   // from mainLoop() go to error_stream.
+   //
+   Sally(istream& input_stream=cin, ostream& output_stream=cout,
+         ostream& error_stream=cerr) ;
+
+   // the same, reading the program from input_source, which must
+   // last as long as the interpreter reads it (see SallyInput.h)
+   //
+   Sally(SallyInput& input_source, ostream& output_stream=cout,
+         ostream& error_stream=cerr) ;
 
    void mainLoop() ;  // do the main interpreter loop
 
+   // Return to the state of a freshly constructed interpreter
+   // and attach new streams. Cost is proportional to the live
+   // state (stack depth, variables, pending tokens); containers
+   // keep their capacity for the next run.
+   //
+   void reset(istream& input_stream, ostream& output_stream=cout,
+              ostream& error_stream=cerr) ;
+   void reset(SallyInput& input_source, ostream& output_stream=cout,
+              ostream& error_stream=cerr) ;
+
+   // Save the current state, e.g. after running a setup script.
+   //
+   void snapshot(SallySnapshot& snap) const ;
+
+   // Replace the current state with a copy of snap and continue
+   // reading from input_stream. Variables are copied lazily,
+   // when this context first changes one.
+   //
+   void fork(const SallySnapshot& snap, istream& input_stream,
+             ostream& output_stream=cout, ostream& error_stream=cerr) ;
+   void fork(const SallySnapshot& snap, SallyInput& input_source,
+             ostream& output_stream=cout, ostream& error_stream=cerr) ;
+
+   // Compile hot DO ... UNTIL loops to native code
+   // (see SallyJit.h). Off by default.
+   //
+   void setJit(bool on) ;
+
+   // Remember what pure DO ... UNTIL loops leave on the stack and
+   // skip running them again from the same start (see SallyMemo.h).
+   // Off by default.
+   //
+   void setMemo(bool on) ;
+
+   // Read and lex the input on a separate thread, ahead of the
+   // program (see SallyPrefetch.h). Off by default.
+   //
+   void setPrefetch(bool on) ;
+
+   // Read all of the input now and lex it on up to threads
+   // threads (0 for one per core), instead of a paragraph at a
+   // time as the program runs. For large generated scripts,
+   // where lexing is most of the startup. Call before mainLoop().
+   //
+   void preload(unsigned threads = 0) ;
+
+   // Take paragraphs cache has lexed before from it, and add the
+   // ones it has not, rather than lexing everything (see
+   // SallyCompileCache.h). The prefetch thread lexes as it reads
+   // and does not use it. The cache is the caller's and may be
+   // shared. NULL, the default, turns it off.
+   //
+   void setCompileCache(SallyCompileCache *compile_cache) { cache = compile_cache ; }
+
+   // Record every token run in a ring and write it to the file
+   // path on DUMP, errors and signals (see SallyTrace.h).
+   // NULL turns tracing off. False if path cannot be opened.
+   //
+   bool setTrace(const char *path, size_t records = TRACE_RECORDS) ;
+
+   // Stop mainLoop() with "Time limit exceeded??" once it has
+   // run for ns nanoseconds, checked every METRIC_BATCH tokens.
+   // Loops the JIT runs natively are only checked when they hand
+   // control back. 0, the default, for no limit.
+   //
+   void setTimeLimit(uint64_t ns) { timeLimit = ns ; }
+
+   // counters and histograms for this interpreter, kept
+   // since it was constructed (see SallyMetrics.h)
+   //
+   const SallyMetrics& metrics() const { return stats ; }
+
+   // split one line of source, len characters at line with no
+   // '\n', into tokens, appending them to tokens. lineNo goes into
+   // each token's m_line.
+   //
+   static void lexLine(const char *line, size_t len, int lineNo, vector<Token>& tokens) ;
+   static void lexLine(const string& line, int lineNo, vector<Token>& tokens) {
+      lexLine(line.data(), line.size(), lineNo, tokens) ;
+   }
+
+   // how the last mainLoop() ended. Its m_stack is the stack after
+   // the failing word took its parameters, empty at a normal end.
+   //
+   const SallyError& lastError() const { return error ; }
+
+   // parameters on the stack now
+   //
+   size_t depth() const { return params.size() ; }
+
+   ~Sally() ;
+
 
 private:
 
-   // Where to read the input
+   // Where to read the input: streamInput for the streams given
+   // to the constructor, reset() and fork(), or the caller's source
+   //
+   SallyStreamInput streamInput ;
+   SallyInput *input ;
+
+
+   // Where to write program output and diagnostics
+   //
+   ostream *ostrm ;
+   ostream *estrm ;
+
+
+   // Sally Forth operations to be interpreted.
+   // fillBuffer() appends a paragraph at a time and they run
+   // from tkBuffer[pc]. Tokens already run are dropped when
+   // no DO loop can jump back to them.
+   //
+   vector<Token> tkBuffer ;
+   size_t pc ;
+
+
+   // return stack: one frame for each call of a word
+   // defined with : NAME ... ; that is still running
+   //
+   struct Frame {
+      const vector<Token> *m_code ;
+      size_t m_pc ;
+      size_t m_loopBase ;    // loops.size() when the word was called
+      size_t m_cloopBase ;   // cloops.size() when the word was called
+   } ;
+   vector<Frame> rstack ;
+
+   void popFrame() ;        // return from the current word
+
+   // end the DO loops after the first keepDo and the FOR loops
+   // after the first keepFor, counting their runs in stats
+   //
+   void dropLoops(size_t keepDo, size_t keepFor) ;
+
+   // end the innermost DO loop at its UNTIL
+   //
+   void endLoop() ;
+
+
+   // DO loops being run: where each body starts, in tkBuffer
+   // or in the code of the word being run
    //
-   istream& istrm ;
+   vector<DoLoop> loops ;
 
 
-   // Sally Forth operations to be interpreted
+   // loop control stack for FOR loops being run: the index
+   // and limit live here rather than on the parameter stack
    //
-   list<Token> tkBuffer ;   
+   vector<CountedLoop> cloops ;
 
 
    // Sally Forth parameter stack
    //
-   stack<Token> params ;    
+   stack<Token, vector<Token> > params ;
+
+
+   // SALLY_OK while the program runs. Anything else stops
+   // mainLoop() once the current handler returns.
+   //
+   SallyStatus status ;
+   SallyError error ;
+
+   // stop the program with message, instead of throwing
+   //
+   void fail(SallyStatus why, const char *message) ;
+
+   // fill in where the program stopped and print the report
+   //
+   void stopped(const string& word, int line) ;
 
 
    // Sally Forth symbol table
-   // keywords and variables are store here
+   // keywords and variables are store here.
+   // may be shared with snapshots and forks, call ownSymtab()
+   // before changing it.
+   //
+   SymTab *symtab ;
+
+   SymTab& ownSymtab() ;
+
+   // elements of the array called name. Prints "array not found"
+   // and returns NULL if there isn't one. Pass forWrite to get a
+   // copy this interpreter can change.
+   //
+   vector<Cell> *findArray(const Token& name, bool forWrite) ;
+
+   friend struct SallyBuiltins ;
+   friend class SallyJit ;
+   friend class SallyMemo ;
+   friend class SallyTranspiler ;
+
+
+   // native code for hot loops, NULL when not in use
+   //
+   SallyJit *jit ;
+
+   // results of pure loops, NULL when not in use
+   //
+   SallyMemo *memo ;
+
+   // mainLoop() time limit in ns, 0 for none
+   //
+   uint64_t timeLimit ;
+
+   // reader thread for input, NULL when not in use
+   //
+   SallyPrefetch *prefetch ;
+
+   // execution trace, NULL when not in use
    //
-   map<string,SymTabEntry> symtab ;   
+   SallyTrace *trace ;
+
+   // lexed paragraphs, NULL when not in use, the paragraph
+   // fillBuffer() is reading for it, and the last it got
+   //
+   SallyCompileCache *cache ;
+   string paragraph ;
+   SallyCacheCursor cacheCursor ;
+
+   SallyMetrics stats ;
+
+   Sally(const Sally&) ;             // no copies
+   Sally& operator=(const Sally&) ;   
 
 
    // add tokens from input to tkBuffer
    //
    bool fillBuffer() ;
+   bool fillFromCache() ;   // the same, through cache
+   int lineNo ;             // lines fillBuffer() has read from input
 
 
    // give me one more token.
    // calls fillBuffer() for you if needed.
+   // the reference is good until the next call.
+   // at the end of the input, sets status to SALLY_END and
+   // returns an UNKNOWN token.
    //
-   Token nextToken() ;
+   const Token& nextToken() ;
+   bool readMore() ;
+
+
+   // position of the next token in the code being run
+   //
+   size_t& curPc() { return rstack.empty() ? pc : rstack.back().m_pc ; }
+   size_t loopBase() const { return rstack.empty() ? 0 : rstack.back().m_loopBase ; }
+   size_t cloopBase() const { return rstack.empty() ? 0 : rstack.back().m_cloopBase ; }
+   const vector<Token> *curCode() const { return rstack.empty() ? &tkBuffer : rstack.back().m_code ; }
 
 
    // static member functions that do what has
@@ -145,6 +535,18 @@ private:
    static void doAT(Sally *Sptr);
    static void doEX(Sally *Sptr);
 
+   static void doARRAY(Sally *Sptr);
+   static void doAAT(Sally *Sptr);
+   static void doAEX(Sally *Sptr);
+   static void doALEN(Sally *Sptr);
+   static void doASUM(Sally *Sptr);
+   static void doAMIN(Sally *Sptr);
+   static void doAMAX(Sally *Sptr);
+   static void doAFILL(Sally *Sptr);
+   static void doACOPY(Sally *Sptr);
+   static void doAPLUS(Sally *Sptr);
+   static void doATIMES(Sally *Sptr);
+
    static void doAND(Sally *Sptr);
    static void doOR(Sally *Sptr);
    static void doNOT(Sally *Sptr);
@@ -156,10 +558,14 @@ private:
    static void doDO(Sally *Sptr);
    static void doUNTIL(Sally *Sptr);
 
-   bool recorder;
-   list<Token> myList;
-   vector<list<Token> > toDoList;//haha lol
-   int DoTracker;
+   static void doFOR(Sally *Sptr);
+   static void doLOOP(Sally *Sptr);
+   static void doPLUSLOOP(Sally *Sptr);
+   static void doI(Sally *Sptr);
+   static void doJ(Sally *Sptr);
+
+   static void doCOLON(Sally *Sptr);
+   static void doSEMI(Sally *Sptr);
 
 } ;
 
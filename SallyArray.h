@@ -0,0 +1,172 @@
+// File: SallyArray.h
+//
+// CMSC 341 Spring 2017 Project 2
+//
+// The bulk array words ASUM AMIN AMAX AFILL A+ A* as loops over
+// plain arrays of cells, shared by the interpreter and
+// SallyRuntime.h. Header only.
+//
+// The loops take CELL_LANES cells at a time using GCC vector
+// extensions on 16 byte vectors, the size every x86-64 (SSE2)
+// and ARM64 (NEON) machine has registers for; the reductions keep
+// two of them going at once. Sums and products are done on
+// unsigned lanes, so they wrap the way + and * do.
+// With SALLY_CHECKED they go one cell at a time through Arith
+// instead, so that overflow throws as it does for + and *.
+//
+
+#ifndef _SALLYARRAY_H_
+#define _SALLYARRAY_H_
+
+#include <cstddef>
+#include <cstring>
+#include <type_traits>
+
+#include "SallyOps.h"
+
+
+typedef std::make_unsigned<Cell>::type UCell ;
+
+typedef Cell CellVec __attribute__((vector_size(16))) ;
+typedef UCell UCellVec __attribute__((vector_size(16))) ;
+
+const size_t CELL_LANES = sizeof(CellVec) / sizeof(Cell) ;
+
+
+inline Cell cellSum(const Cell *a, size_t n) {
+   if (SALLY_CHECKED) {
+      Cell sum = 0 ;
+      for (size_t i = 0 ; i < n ; i++) sum = Arith::add(sum, a[i]) ;
+      return sum ;
+   }
+
+   UCellVec acc0 = {}, acc1 = {} ;
+   UCell sum = 0 ;
+   size_t i = 0 ;
+
+   for ( ; i + 2 * CELL_LANES <= n ; i += 2 * CELL_LANES) {
+      UCellVec v0, v1 ;
+      memcpy(&v0, a + i, sizeof v0) ;
+      memcpy(&v1, a + i + CELL_LANES, sizeof v1) ;
+      acc0 += v0 ;
+      acc1 += v1 ;
+   }
+   acc0 += acc1 ;
+   for (size_t l = 0 ; l < CELL_LANES ; l++) sum += acc0[l] ;
+   for ( ; i < n ; i++) sum += (UCell) a[i] ;
+   return (Cell) sum ;
+}
+
+
+// smallest of a[0..n-1], n > 0
+//
+inline Cell cellMin(const Cell *a, size_t n) {
+   Cell m = a[0] ;
+   size_t i = 0 ;
+
+   if (n >= 2 * CELL_LANES) {
+      CellVec acc0, acc1 ;
+      memcpy(&acc0, a, sizeof acc0) ;
+      memcpy(&acc1, a + CELL_LANES, sizeof acc1) ;
+      for (i = 2 * CELL_LANES ; i + 2 * CELL_LANES <= n ; i += 2 * CELL_LANES) {
+         CellVec v0, v1 ;
+         memcpy(&v0, a + i, sizeof v0) ;
+         memcpy(&v1, a + i + CELL_LANES, sizeof v1) ;
+         acc0 = v0 < acc0 ? v0 : acc0 ;
+         acc1 = v1 < acc1 ? v1 : acc1 ;
+      }
+      CellVec acc = acc1 < acc0 ? acc1 : acc0 ;
+      m = acc[0] ;
+      for (size_t l = 1 ; l < CELL_LANES ; l++) {
+         if (acc[l] < m) m = acc[l] ;
+      }
+   }
+   for ( ; i < n ; i++) {
+      if (a[i] < m) m = a[i] ;
+   }
+   return m ;
+}
+
+
+// largest of a[0..n-1], n > 0
+//
+inline Cell cellMax(const Cell *a, size_t n) {
+   Cell m = a[0] ;
+   size_t i = 0 ;
+
+   if (n >= 2 * CELL_LANES) {
+      CellVec acc0, acc1 ;
+      memcpy(&acc0, a, sizeof acc0) ;
+      memcpy(&acc1, a + CELL_LANES, sizeof acc1) ;
+      for (i = 2 * CELL_LANES ; i + 2 * CELL_LANES <= n ; i += 2 * CELL_LANES) {
+         CellVec v0, v1 ;
+         memcpy(&v0, a + i, sizeof v0) ;
+         memcpy(&v1, a + i + CELL_LANES, sizeof v1) ;
+         acc0 = v0 > acc0 ? v0 : acc0 ;
+         acc1 = v1 > acc1 ? v1 : acc1 ;
+      }
+      CellVec acc = acc1 > acc0 ? acc1 : acc0 ;
+      m = acc[0] ;
+      for (size_t l = 1 ; l < CELL_LANES ; l++) {
+         if (acc[l] > m) m = acc[l] ;
+      }
+   }
+   for ( ; i < n ; i++) {
+      if (a[i] > m) m = a[i] ;
+   }
+   return m ;
+}
+
+
+inline void cellFill(Cell *a, size_t n, Cell value) {
+   CellVec v = {} ;
+   size_t i = 0 ;
+
+   v += value ;
+   for ( ; i + CELL_LANES <= n ; i += CELL_LANES) {
+      memcpy(a + i, &v, sizeof v) ;
+   }
+   for ( ; i < n ; i++) a[i] = value ;
+}
+
+
+// dst[i] = a[i] + b[i]. dst may be a or b.
+//
+inline void cellAdd(Cell *dst, const Cell *a, const Cell *b, size_t n) {
+   size_t i = 0 ;
+
+   if (SALLY_CHECKED) {
+      for ( ; i < n ; i++) dst[i] = Arith::add(a[i], b[i]) ;
+      return ;
+   }
+   for ( ; i + CELL_LANES <= n ; i += CELL_LANES) {
+      UCellVec x, y ;
+      memcpy(&x, a + i, sizeof x) ;
+      memcpy(&y, b + i, sizeof y) ;
+      x += y ;
+      memcpy(dst + i, &x, sizeof x) ;
+   }
+   for ( ; i < n ; i++) dst[i] = (Cell) ((UCell) a[i] + (UCell) b[i]) ;
+}
+
+
+// dst[i] = a[i] * b[i]. dst may be a or b.
+//
+inline void cellMul(Cell *dst, const Cell *a, const Cell *b, size_t n) {
+   size_t i = 0 ;
+
+   if (SALLY_CHECKED) {
+      for ( ; i < n ; i++) dst[i] = Arith::mul(a[i], b[i]) ;
+      return ;
+   }
+   for ( ; i + CELL_LANES <= n ; i += CELL_LANES) {
+      UCellVec x, y ;
+      memcpy(&x, a + i, sizeof x) ;
+      memcpy(&y, b + i, sizeof y) ;
+      x *= y ;
+      memcpy(dst + i, &x, sizeof x) ;
+   }
+   for ( ; i < n ; i++) dst[i] = (Cell) ((UCell) a[i] * (UCell) b[i]) ;
+}
+
+#endif
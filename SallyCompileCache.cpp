@@ -0,0 +1,327 @@
+// File: SallyCompileCache.cpp
+//
+// CMSC 341 Spring 2017 Project 2
+//
+// Implementation of the cache of lexed paragraphs
+//
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+using namespace std ;
+
+#include "Sally.h"
+#include "SallyCompileCache.h"
+
+
+// one cached paragraph. Nothing changes once it is in the
+// cache but the two mutable fields, and those only with the
+// cache's lock held.
+//
+struct SallyCacheEntry {
+   uint64_t m_hash ;
+   string m_text ;
+   int m_lines ;
+   vector<Token> m_tokens ;
+   size_t m_bytes ;
+   mutable uint64_t m_used ;                           // tick when last found or added
+   mutable weak_ptr<const SallyCacheEntry> m_next ;    // read after it last time
+} ;
+
+typedef SallyCacheEntry Entry ;
+
+
+// 64 bit hash of a paragraph, a word at a time. Entries also
+// keep their text, so a collision only costs a miss.
+//
+static uint64_t textHash(const char *p, size_t n) {
+   uint64_t h = 0x9e3779b97f4a7c15ull ^ n ;
+   uint64_t w ;
+
+   for ( ; n >= 8 ; p += 8, n -= 8) {
+      memcpy(&w, p, 8) ;
+      h = (h ^ w) * 0xff51afd7ed558ccdull ;
+      h ^= h >> 32 ;
+   }
+   w = 0 ;
+   memcpy(&w, p, n) ;
+   h = (h ^ w) * 0xc4ceb9fe1a85ec53ull ;
+   return h ^ (h >> 29) ;
+}
+
+
+// Starts a saved cache: its format, and what the tokens in it
+// depend on, the builtins' opcodes and the width of a Cell
+//
+static string fileHeader() {
+   string layout ;
+
+   for (int op = 0 ; op < NUM_OPS ; op++) {
+      layout += opTable[op].m_name ;
+      layout += ' ' ;
+   }
+   layout += to_string(sizeof(Cell)) ;
+
+   uint64_t sig = textHash(layout.data(), layout.size()) ;
+   return string("SALLYCC1") + string((const char *) &sig, sizeof sig) ;
+}
+
+
+SallyCompileCache::SallyCompileCache(size_t max_bytes) :
+   maxBytes(max_bytes), used(0), tick(0), nhits(0), nmisses(0)
+{
+}
+
+
+int SallyCompileCache::lex(const char *text, size_t len, int lineNo, vector<Token>& tokens,
+                           bool& hit, SallyCacheCursor& cursor) {
+   uint64_t h = textHash(text, len) ;
+   shared_ptr<const Entry> e ;
+   const Entry *prev = cursor.m_entry.get() ;
+
+   {
+      lock_guard<mutex> guard(lock) ;
+      if (prev != NULL) e = prev->m_next.lock() ;
+      if (e == NULL || e->m_hash != h) {
+         auto it = entries.find(h) ;
+         e = it != entries.end() ? it->second : NULL ;
+         if (prev != NULL && e != NULL) prev->m_next = e ;
+      }
+      if (e != NULL) e->m_used = ++tick ;
+   }
+
+   // entries never change, so the text is compared unlocked
+   //
+   hit = e != NULL && e->m_text.size() == len && memcmp(e->m_text.data(), text, len) == 0 ;
+
+   if (hit) {
+      nhits.fetch_add(1, memory_order_relaxed) ;
+   } else {
+      nmisses.fetch_add(1, memory_order_relaxed) ;
+
+      shared_ptr<Entry> made = make_shared<Entry>() ;
+      made->m_hash = h ;
+      made->m_text.assign(text, len) ;
+      made->m_lines = 0 ;
+      for (const char *p = text ; p < text + len ; ) {
+         const char *nl = (const char *) memchr(p, '\n', text + len - p) ;
+         made->m_lines++ ;
+         Sally::lexLine(p, nl - p, made->m_lines, made->m_tokens) ;
+         p = nl + 1 ;
+      }
+      made->m_bytes = sizeof(Entry) + len + made->m_tokens.size() * sizeof(Token) ;
+
+      e = made ;
+      lock_guard<mutex> guard(lock) ;
+      add(made) ;
+      if (prev != NULL) prev->m_next = e ;
+   }
+
+   size_t first = tokens.size() ;
+   tokens.insert(tokens.end(), e->m_tokens.begin(), e->m_tokens.end()) ;
+   for (size_t i = first ; i < tokens.size() ; i++) {
+      tokens[i].m_line += lineNo ;
+   }
+
+   cursor.m_entry = e ;
+   return e->m_lines ;
+}
+
+
+// Add e in place of any entry with its hash. If they take too
+// much room now, drop the least recently used down to 3/4 of it.
+//
+void SallyCompileCache::add(const shared_ptr<const Entry>& e) {
+   if (e->m_bytes > maxBytes) return ;
+
+   shared_ptr<const Entry>& slot = entries[e->m_hash] ;
+   if (slot != NULL) used -= slot->m_bytes ;
+   slot = e ;
+   e->m_used = ++tick ;
+   used += e->m_bytes ;
+
+   if (used <= maxBytes) return ;
+
+   vector<pair<uint64_t, uint64_t> > ages ;     // last used, hash
+   ages.reserve(entries.size()) ;
+   for (auto it = entries.begin() ; it != entries.end() ; ++it) {
+      ages.push_back(make_pair(it->second->m_used, it->first)) ;
+   }
+   sort(ages.begin(), ages.end()) ;
+
+   for (size_t i = 0 ; i < ages.size() && used > maxBytes / 4 * 3 ; i++) {
+      auto it = entries.find(ages[i].second) ;
+      used -= it->second->m_bytes ;
+      entries.erase(it) ;
+   }
+}
+
+
+void SallyCompileCache::clear() {
+   lock_guard<mutex> guard(lock) ;
+   entries.clear() ;
+   used = 0 ;
+}
+
+
+size_t SallyCompileCache::size() const {
+   lock_guard<mutex> guard(lock) ;
+   return entries.size() ;
+}
+
+
+size_t SallyCompileCache::bytes() const {
+   lock_guard<mutex> guard(lock) ;
+   return used ;
+}
+
+
+// -------------------------------------------------------
+//
+// Saved caches: the header, then for each entry
+//
+//    text length, text, lines, token count
+//    and for each token: kind, value, line, text length, text
+//
+// as uint32_t, except kind (one byte) and value (a Cell), in
+// this machine's byte order. Entries go oldest first, so they
+// are as old again once loaded. Hashes are worked out again.
+//
+
+
+static void put32(string& out, uint32_t v) {
+   out.append((const char *) &v, sizeof v) ;
+}
+
+
+// Reads a saved cache, failing for good at the first
+// thing that is not there
+//
+struct CacheReader {
+   const char *m_pos ;
+   const char *m_end ;
+   bool m_ok ;
+
+   const char *skip(size_t n) {
+      const char *at = m_pos ;
+      if (!m_ok || (size_t) (m_end - m_pos) < n) {
+         m_ok = false ;
+         return NULL ;
+      }
+      m_pos += n ;
+      return at ;
+   }
+
+   void get(void *to, size_t n) {
+      const char *at = skip(n) ;
+      if (at != NULL) memcpy(to, at, n) ;
+   }
+
+   uint32_t get32() {
+      uint32_t v = 0 ;
+      get(&v, sizeof v) ;
+      return v ;
+   }
+} ;
+
+
+bool SallyCompileCache::save(const string& path) const {
+   string out = fileHeader() ;
+
+   {
+      lock_guard<mutex> guard(lock) ;
+
+      vector<const Entry *> byAge ;
+      for (auto it = entries.begin() ; it != entries.end() ; ++it) byAge.push_back(it->second.get()) ;
+      sort(byAge.begin(), byAge.end(),
+           [](const Entry *a, const Entry *b) { return a->m_used < b->m_used ; }) ;
+
+      for (size_t k = 0 ; k < byAge.size() ; k++) {
+         const Entry& e = *byAge[k] ;
+         put32(out, e.m_text.size()) ;
+         out += e.m_text ;
+         put32(out, e.m_lines) ;
+         put32(out, e.m_tokens.size()) ;
+         for (size_t i = 0 ; i < e.m_tokens.size() ; i++) {
+            const Token& tk = e.m_tokens[i] ;
+            out.push_back((char) tk.m_kind) ;
+            out.append((const char *) &tk.m_value, sizeof tk.m_value) ;
+            put32(out, tk.m_line) ;
+            put32(out, tk.m_text.size()) ;
+            out.append(tk.m_text.data(), tk.m_text.size()) ;
+         }
+      }
+   }
+
+   // written aside and renamed, so a run that stops half way
+   // leaves the old file
+   //
+   string tmp = path + ".tmp" ;
+   ofstream file(tmp.c_str(), ios::binary) ;
+   file.write(out.data(), out.size()) ;
+   file.close() ;
+   if (!file || rename(tmp.c_str(), path.c_str()) != 0) {
+      remove(tmp.c_str()) ;
+      return false ;
+   }
+   return true ;
+}
+
+
+bool SallyCompileCache::load(const string& path) {
+   ifstream file(path.c_str(), ios::binary) ;
+   if (!file) return false ;
+
+   ostringstream ss ;
+   ss << file.rdbuf() ;
+   const string data = ss.str() ;
+   const string header = fileHeader() ;
+
+   if (data.compare(0, header.size(), header) != 0) return false ;
+
+   CacheReader in = { data.data() + header.size(), data.data() + data.size(), true } ;
+   shared_ptr<Entry> prev ;
+
+   while (in.m_ok && in.m_pos != in.m_end) {
+      shared_ptr<Entry> e = make_shared<Entry>() ;
+
+      uint32_t len = in.get32() ;
+      const char *text = in.skip(len) ;
+      e->m_lines = in.get32() ;
+      uint32_t count = in.get32() ;
+      if (count > (size_t) (in.m_end - in.m_pos)) in.m_ok = false ;
+      if (!in.m_ok) break ;
+
+      e->m_tokens.reserve(count) ;
+      for (uint32_t i = 0 ; i < count && in.m_ok ; i++) {
+         unsigned char kind = 0 ;
+         Cell value = 0 ;
+         in.get(&kind, 1) ;
+         in.get(&value, sizeof value) ;
+         int line = in.get32() ;
+         uint32_t n = in.get32() ;
+         const char *chars = in.skip(n) ;
+         if (!in.m_ok) break ;
+
+         // nothing may name an opcode this build does not have
+         //
+         if (kind > ARRAY || (kind == KEYWORD && (value < 0 || value >= NUM_OPS))) return false ;
+
+         e->m_tokens.push_back(Token((TokenKind) kind, value, SallyText(chars, n))) ;
+         e->m_tokens.back().m_line = line ;
+      }
+      if (!in.m_ok) break ;
+
+      e->m_hash = textHash(text, len) ;
+      e->m_text.assign(text, len) ;
+      e->m_bytes = sizeof(Entry) + len + count * sizeof(Token) ;
+
+      lock_guard<mutex> guard(lock) ;
+      add(e) ;
+      if (prev != NULL) prev->m_next = e ;
+      prev = e ;
+   }
+   return in.m_ok ;
+}
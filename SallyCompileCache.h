@@ -0,0 +1,126 @@
+// File: SallyCompileCache.h
+//
+// CMSC 341 Spring 2017 Project 2
+//
+// Lexed paragraphs of Sally Forth source, looked up by a hash of
+// their text, so a large script run again after a few lines of it
+// changed only lexes the paragraphs that changed.
+//
+// A paragraph is what fillBuffer() reads at once: the lines up
+// to a blank one. lexLine() looks at nothing but its own line, so
+// the tokens of some lines depend on nothing but their text. They
+// are cached with line numbers counted from the paragraph's first
+// line, and renumbered as they are copied out.
+//
+// Finding an entry in the hash table costs about as many cache
+// misses as lexing a short paragraph does. So each entry also
+// remembers the one read after it, and a reader's SallyCacheCursor
+// tries that one first: a script read again walks from entry to
+// entry, and the table is only searched after an edit.
+//
+// Each entry remembers when it was last used. Once all of them
+// take more than max_bytes, the least recently used are dropped
+// in one go, down to three quarters of it; a hit only stamps its
+// entry, since keeping a list in order would cost more than the
+// lexing saved. One cache can be shared by any number of
+// interpreters on any threads: it holds a lock while it finds or
+// adds an entry, but not while it lexes or copies tokens out.
+//
+// save() and load() keep a cache in a file between runs, as
+// "proj2 --compile-cache FILE" does. The file is only read back by
+// a build with the same builtin words and cell width.
+//
+// Only lexing is cached. Loops the JIT compiles belong to the
+// token buffer of one run, and are compiled again once they get
+// hot in the next.
+//
+
+#ifndef _SALLYCOMPILECACHE_H_
+#define _SALLYCOMPILECACHE_H_
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+using namespace std ;
+
+class Token ;
+struct SallyCacheEntry ;     // in SallyCompileCache.cpp
+
+
+const size_t COMPILE_CACHE_BYTES = 256 << 20 ;
+
+
+// The paragraph one reader of a cache got last. Each reader
+// keeps its own; an empty one just starts at the hash table.
+//
+class SallyCacheCursor {
+
+public:
+
+   void clear() { m_entry.reset() ; }
+
+private:
+
+   friend class SallyCompileCache ;
+   shared_ptr<const SallyCacheEntry> m_entry ;
+
+} ;
+
+
+
+class SallyCompileCache {
+
+public:
+
+   SallyCompileCache(size_t max_bytes=COMPILE_CACHE_BYTES) ;
+
+   // Append the tokens of the len characters at text, whole lines
+   // each ending in '\n', to tokens, numbering their lines from
+   // lineNo + 1. They are lexed and added to the cache unless
+   // they are there already, which hit is set to. cursor is moved
+   // on to this paragraph. Returns the number of lines.
+   //
+   int lex(const char *text, size_t len, int lineNo, vector<Token>& tokens,
+           bool& hit, SallyCacheCursor& cursor) ;
+
+   // Write the cache to path, oldest entries first. False if it
+   // cannot be written.
+   //
+   bool save(const string& path) const ;
+
+   // Add the entries saved in path. False, having added what it
+   // could, if path is missing, from another build or damaged.
+   //
+   bool load(const string& path) ;
+
+   void clear() ;
+
+   size_t size() const ;    // paragraphs cached
+   size_t bytes() const ;   // roughly the memory they take
+
+   uint64_t hits() const { return nhits.load(memory_order_relaxed) ; }
+   uint64_t misses() const { return nmisses.load(memory_order_relaxed) ; }
+
+private:
+
+   mutable mutex lock ;
+   unordered_map<uint64_t, shared_ptr<const SallyCacheEntry> > entries ;
+   size_t maxBytes ;
+   size_t used ;            // m_bytes of every entry
+   uint64_t tick ;
+
+   atomic<uint64_t> nhits ;
+   atomic<uint64_t> nmisses ;
+
+   void add(const shared_ptr<const SallyCacheEntry>& e) ;   // with lock held
+
+   SallyCompileCache(const SallyCompileCache&) ;             // no copies
+   SallyCompileCache& operator=(const SallyCompileCache&) ;
+
+} ;
+
+#endif
@@ -0,0 +1,97 @@
+// File: SallyConst.cpp
+//
+// CMSC 341 Spring 2017 Project 2
+//
+// Compile-time checks of SallyConst.h. Nothing in here runs:
+// if the library builds, SallyConst gets these programs right,
+// and refuses the ones the interpreter would complain about.
+//
+
+#include "SallyConst.h"
+
+
+// Does the program in F() run to the end at compile time? Errors
+// throw, which makes the first one not a constant expression.
+//
+template <typename F, int = (F()().depth(), 0)>
+constexpr bool constRuns(int) { return true ; }
+
+template <typename F>
+constexpr bool constRuns(long) { return false ; }
+
+#define SALLY_PROGRAM(name, src) \
+   struct name { constexpr SallyConst<> operator()() const { return SallyConst<>(src) ; } }
+
+
+// arithmetic, on Cell like applyBinary() / applyUnary()
+//
+static_assert(SallyConst<>("3 4 + 2 *").top() == 14, "+ *") ;
+static_assert(SallyConst<>("10 3 -").top() == 7, "-") ;
+static_assert(SallyConst<>("-7 2 /").top() == -3, "/ rounds toward 0") ;
+static_assert(SallyConst<>("-7 2 %").top() == -1, "%") ;
+static_assert(SallyConst<>("5 NEG").top() == -5, "NEG") ;
+static_assert(SallyConst<>("3 4 < 4 3 < 2 2 <= 1 2 ==").depth() == 4, "comparisons") ;
+static_assert(SallyConst<>("3 4 < 4 3 < 2 2 <= 1 2 ==")[3] == 1, "<") ;
+static_assert(SallyConst<>("3 4 < 4 3 < 2 2 <= 1 2 ==")[2] == 0, "<") ;
+static_assert(SallyConst<>("1 0 AND 1 0 OR 0 NOT").top() == 1, "NOT") ;
+static_assert(SallyConst<>("1 0 AND 1 0 OR 0 NOT")[2] == 0, "AND") ;
+static_assert(SallyConst<>("+12 // a comment 99\n").top() == 12, "literals and comments") ;
+
+// stack words
+//
+static_assert(SallyConst<>("1 2 SWAP").top() == 1, "SWAP") ;
+static_assert(SallyConst<>("1 2 3 ROT").top() == 1, "ROT") ;
+static_assert(SallyConst<>("1 2 3 ROT")[2] == 2, "ROT") ;
+static_assert(SallyConst<>("7 DUP").depth() == 2, "DUP") ;
+static_assert(SallyConst<>("7 8 DROP").top() == 7, "DROP") ;
+
+// variables, as in the header's example
+//
+constexpr SallyConst<> cfg("60 1000 * timeout SET  3 4 +") ;
+static_assert(cfg.var("timeout") == 60000, "SET") ;
+static_assert(cfg.top() == 7 && cfg.depth() == 1, "SET") ;
+static_assert(!cfg.hasVar("limit"), "SET") ;
+static_assert(SallyConst<>("5 x SET x @ 2 * x ! x @").top() == 10, "@ !") ;
+
+// IFTHEN ... ELSE ... ENDIF, nested and not
+//
+static_assert(SallyConst<>("1 IFTHEN 10 ELSE 20 ENDIF").top() == 10, "IFTHEN") ;
+static_assert(SallyConst<>("0 IFTHEN 10 ELSE 20 ENDIF").top() == 20, "ELSE") ;
+static_assert(SallyConst<>("0 IFTHEN 1 IFTHEN 10 ELSE 11 ENDIF ELSE 20 ENDIF").top() == 20,
+              "nested IFTHEN") ;
+
+// DO ... UNTIL runs at least once; FOR ... LOOP
+//
+static_assert(SallyConst<>("0 DO 1 + DUP 10 >= UNTIL").top() == 10, "DO UNTIL") ;
+static_assert(SallyConst<>("5 DO 1 + 1 UNTIL").top() == 6, "DO UNTIL runs once") ;
+static_assert(SallyConst<>("1 x SET 0 DO x @ 2 * x ! 1 + DUP 5 >= UNTIL").var("x") == 32,
+              "DO UNTIL with a variable") ;
+static_assert(SallyConst<>("0 5 0 FOR I + LOOP").top() == 10, "FOR LOOP") ;
+static_assert(SallyConst<>("0 0 10 FOR I + -3 +LOOP").top() == 22, "+LOOP counting down") ;
+static_assert(SallyConst<>("7 3 3 FOR 1 + LOOP").top() == 7, "empty FOR") ;
+
+// what the interpreter only complains about is an error
+//
+SALLY_PROGRAM(Fine, "1 2 +") ;
+SALLY_PROGRAM(Underflow, "1 +") ;
+SALLY_PROGRAM(SetTwice, "1 x SET 2 x SET") ;
+SALLY_PROGRAM(NeverSet, "x @") ;
+SALLY_PROGRAM(NotDeclared, "1 x !") ;
+SALLY_PROGRAM(NoElse, "0 IFTHEN 1 ENDIF") ;
+SALLY_PROGRAM(Output, "1 .") ;
+SALLY_PROGRAM(String, ".\" hello\"") ;
+SALLY_PROGRAM(Definition, ": sq DUP * ;") ;
+SALLY_PROGRAM(Array, "3 a ARRAY") ;
+SALLY_PROGRAM(OutsideFor, "I") ;
+
+static_assert(constRuns<Fine>(0), "a program that runs") ;
+static_assert(!constRuns<Underflow>(0), "stack underflow") ;
+static_assert(!constRuns<SetTwice>(0), "setting a variable twice") ;
+static_assert(!constRuns<NeverSet>(0), "a variable never set") ;
+static_assert(!constRuns<NotDeclared>(0), "! on an undeclared variable") ;
+static_assert(!constRuns<NoElse>(0), "a false IFTHEN with no ELSE") ;
+static_assert(!constRuns<Output>(0), "output") ;
+static_assert(!constRuns<String>(0), "string literals") ;
+static_assert(!constRuns<Definition>(0), "word definitions") ;
+static_assert(!constRuns<Array>(0), "arrays") ;
+static_assert(!constRuns<OutsideFor>(0), "I outside of a FOR loop") ;
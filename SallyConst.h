@@ -0,0 +1,450 @@
+// File: SallyConst.h
+//
+// CMSC 341 Spring 2017 Project 2
+//
+// Running small Sally Forth programs at compile time.
+//
+//    constexpr SallyConst<> cfg("60 1000 * timeout SET  3 4 +") ;
+//    static_assert(cfg.var("timeout") == 60000, "") ;
+//    static_assert(cfg.top() == 7, "") ;
+//
+// The program is lexed like fillBuffer() does and run like
+// mainLoop() does, with the builtins' stack effects from opTable
+// and their arithmetic from applyBinary() / applyUnary().
+// IFTHEN ... ELSE ... ENDIF, DO ... UNTIL and FOR ... LOOP skip
+// and jump over tokens exactly like the interpreter's handlers.
+//
+// There is nowhere to send output at compile time, so . SP CR,
+// string literals, word definitions and the array words are
+// errors. So is anything the interpreter only complains about
+// (stack underflow, setting a variable twice, using one that was
+// never set): errors throw, which stops compilation when the
+// object is constexpr.
+//
+// Capacities are template parameters: tokens in the program,
+// parameter stack depth, variables and nested loops.
+//
+// SallyConst.cpp checks all of this with static_assert whenever
+// the library is built.
+//
+
+#ifndef _SALLYCONST_H_
+#define _SALLYCONST_H_
+
+#include <cstddef>
+#include <climits>
+#include <stdexcept>
+
+#include "SallyOps.h"
+
+
+template <size_t MAX_TOKENS=256, size_t MAX_STACK=32, size_t MAX_VARS=16, size_t MAX_LOOPS=8>
+class SallyConst {
+
+public:
+
+   constexpr SallyConst(const char *src) {
+      lex(src) ;
+      run() ;
+   }
+
+   constexpr size_t depth() const { return m_depth ; }
+
+   // i-th parameter from the top, 0 is the top
+   //
+   constexpr Cell operator[](size_t i) const {
+      return i < m_depth ? m_stack[m_depth - 1 - i].m_value
+                         : throw std::out_of_range("Parameter stack underflow") ;
+   }
+
+   constexpr Cell top() const { return (*this)[0] ; }
+
+   constexpr bool hasVar(const char *name) const {
+      return findVar(name, constLength(name)) >= 0 ;
+   }
+
+   constexpr Cell var(const char *name) const {
+      int v = findVar(name, constLength(name)) ;
+      return v >= 0 ? m_vars[v].m_value : throw std::logic_error("variable not found") ;
+   }
+
+private:
+
+   enum Kind { C_INTEGER, C_KEYWORD, C_NAME, C_STRING } ;
+
+   struct Text {
+      const char *m_text ;
+      size_t m_len ;
+   } ;
+
+   struct CToken {
+      Kind m_kind ;
+      Cell m_value ;       // opcode for C_KEYWORD
+      Text m_text ;
+   } ;
+
+   struct Param {
+      Cell m_value ;
+      Text m_text ;        // used when it names a variable
+   } ;
+
+   struct Var {
+      Text m_name ;
+      Cell m_value ;
+   } ;
+
+   struct Counted {
+      Cell m_index ;
+      Cell m_limit ;
+      size_t m_start ;
+   } ;
+
+   CToken m_tokens[MAX_TOKENS] = {} ;
+   size_t m_ntokens = 0 ;
+   size_t m_pc = 0 ;
+
+   Param m_stack[MAX_STACK] = {} ;
+   size_t m_depth = 0 ;
+
+   Var m_vars[MAX_VARS] = {} ;
+   size_t m_nvars = 0 ;
+
+   size_t m_loops[MAX_LOOPS] = {} ;      // DO loops: where the body starts
+   size_t m_nloops = 0 ;
+   Counted m_cloops[MAX_LOOPS] = {} ;    // FOR loops
+   size_t m_ncloops = 0 ;
+
+
+   static constexpr bool sameText(Text a, const char *b, size_t len) {
+      if (a.m_len != len) return false ;
+      for (size_t i = 0 ; i < len ; i++) {
+         if (a.m_text[i] != b[i]) return false ;
+      }
+      return true ;
+   }
+
+   // findOp() without memcmp
+   //
+   static constexpr int constFindOp(const char *s, size_t len) {
+      uint32_t hash = symHash(s, len) ;
+      int op = opHash.slot[(hash * opHash.mult) >> (32 - OPHASH_BITS)] ;
+
+      if (op >= 0 && opHash.hash[op] == hash && opHash.len[op] == len) {
+         Text t = { opTable[op].m_name, len } ;
+         if (sameText(t, s, len)) return op ;
+      }
+      return -1 ;
+   }
+
+   // strtoll() base 10 on the whole token, as fillBuffer() uses it
+   //
+   static constexpr bool parseNumber(const char *s, size_t len, Cell& value) {
+      size_t i = 0 ;
+      bool neg = false ;
+      long long n = 0 ;
+      bool big = false ;
+
+      if (i < len && (s[i] == '+' || s[i] == '-')) {
+         neg = (s[i] == '-') ;
+         i++ ;
+      }
+      if (i == len) return false ;
+      for ( ; i < len ; i++) {
+         if (s[i] < '0' || s[i] > '9') return false ;
+         if (n > (LLONG_MAX - (s[i] - '0')) / 10) {
+            big = true ;
+         } else {
+            n = n * 10 + (s[i] - '0') ;
+         }
+      }
+      if (big) {
+         n = neg ? -LLONG_MAX - 1 : LLONG_MAX ;
+      } else if (neg) {
+         n = -n ;
+      }
+      value = (Cell) n ;
+      return true ;
+   }
+
+   constexpr void addToken(Kind kind, Cell value, const char *s, size_t len) {
+      if (m_ntokens == MAX_TOKENS) throw std::length_error("too many tokens") ;
+      CToken tk = { kind, value, { s, len } } ;
+      m_tokens[m_ntokens++] = tk ;
+   }
+
+   // split into tokens the way fillBuffer() does
+   //
+   constexpr void lex(const char *src) {
+      size_t pos = 0 ;
+
+      while (src[pos] != '\0') {
+         char c = src[pos] ;
+
+         if (c == ' ' || c == '\t' || c == '\n') {
+            pos++ ;
+            continue ;
+         }
+
+         // comment: skip rest of line
+         //
+         if (c == '/' && src[pos+1] == '/') {
+            while (src[pos] != '\0' && src[pos] != '\n') pos++ ;
+            continue ;
+         }
+
+         // string literal, up to " or end of line
+         //
+         if (c == '.' && src[pos+1] == '"') {
+            size_t len = 0 ;
+            pos += 2 ;
+            while (src[pos+len] != '\0' && src[pos+len] != '\n' && src[pos+len] != '"') len++ ;
+            addToken(C_STRING, 0, src + pos, len) ;
+            pos += len ;
+            if (src[pos] == '"') pos++ ;
+            continue ;
+         }
+
+         size_t len = 0 ;
+         while (src[pos+len] != '\0' && src[pos+len] != ' ' && src[pos+len] != '\t'
+                && src[pos+len] != '\n') {
+            len++ ;
+         }
+
+         Cell value = 0 ;
+         if (parseNumber(src + pos, len, value)) {
+            addToken(C_INTEGER, value, src + pos, len) ;
+         } else {
+            int op = constFindOp(src + pos, len) ;
+            if (op >= 0) {
+               addToken(C_KEYWORD, op, src + pos, len) ;
+            } else {
+               addToken(C_NAME, 0, src + pos, len) ;
+            }
+         }
+         pos += len ;
+      }
+   }
+
+   constexpr void push(Cell value, Text text) {
+      if (m_depth == MAX_STACK) throw std::length_error("Parameter stack full") ;
+      Param c = { value, text } ;
+      m_stack[m_depth++] = c ;
+   }
+
+   constexpr Param pop() {
+      return m_stack[--m_depth] ;
+   }
+
+   constexpr int findVar(const char *name, size_t len) const {
+      for (size_t v = 0 ; v < m_nvars ; v++) {
+         if (sameText(m_vars[v].m_name, name, len)) return v ;
+      }
+      return -1 ;
+   }
+
+   constexpr const CToken& nextToken() {
+      if (m_pc == m_ntokens) throw std::logic_error("End of Program") ;
+      return m_tokens[m_pc++] ;
+   }
+
+   // mainLoop()
+   //
+   constexpr void run() {
+      while (m_pc < m_ntokens) {
+         const CToken& tk = m_tokens[m_pc++] ;
+
+         if (tk.m_kind == C_STRING) {
+            throw std::logic_error("no strings at compile time") ;
+         }
+         if (tk.m_kind != C_KEYWORD) {
+            push(tk.m_value, tk.m_text) ;
+            continue ;
+         }
+         if ((int) m_depth < opTable[tk.m_value].m_pops) {
+            throw std::out_of_range("Parameter stack underflow") ;
+         }
+         doOp(tk.m_value) ;
+      }
+   }
+
+   constexpr void doOp(int op) {
+      Text none = { "", 0 } ;
+
+      switch (op) {
+
+      case OP_PLUS: case OP_MINUS: case OP_TIMES: case OP_DIVIDE: case OP_MOD:
+      case OP_EE: case OP_NE: case OP_LT: case OP_LTE: case OP_GT: case OP_GTE:
+      case OP_AND: case OP_OR: {
+         Param p1 = pop() ;
+         Param p2 = pop() ;
+         push(applyBinary(op, p2.m_value, p1.m_value), none) ;
+         break ;
+      }
+
+      case OP_NEG: case OP_NOT: {
+         Param p = pop() ;
+         push(applyUnary(op, p.m_value), none) ;
+         break ;
+      }
+
+      case OP_DUP: {
+         Param p = m_stack[m_depth-1] ;
+         push(p.m_value, p.m_text) ;
+         break ;
+      }
+
+      case OP_DROP:
+         pop() ;
+         break ;
+
+      case OP_SWAP: {
+         Param p = m_stack[m_depth-1] ;
+         m_stack[m_depth-1] = m_stack[m_depth-2] ;
+         m_stack[m_depth-2] = p ;
+         break ;
+      }
+
+      case OP_ROT: {
+         Param r = m_stack[m_depth-3] ;
+         m_stack[m_depth-3] = m_stack[m_depth-2] ;
+         m_stack[m_depth-2] = m_stack[m_depth-1] ;
+         m_stack[m_depth-1] = r ;
+         break ;
+      }
+
+      case OP_SET: {
+         Param p1 = pop() ;
+         Param p2 = pop() ;
+         if (findVar(p1.m_text.m_text, p1.m_text.m_len) >= 0) {
+            throw std::logic_error("variable has already been set") ;
+         }
+         if (m_nvars == MAX_VARS) throw std::length_error("too many variables") ;
+         Var v = { p1.m_text, p2.m_value } ;
+         m_vars[m_nvars++] = v ;
+         break ;
+      }
+
+      case OP_AT: {
+         Param p1 = pop() ;
+         int v = findVar(p1.m_text.m_text, p1.m_text.m_len) ;
+         if (v < 0) throw std::logic_error("variable not found") ;
+         push(m_vars[v].m_value, none) ;
+         break ;
+      }
+
+      case OP_EX: {
+         Param p1 = pop() ;
+         Param p2 = pop() ;
+         int v = findVar(p1.m_text.m_text, p1.m_text.m_len) ;
+         if (v < 0) throw std::logic_error("variable has not been declared yet") ;
+         m_vars[v].m_value = p2.m_value ;
+         break ;
+      }
+
+      case OP_IFTHEN: {
+         // false: skip to the matching ELSE
+         //
+         if (pop().m_value != 0) break ;
+         int nested = 0 ;
+         while (nested >= 0) {
+            const CToken& tk = nextToken() ;
+            if (tk.m_kind == C_KEYWORD && tk.m_value == OP_IFTHEN) nested++ ;
+            else if (tk.m_kind == C_KEYWORD && tk.m_value == OP_ELSE) nested-- ;
+         }
+         break ;
+      }
+
+      case OP_ELSE:
+         // the IFTHEN part has run: skip to the next ENDIF
+         //
+         while (true) {
+            const CToken& tk = nextToken() ;
+            if (tk.m_kind == C_KEYWORD && tk.m_value == OP_ENDIF) break ;
+         }
+         break ;
+
+      case OP_DO:
+         if (m_nloops == MAX_LOOPS) throw std::length_error("loops nested too deep") ;
+         m_loops[m_nloops++] = m_pc ;
+         break ;
+
+      case OP_UNTIL:
+         if (m_nloops == 0) {
+            pop() ;
+         } else if (pop().m_value == 0) {
+            m_pc = m_loops[m_nloops-1] ;
+         } else {
+            m_nloops-- ;
+         }
+         break ;
+
+      case OP_FOR: {
+         Param start = pop() ;
+         Param limit = pop() ;
+
+         if (start.m_value != limit.m_value) {
+            if (m_ncloops == MAX_LOOPS) throw std::length_error("loops nested too deep") ;
+            Counted cl = { start.m_value, limit.m_value, m_pc } ;
+            m_cloops[m_ncloops++] = cl ;
+            break ;
+         }
+
+         // nothing to do: skip to just past the matching LOOP or +LOOP
+         //
+         int nested = 0 ;
+         while (true) {
+            const CToken& tk = nextToken() ;
+            if (tk.m_kind != C_KEYWORD) continue ;
+            if (tk.m_value == OP_FOR) {
+               nested++ ;
+            } else if (tk.m_value == OP_LOOP || tk.m_value == OP_PLUSLOOP) {
+               if (nested-- == 0) break ;
+            }
+         }
+         break ;
+      }
+
+      case OP_LOOP:
+      case OP_PLUSLOOP: {
+         Cell step = (op == OP_LOOP) ? 1 : pop().m_value ;
+         if (m_ncloops == 0) break ;
+
+         Counted& cl = m_cloops[m_ncloops-1] ;
+         cl.m_index += step ;
+         bool again = (step >= 0) ? (cl.m_index < cl.m_limit) : (cl.m_index >= cl.m_limit) ;
+         if (again) {
+            m_pc = cl.m_start ;
+         } else {
+            m_ncloops-- ;
+         }
+         break ;
+      }
+
+      case OP_I:
+         if (m_ncloops < 1) throw std::out_of_range("I outside of a FOR loop") ;
+         push(m_cloops[m_ncloops-1].m_index, none) ;
+         break ;
+
+      case OP_J:
+         if (m_ncloops < 2) throw std::out_of_range("J outside of two FOR loops") ;
+         push(m_cloops[m_ncloops-2].m_index, none) ;
+         break ;
+
+      case OP_DUMP:
+      case OP_ENDIF:
+      case OP_SEMI:
+         break ;
+
+      case OP_ARRAY: case OP_AAT: case OP_AEX: case OP_ALEN:
+      case OP_ASUM: case OP_AMIN: case OP_AMAX: case OP_AFILL: case OP_ACOPY:
+      case OP_APLUS: case OP_ATIMES:
+         throw std::logic_error("no arrays at compile time") ;
+
+      default:    // . SP CR and :
+         throw std::logic_error("no output or word definitions at compile time") ;
+      }
+   }
+
+} ;
+
+#endif
@@ -0,0 +1,258 @@
+// File: SallyInflate.cpp
+//
+// CMSC 341 Spring 2017 Project 2
+//
+// DEFLATE decoder, after RFC 1951 and zlib's puff.c
+//
+
+#include <cstring>
+using namespace std ;
+
+#include "SallyInflate.h"
+
+
+// base lengths and extra bits of length codes 257..285,
+// and of distance codes 0..29
+//
+static const short lengthBase[29] = {
+   3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31,
+   35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258 } ;
+static const short lengthExtra[29] = {
+   0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2,
+   3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0 } ;
+static const short distBase[30] = {
+   1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193,
+   257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145,
+   8193, 12289, 16385, 24577 } ;
+static const short distExtra[30] = {
+   0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6,
+   7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13 } ;
+
+// order the code length code lengths are sent in
+//
+static const short lengthOrder[19] = {
+   16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15 } ;
+
+
+SallyInflate::SallyInflate(const unsigned char *data, size_t size) :
+   m_data(data), m_size(size), m_pos(0), m_bits(0), m_nbits(0),
+   m_last(false), m_error(NULL)
+{
+   short lengths[288] ;
+   int sym ;
+
+   for (sym = 0 ; sym < 144 ; sym++) lengths[sym] = 8 ;
+   for ( ; sym < 256 ; sym++) lengths[sym] = 9 ;
+   for ( ; sym < 280 ; sym++) lengths[sym] = 7 ;
+   for ( ; sym < 288 ; sym++) lengths[sym] = 8 ;
+   build(m_fixedLen, lengths, 288) ;
+
+   for (sym = 0 ; sym < 30 ; sym++) lengths[sym] = 5 ;
+   build(m_fixedDist, lengths, 30) ;
+}
+
+
+bool SallyInflate::fail(const char *why) {
+   if (m_error == NULL) m_error = why ;
+   return false ;
+}
+
+
+// the next need bits, low bit first. Running out of data
+// sets the error and reads zeros.
+//
+uint32_t SallyInflate::bits(int need) {
+   uint32_t val = m_bits ;
+
+   while (m_nbits < need) {
+      if (m_pos == m_size) {
+         fail("compressed data is cut short") ;
+         m_bits = 0 ;
+         m_nbits = 0 ;
+         return 0 ;
+      }
+      val |= (uint32_t) m_data[m_pos++] << m_nbits ;
+      m_nbits += 8 ;
+   }
+   m_bits = val >> need ;
+   m_nbits -= need ;
+   return val & ((1u << need) - 1) ;
+}
+
+
+// Fill in the counts and symbols of a canonical code from the
+// code lengths of symbols 0 .. n-1. Returns 0 for a complete
+// code, more for an incomplete one, less if it has too many
+// codes of some length.
+//
+int SallyInflate::build(Huffman& h, const short *lengths, int n) {
+   short offsets[16] ;
+   int left = 1 ;
+
+   memset(h.m_count, 0, sizeof h.m_count) ;
+   for (int sym = 0 ; sym < n ; sym++) h.m_count[lengths[sym]]++ ;
+   if (h.m_count[0] == n) return 0 ;
+
+   for (int len = 1 ; len < 16 ; len++) {
+      left = 2 * left - h.m_count[len] ;
+      if (left < 0) return left ;
+   }
+
+   offsets[1] = 0 ;
+   for (int len = 1 ; len < 15 ; len++) offsets[len + 1] = offsets[len] + h.m_count[len] ;
+   for (int sym = 0 ; sym < n ; sym++) {
+      if (lengths[sym] != 0) h.m_symbol[offsets[lengths[sym]]++] = sym ;
+   }
+   return left ;
+}
+
+
+// next symbol of code h, or -1 for bad data
+//
+int SallyInflate::decode(const Huffman& h) {
+   int code = 0 ;       // bits read so far
+   int first = 0 ;      // first code of the current length
+   int index = 0 ;      // its symbol
+
+   for (int len = 1 ; len < 16 ; len++) {
+      code |= bits(1) ;
+      int count = h.m_count[len] ;
+      if (code - count < first) return h.m_symbol[index + (code - first)] ;
+      index += count ;
+      first = (first + count) << 1 ;
+      code <<= 1 ;
+   }
+   fail("bad code in compressed data") ;
+   return -1 ;
+}
+
+
+bool SallyInflate::stored(string& out) {
+   m_bits = 0 ;          // the rest of the current byte
+   m_nbits = 0 ;
+
+   if (m_size - m_pos < 4) return fail("compressed data is cut short") ;
+   unsigned len = m_data[m_pos] | (m_data[m_pos + 1] << 8) ;
+   unsigned check = m_data[m_pos + 2] | (m_data[m_pos + 3] << 8) ;
+   m_pos += 4 ;
+   if (len != (~check & 0xffff)) return fail("bad stored block length") ;
+   if (m_size - m_pos < len) return fail("compressed data is cut short") ;
+
+   out.append((const char *) m_data + m_pos, len) ;
+   m_pos += len ;
+   return true ;
+}
+
+
+// literals and length/distance pairs up to the end of the block
+//
+bool SallyInflate::codes(string& out, const Huffman& lencode, const Huffman& distcode) {
+   while (true) {
+      int sym = decode(lencode) ;
+      if (m_error != NULL) return false ;
+
+      if (sym < 256) {
+         out.push_back((char) sym) ;
+         continue ;
+      }
+      if (sym == 256) return true ;
+
+      sym -= 257 ;
+      if (sym >= 29) return fail("bad length code") ;
+      size_t len = lengthBase[sym] + bits(lengthExtra[sym]) ;
+
+      sym = decode(distcode) ;
+      if (m_error != NULL) return false ;
+      if (sym >= 30) return fail("bad distance code") ;
+      size_t dist = distBase[sym] + bits(distExtra[sym]) ;
+      if (m_error != NULL) return false ;
+      if (dist > out.size()) return fail("distance too far back") ;
+
+      // the copy may overlap what it is making
+      //
+      size_t from = out.size() - dist ;
+      for (size_t i = 0 ; i < len ; i++) out.push_back(out[from + i]) ;
+   }
+}
+
+
+bool SallyInflate::dynamic(string& out) {
+   short lengths[320] ;     // literal/length then distance
+   Huffman lencode, distcode ;
+
+   int nlen = bits(5) + 257 ;
+   int ndist = bits(5) + 1 ;
+   int ncode = bits(4) + 4 ;
+   if (m_error != NULL) return false ;
+   if (nlen > 286 || ndist > 30) return fail("bad code counts") ;
+
+   // the code for the code lengths
+   //
+   int index ;
+   for (index = 0 ; index < ncode ; index++) lengths[lengthOrder[index]] = bits(3) ;
+   for ( ; index < 19 ; index++) lengths[lengthOrder[index]] = 0 ;
+   if (m_error != NULL) return false ;
+   if (build(lencode, lengths, 19) != 0) return fail("bad code lengths code") ;
+
+   index = 0 ;
+   while (index < nlen + ndist) {
+      int sym = decode(lencode) ;
+      if (m_error != NULL) return false ;
+
+      if (sym < 16) {
+         lengths[index++] = sym ;
+         continue ;
+      }
+
+      short len = 0 ;       // what to repeat
+      int times ;
+      if (sym == 16) {
+         if (index == 0) return fail("repeat with no length") ;
+         len = lengths[index - 1] ;
+         times = 3 + bits(2) ;
+      } else if (sym == 17) {
+         times = 3 + bits(3) ;
+      } else {
+         times = 11 + bits(7) ;
+      }
+      if (index + times > nlen + ndist) return fail("too many code lengths") ;
+      while (times-- > 0) lengths[index++] = len ;
+   }
+   if (m_error != NULL) return false ;
+   if (lengths[256] == 0) return fail("no end of block code") ;
+
+   // incomplete codes are only allowed for a single length 1 code
+   //
+   int left = build(lencode, lengths, nlen) ;
+   if (left < 0 || (left > 0 && nlen - lencode.m_count[0] != 1)) {
+      return fail("bad literal/length code") ;
+   }
+   left = build(distcode, lengths + nlen, ndist) ;
+   if (left < 0 || (left > 0 && ndist - distcode.m_count[0] != 1)) {
+      return fail("bad distance code") ;
+   }
+
+   return codes(out, lencode, distcode) ;
+}
+
+
+bool SallyInflate::block(string& out) {
+   if (m_last || m_error != NULL) return false ;
+
+   m_last = bits(1) == 1 ;
+   int type = bits(2) ;
+   if (m_error != NULL) return false ;
+
+   bool ok ;
+   if (type == 0) {
+      ok = stored(out) ;
+   } else if (type == 1) {
+      ok = codes(out, m_fixedLen, m_fixedDist) ;
+   } else if (type == 2) {
+      ok = dynamic(out) ;
+   } else {
+      ok = fail("bad block type") ;
+   }
+   if (!ok) m_last = true ;
+   return ok ;
+}
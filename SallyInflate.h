@@ -0,0 +1,81 @@
+// File: SallyInflate.h
+//
+// CMSC 341 Spring 2017 Project 2
+//
+// A small DEFLATE (RFC 1951) decoder, so compressed programs can
+// be run without linking zlib. Used by SallyGzipInput.
+//
+// The compressed data must all be there before decoding starts,
+// but the output comes a block at a time: block() appends one
+// block to a string that only has to keep the last INFLATE_WINDOW
+// bytes before it, the furthest back a block can refer to.
+//
+// Codes are decoded a bit at a time with the canonical code
+// counts (as in zlib's puff.c), which is slower than zlib's
+// tables but short enough to check by reading.
+//
+
+#ifndef _SALLYINFLATE_H_
+#define _SALLYINFLATE_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+using namespace std ;
+
+
+const size_t INFLATE_WINDOW = 32768 ;
+
+
+class SallyInflate {
+
+public:
+
+   // decode the raw DEFLATE stream in data[0 .. size-1]
+   //
+   SallyInflate(const unsigned char *data, size_t size) ;
+
+   // Decode the next block onto the end of out. False when the
+   // last block is done already, or if the data is bad, in which
+   // case error() says why.
+   //
+   bool block(string& out) ;
+
+   // NULL if nothing has gone wrong
+   //
+   const char *error() const { return m_error ; }
+
+   // bytes of data used so far, counting a partly used byte
+   //
+   size_t used() const { return m_pos ; }
+
+private:
+
+   struct Huffman {
+      short m_count[16] ;     // codes of each length
+      short m_symbol[288] ;   // symbols in canonical order
+   } ;
+
+   const unsigned char *m_data ;
+   size_t m_size ;
+   size_t m_pos ;
+   uint32_t m_bits ;          // bits read but not used, low first
+   int m_nbits ;
+   bool m_last ;              // the last block has been decoded
+   const char *m_error ;
+
+   Huffman m_fixedLen ;
+   Huffman m_fixedDist ;
+
+   uint32_t bits(int need) ;
+   int decode(const Huffman& h) ;
+   static int build(Huffman& h, const short *lengths, int n) ;
+
+   bool stored(string& out) ;
+   bool codes(string& out, const Huffman& len, const Huffman& dist) ;
+   bool dynamic(string& out) ;
+   bool fail(const char *why) ;
+
+} ;
+
+#endif
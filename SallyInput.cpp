@@ -0,0 +1,411 @@
+// File: SallyInput.cpp
+//
+// CMSC 341 Spring 2017 Project 2
+//
+// Implementation of the Sally Forth input sources
+//
+
+#include <cstring>
+#include <cerrno>
+#include <string>
+using namespace std ;
+
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "SallyInput.h"
+
+
+bool SallyInput::line(const char *&begin, size_t& len) {
+   if (!m_interrupted) m_line.clear() ;     // else it is still going
+   m_interrupted = false ;
+
+   while (true) {
+      const char *nl = NULL ;
+      if (m_pos != m_end) nl = (const char *) memchr(m_pos, '\n', m_end - m_pos) ;
+
+      if (nl != NULL) {
+         if (m_line.empty()) {
+            begin = m_pos ;
+            len = nl - m_pos ;
+         } else {
+            m_line.append(m_pos, nl - m_pos) ;
+            begin = m_line.data() ;
+            len = m_line.size() ;
+         }
+         m_pos = nl + 1 ;
+         return true ;
+      }
+
+      // the line goes on in the next chunk
+      //
+      if (m_pos != m_end) m_line.append(m_pos, m_end - m_pos) ;
+      if (!read(m_pos, m_end)) {
+         m_pos = m_end = NULL ;
+         return false ;
+      }
+   }
+}
+
+
+void SallyInput::rest(const char *&begin, const char *&end, string& storage) {
+   const char *b = m_pos ;
+   const char *e = m_end ;
+
+   m_pos = m_end = NULL ;
+   storage.clear() ;
+
+   // the start of a line an interrupted line() was reading
+   //
+   if (m_interrupted) storage.swap(m_line) ;
+   m_interrupted = false ;
+
+   if (b == e && !read(b, e)) {
+      begin = storage.data() ;
+      end = begin + storage.size() ;
+      return ;
+   }
+   if (ended() && storage.empty()) {
+      begin = b ;
+      end = e ;
+      return ;
+   }
+
+   storage.append(b, e - b) ;
+   while (read(b, e)) storage.append(b, e - b) ;
+   begin = storage.data() ;
+   end = begin + storage.size() ;
+}
+
+
+bool SallyInput::startsWith(const char *magic, size_t len) {
+   if (m_pos == m_end && !read(m_pos, m_end)) {
+      m_pos = m_end = NULL ;
+      return false ;
+   }
+   return (size_t) (m_end - m_pos) >= len && memcmp(m_pos, magic, len) == 0 ;
+}
+
+
+SallyInput *SallyInput::open(const string& path) {
+   int fd = ::open(path.c_str(), O_RDONLY) ;
+   if (fd < 0) return NULL ;
+
+   struct stat st ;
+   if (fstat(fd, &st) < 0 || S_ISDIR(st.st_mode)) {
+      close(fd) ;
+      return NULL ;
+   }
+
+   SallyInput *in ;
+   if (S_ISREG(st.st_mode)) {
+      SallyMmapInput *m = new SallyMmapInput(fd) ;
+      if (!m->error().empty()) {
+         delete m ;
+         return NULL ;
+      }
+      in = m ;
+   } else {
+      in = new SallyPipeInput(fd, true) ;
+   }
+
+   if (in->startsWith("\x1f\x8b", 2)) {
+      in = new SallyGzipInput(in, true) ;
+   }
+   return in ;
+}
+
+
+// -------------------------------------------------------
+
+
+bool SallyStreamInput::read(const char *&begin, const char *&end) {
+   if (!*m_stream) return false ;
+
+   // all that is buffered, if anything is
+   //
+   streamsize avail = m_stream->rdbuf()->in_avail() ;
+   if (avail > 0) {
+      m_chunk.resize((size_t) avail) ;
+      m_chunk.resize((size_t) m_stream->readsome(&m_chunk[0], avail)) ;
+   } else {
+      m_chunk.clear() ;
+   }
+
+   // else wait for a line
+   //
+   if (m_chunk.empty()) {
+      getline(*m_stream, m_chunk) ;
+      if (!m_stream->eof()) {
+         m_chunk.push_back('\n') ;
+      } else if (m_chunk.empty()) {
+         return false ;
+      }
+   }
+
+   begin = m_chunk.data() ;
+   end = begin + m_chunk.size() ;
+   return true ;
+}
+
+
+// -------------------------------------------------------
+
+
+bool SallyMemoryInput::read(const char *&begin, const char *&end) {
+   if (m_done) return false ;
+
+   m_done = true ;
+   if (m_size == 0) return false ;
+   begin = m_data ;
+   end = m_data + m_size ;
+   return true ;
+}
+
+
+SallyMmapInput::SallyMmapInput(int fd) :
+   SallyMemoryInput(NULL, 0), m_map(NULL), m_mapped(0)
+{
+   struct stat st ;
+
+   if (fstat(fd, &st) < 0) {
+      m_error = strerror(errno) ;
+   } else if (st.st_size > 0) {
+      void *p = mmap(NULL, (size_t) st.st_size, PROT_READ, MAP_PRIVATE, fd, 0) ;
+      if (p == MAP_FAILED) {
+         m_error = strerror(errno) ;
+      } else {
+         madvise(p, (size_t) st.st_size, MADV_SEQUENTIAL) ;
+         m_map = p ;
+         m_mapped = (size_t) st.st_size ;
+         m_data = (const char *) p ;
+         m_size = m_mapped ;
+      }
+   }
+   close(fd) ;
+}
+
+
+SallyMmapInput::~SallyMmapInput() {
+   if (m_map != NULL) munmap(m_map, m_mapped) ;
+}
+
+
+// -------------------------------------------------------
+
+
+SallyPipeInput::SallyPipeInput(int fd, bool owned) :
+   m_fd(fd), m_owned(owned), m_done(false), m_stop(false)
+{
+   m_flags = fcntl(fd, F_GETFL) ;
+   if (m_flags >= 0) fcntl(fd, F_SETFL, m_flags | O_NONBLOCK) ;
+   m_wake = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC) ;
+}
+
+
+SallyPipeInput::~SallyPipeInput() {
+   if (m_wake >= 0) close(m_wake) ;
+   if (m_owned) {
+      close(m_fd) ;
+   } else if (m_flags >= 0) {
+      fcntl(m_fd, F_SETFL, m_flags) ;
+   }
+}
+
+
+bool SallyPipeInput::read(const char *&begin, const char *&end) {
+   while (!m_done) {
+      ssize_t n = ::read(m_fd, m_buf, sizeof m_buf) ;
+
+      if (n > 0) {
+         begin = m_buf ;
+         end = m_buf + n ;
+         return true ;
+      }
+      if (n == 0) {
+         m_done = true ;
+      } else if (errno == EAGAIN || errno == EWOULDBLOCK) {
+         if (m_stop.load()) {
+            m_interrupted = true ;
+            return false ;
+         }
+
+         // without an eventfd, look at m_stop now and then instead
+         //
+         pollfd p[2] = { { m_fd, POLLIN, 0 }, { m_wake, POLLIN, 0 } } ;
+         poll(p, 2, m_wake >= 0 ? -1 : 10) ;
+      } else if (errno != EINTR) {
+         m_error = strerror(errno) ;
+         m_done = true ;
+      }
+   }
+   return false ;
+}
+
+
+// m_stop is set before the eventfd is written, so a read() that
+// misses one on its way into poll() is woken by the other.
+//
+void SallyPipeInput::interrupt() {
+   m_stop.store(true) ;
+   if (m_wake >= 0) {
+      uint64_t one = 1 ;
+      ssize_t n = ::write(m_wake, &one, sizeof one) ;
+      (void) n ;
+   }
+}
+
+
+void SallyPipeInput::resume() {
+   if (m_wake >= 0) {
+      uint64_t count ;
+      ssize_t n = ::read(m_wake, &count, sizeof count) ;
+      (void) n ;
+   }
+   m_stop.store(false) ;
+}
+
+
+// -------------------------------------------------------
+
+
+// CRC-32 of the gzip trailer (the one zlib and PNG use)
+//
+struct Crc32Table {
+   uint32_t m_entry[256] ;
+
+   Crc32Table() {
+      for (uint32_t i = 0 ; i < 256 ; i++) {
+         uint32_t c = i ;
+         for (int k = 0 ; k < 8 ; k++) c = (c & 1) ? 0xedb88320u ^ (c >> 1) : c >> 1 ;
+         m_entry[i] = c ;
+      }
+   }
+} ;
+
+static uint32_t crc32(uint32_t crc, const char *p, size_t n) {
+   static const Crc32Table table ;
+
+   crc = ~crc ;
+   for (size_t i = 0 ; i < n ; i++) {
+      crc = table.m_entry[(crc ^ (unsigned char) p[i]) & 0xff] ^ (crc >> 8) ;
+   }
+   return ~crc ;
+}
+
+
+SallyGzipInput::SallyGzipInput(SallyInput *compressed, bool owned) :
+   m_source(compressed), m_owned(owned), m_state(GZ_START),
+   m_data(NULL), m_size(0), m_pos(0), m_inflate(NULL), m_crc(0), m_length(0)
+{
+}
+
+
+SallyGzipInput::~SallyGzipInput() {
+   delete m_inflate ;
+   if (m_owned) delete m_source ;
+}
+
+
+bool SallyGzipInput::fail(const char *why) {
+   m_error = why ;
+   m_state = GZ_DONE ;
+   return false ;
+}
+
+
+// Skip the member header at m_pos and start decoding
+// what follows it.
+//
+bool SallyGzipInput::header() {
+   const unsigned char *h = m_data + m_pos ;
+   size_t left = m_size - m_pos ;
+
+   if (left < 10 || h[0] != 0x1f || h[1] != 0x8b) return fail("not a gzip file") ;
+   if (h[2] != 8) return fail("unknown gzip compression method") ;
+
+   int flags = h[3] ;
+   size_t at = 10 ;
+
+   if (flags & 4) {                 // FEXTRA
+      if (left < at + 2) return fail("gzip header is cut short") ;
+      at += 2 + (h[at] | (h[at + 1] << 8)) ;
+   }
+   for (int f = 8 ; f <= 16 ; f += 8) {       // FNAME, FCOMMENT
+      if (flags & f) {
+         while (at < left && h[at] != 0) at++ ;
+         at++ ;
+      }
+   }
+   if (flags & 2) at += 2 ;         // FHCRC
+   if (at > left) return fail("gzip header is cut short") ;
+
+   m_pos += at ;
+   delete m_inflate ;
+   m_inflate = new SallyInflate(m_data + m_pos, m_size - m_pos) ;
+   m_crc = 0 ;
+   m_length = 0 ;
+   m_state = GZ_BLOCKS ;
+   return true ;
+}
+
+
+// Check the trailer after the member just decoded. Another
+// member may follow.
+//
+bool SallyGzipInput::trailer() {
+   m_pos += m_inflate->used() ;
+   if (m_size - m_pos < 8) return fail("gzip file is cut short") ;
+
+   const unsigned char *t = m_data + m_pos ;
+   uint32_t crc = t[0] | (t[1] << 8) | (t[2] << 16) | ((uint32_t) t[3] << 24) ;
+   uint32_t length = t[4] | (t[5] << 8) | (t[6] << 16) | ((uint32_t) t[7] << 24) ;
+   if (crc != m_crc || length != m_length) return fail("gzip data is corrupt") ;
+
+   m_pos += 8 ;
+   m_state = (m_size - m_pos >= 2 && t[8] == 0x1f && t[9] == 0x8b) ? GZ_HEADER : GZ_DONE ;
+   return true ;
+}
+
+
+bool SallyGzipInput::read(const char *&begin, const char *&end) {
+   if (m_state == GZ_START) {
+      const char *b, *e ;
+      m_source->rest(b, e, m_storage) ;
+      m_data = (const unsigned char *) b ;
+      m_size = e - b ;
+      m_state = GZ_HEADER ;
+   }
+
+   // keep what the next blocks may copy from
+   //
+   if (m_out.size() > INFLATE_WINDOW) m_out.erase(0, m_out.size() - INFLATE_WINDOW) ;
+   size_t from = m_out.size() ;
+
+   while (m_out.size() - from < GZIP_CHUNK && m_state != GZ_DONE) {
+      if (m_state == GZ_HEADER) {
+         header() ;
+         continue ;
+      }
+
+      size_t had = m_out.size() ;
+      if (m_inflate->block(m_out)) {
+         m_crc = crc32(m_crc, m_out.data() + had, m_out.size() - had) ;
+         m_length += (uint32_t) (m_out.size() - had) ;
+      } else if (m_inflate->error() != NULL) {
+         m_out.resize(had) ;       // not the bad block
+         fail(m_inflate->error()) ;
+      } else {
+         trailer() ;
+      }
+   }
+
+   if (m_out.size() == from) return false ;
+   begin = m_out.data() + from ;
+   end = m_out.data() + m_out.size() ;
+   return true ;
+}
@@ -0,0 +1,272 @@
+// File: SallyInput.h
+//
+// CMSC 341 Spring 2017 Project 2
+//
+// Where a Sally Forth program is read from.
+//
+// A SallyInput hands out its text in chunks, as large as the
+// source has them: all of an mmap'd file or a buffer in memory
+// at once, whatever a pipe holds, a block of a gzip file. The
+// interpreter, the prefetch thread and preload() take lines out
+// of the chunks with line() and lex them where they are; only a
+// line split across two chunks is copied.
+//
+//   SallyStreamInput   an istream, what Sally(istream&) uses
+//   SallyMemoryInput   a buffer owned by the caller, not copied
+//   SallyMmapInput     a file, mapped into memory
+//   SallyPipeInput     a pipe, FIFO or socket, read without blocking
+//                      and waiting in poll() while it is empty,
+//                      which interrupt() can cut short
+//   SallyGzipInput     another input, gzip compressed, decoded
+//                      with SallyInflate
+//
+// SallyInput::open() picks the right one for a file name.
+//
+
+#ifndef _SALLYINPUT_H_
+#define _SALLYINPUT_H_
+
+#include <cstddef>
+#include <atomic>
+#include <cstdint>
+#include <iostream>
+#include <string>
+using namespace std ;
+
+#include "SallyInflate.h"
+
+
+class SallyInput {
+
+public:
+
+   virtual ~SallyInput() {}
+
+   // Point begin and end at the next chunk of the input, which
+   // stays valid until the next call. Chunks can end anywhere,
+   // even in the middle of a line. False at the end of the input
+   // or on an error, and every time after that.
+   //
+   virtual bool read(const char *&begin, const char *&end) = 0 ;
+
+   // why the input ended early, empty if it did not
+   //
+   const string& error() const { return m_error ; }
+
+   // The next line, without its '\n', valid until the next call.
+   // False at the end of the input. A last line with no '\n' is
+   // dropped, as fillBuffer() always has.
+   //
+   bool line(const char *&begin, size_t& len) ;
+
+   // All of the input line() has not taken, in one piece: in the
+   // input's own chunk if it was the last one, else in storage.
+   //
+   void rest(const char *&begin, const char *&end, string& storage) ;
+
+   // Does the first chunk start with these bytes? Call it before
+   // anything else reads the input.
+   //
+   bool startsWith(const char *magic, size_t len) ;
+
+   // From another thread: make a read() that is waiting for input
+   // give up, now or the next time it would wait, until resume().
+   // line() then returns false with interrupted() set, and carries
+   // on with the line it was part way through once resumed. Only
+   // SallyPipeInput waits where it can be interrupted; the others
+   // ignore it.
+   //
+   virtual void interrupt() {}
+   virtual void resume() {}
+
+   // did the last line() stop because of interrupt()?
+   //
+   bool interrupted() const { return m_interrupted ; }
+
+   // Open the file at path: mapped if it is a regular file, read as
+   // a pipe if not, and decoded if it starts like a gzip file.
+   // NULL if it cannot be opened.
+   //
+   static SallyInput *open(const string& path) ;
+
+protected:
+
+   SallyInput() : m_interrupted(false), m_pos(NULL), m_end(NULL) {}
+
+   // forget any chunk line() was part way through
+   //
+   void restart() { m_pos = m_end = NULL ; m_interrupted = false ; m_error.clear() ; }
+
+   // true if read() is sure to return false next time, so the
+   // last chunk can be used after calling it
+   //
+   virtual bool ended() const { return false ; }
+
+   string m_error ;
+   bool m_interrupted ;     // set by read() when it gives up for interrupt()
+
+private:
+
+   const char *m_pos ;      // what line() has not taken of the chunk
+   const char *m_end ;
+   string m_line ;          // a line split across chunks
+
+} ;
+
+
+
+// Reads an istream. Whatever the stream has buffered already is
+// handed over in one piece, otherwise a line at a time, so a
+// program typed at a terminal runs each paragraph as it ends.
+//
+class SallyStreamInput : public SallyInput {
+
+public:
+
+   SallyStreamInput(istream& input_stream) : m_stream(&input_stream) {}
+
+   // read from another stream from now on
+   //
+   void attach(istream& input_stream) { m_stream = &input_stream ; restart() ; }
+
+   virtual bool read(const char *&begin, const char *&end) ;
+
+private:
+
+   istream *m_stream ;
+   string m_chunk ;
+
+} ;
+
+
+
+// Hands out size bytes at data, which must stay put until the
+// input is done with, as one chunk.
+//
+class SallyMemoryInput : public SallyInput {
+
+public:
+
+   SallyMemoryInput(const char *data, size_t size) :
+      m_data(data), m_size(size), m_done(false) {}
+
+   virtual bool read(const char *&begin, const char *&end) ;
+
+protected:
+
+   virtual bool ended() const { return m_done ; }
+
+   const char *m_data ;
+   size_t m_size ;
+   bool m_done ;
+
+} ;
+
+
+
+// The file open on fd, mapped into memory and read as one chunk.
+// Takes fd over, closing it once it is mapped.
+//
+class SallyMmapInput : public SallyMemoryInput {
+
+public:
+
+   SallyMmapInput(int fd) ;
+   ~SallyMmapInput() ;
+
+private:
+
+   void *m_map ;
+   size_t m_mapped ;
+
+   SallyMmapInput(const SallyMmapInput&) ;             // no copies
+   SallyMmapInput& operator=(const SallyMmapInput&) ;
+
+} ;
+
+
+
+// Reads fd with O_NONBLOCK set, handing over whatever one read()
+// gets. When the pipe is empty it waits in poll() rather than in
+// read(), along with an eventfd interrupt() writes to. Closes fd
+// at the end if owned, else puts its flags back.
+//
+const size_t PIPE_CHUNK = 1 << 16 ;
+
+class SallyPipeInput : public SallyInput {
+
+public:
+
+   SallyPipeInput(int fd, bool owned = false) ;
+   ~SallyPipeInput() ;
+
+   virtual bool read(const char *&begin, const char *&end) ;
+   virtual void interrupt() ;
+   virtual void resume() ;
+
+private:
+
+   int m_fd ;
+   bool m_owned ;
+   int m_flags ;            // fd's flags before
+   bool m_done ;
+   int m_wake ;             // eventfd that wakes poll() for interrupt()
+   atomic<bool> m_stop ;    // interrupted until resume()
+   char m_buf[PIPE_CHUNK] ;
+
+   SallyPipeInput(const SallyPipeInput&) ;             // no copies
+   SallyPipeInput& operator=(const SallyPipeInput&) ;
+
+} ;
+
+
+
+// Decodes a gzip file (RFC 1952), one or more members, read from
+// compressed, which is read whole before decoding starts. Chunks
+// are at least GZIP_CHUNK bytes, block by block. Deletes compressed
+// at the end if owned.
+//
+const size_t GZIP_CHUNK = 1 << 16 ;
+
+class SallyGzipInput : public SallyInput {
+
+public:
+
+   SallyGzipInput(SallyInput *compressed, bool owned = false) ;
+   ~SallyGzipInput() ;
+
+   virtual bool read(const char *&begin, const char *&end) ;
+
+protected:
+
+   virtual bool ended() const { return m_state == GZ_DONE ; }
+
+private:
+
+   enum State { GZ_START, GZ_HEADER, GZ_BLOCKS, GZ_DONE } ;
+
+   SallyInput *m_source ;
+   bool m_owned ;
+   State m_state ;
+
+   const unsigned char *m_data ;    // all of the compressed input
+   size_t m_size ;
+   size_t m_pos ;                   // start of the member being decoded
+   string m_storage ;               // m_data, if the source had it in pieces
+
+   SallyInflate *m_inflate ;        // for the member being decoded
+   string m_out ;                   // the last chunk, after up to
+                                    // INFLATE_WINDOW bytes of the one before
+   uint32_t m_crc ;                 // of the member so far
+   uint32_t m_length ;              // and its length, mod 2^32
+
+   bool header() ;
+   bool trailer() ;
+   bool fail(const char *why) ;
+
+   SallyGzipInput(const SallyGzipInput&) ;             // no copies
+   SallyGzipInput& operator=(const SallyGzipInput&) ;
+
+} ;
+
+#endif
@@ -0,0 +1,694 @@
+// File: SallyJit.cpp
+//
+// CMSC 341 Spring 2017 Project 2
+//
+// Compiling hot DO ... UNTIL loops to x86-64 code
+//
+
+#include <cstring>
+#include <cstdint>
+#include <string>
+#include <vector>
+using namespace std ;
+
+#if defined(__x86_64__)
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+#include "Sally.h"
+#include "SallyJit.h"
+
+
+// native loop body: runs from entry point number entry until the
+// loop ends (returns -1) or a body token has to be run by the
+// interpreter (returns its position in the body).
+//
+typedef int (*jit_fn)(Cell *window, Cell **vars, int entry) ;
+
+
+struct JitLoop {
+   void *m_mem ;              // executable mapping holding m_fn
+   size_t m_size ;
+   jit_fn m_fn ;
+
+   size_t m_start ;           // first token of the body
+   size_t m_until ;           // the UNTIL ending it
+   vector<int> m_op ;         // opcode of each body token, -1 if not a KEYWORD
+   vector<int> m_depth ;      // window depth before each body token, and after UNTIL
+   vector<int> m_entries ;    // body token each entry point starts at
+   int m_maxDepth ;
+   vector<Token> m_vars ;     // variables named in the body, m_fn's vars[i]
+   bool m_stores ;            // body changes variables
+} ;
+
+
+static void freeLoop(JitLoop *loop) {
+#if defined(__x86_64__)
+   munmap(loop->m_mem, loop->m_size) ;
+#endif
+   delete loop ;
+}
+
+
+// longest loop body we try to compile
+//
+const size_t JIT_MAX_BODY = 4096 ;
+
+
+// -------------------------------------------------------
+//
+// Instruction encoding. The generated function keeps
+// window in rdi, vars in rsi and does its work in eax, ecx, edx,
+// or rax, rcx, rdx when cells are 64 bits: cell() puts the REX.W
+// prefix in front of every instruction on a cell. Variables
+// live in r8 to r11 (see generate()).
+//
+
+#if defined(__x86_64__)
+
+enum { EAX = 0, ECX = 1, EDX = 2, R8 = 8 } ;
+
+// registers r8 .. r11 that hold variables
+//
+const int JIT_VAR_REGS = 4 ;
+
+// condition codes for jcc / setcc
+//
+enum { CC_O = 0x0, CC_E = 0x4, CC_NE = 0x5, CC_L = 0xC, CC_GE = 0xD, CC_LE = 0xE, CC_G = 0xF } ;
+
+
+class Emitter {
+
+public:
+
+   vector<unsigned char> m_code ;
+
+   size_t here() const { return m_code.size() ; }
+
+   void byte(int b) { m_code.push_back((unsigned char) b) ; }
+
+   void imm32(int32_t v) {
+      for (int i = 0 ; i < 4 ; i++) byte((v >> (8 * i)) & 0xFF) ;
+   }
+
+   void cell() {
+      if (sizeof(Cell) == 8) byte(0x48) ;
+   }
+
+   // cell() for an instruction whose ModRM names reg and rm,
+   // either of which may be r8 .. r15
+   //
+   void cellRex(int reg, int rm) {
+      int rex = (sizeof(Cell) == 8 ? 0x48 : 0x40) | (reg >> 3) << 2 | rm >> 3 ;
+      if (rex != 0x40) byte(rex) ;
+   }
+
+   // mov reg, window[slot]
+   //
+   void load(int reg, int slot) {
+      cellRex(reg, 7) ; byte(0x8B) ; byte(0x80 | (reg & 7) << 3 | 7) ; imm32(slot * sizeof(Cell)) ;
+   }
+
+   // mov window[slot], reg
+   //
+   void store(int slot, int reg) {
+      cellRex(reg, 7) ; byte(0x89) ; byte(0x80 | (reg & 7) << 3 | 7) ; imm32(slot * sizeof(Cell)) ;
+   }
+
+   // mov reg, [ptr] and mov [ptr], reg
+   //
+   void loadFrom(int reg, int ptr) {
+      cellRex(reg, ptr) ; byte(0x8B) ; byte((reg & 7) << 3 | (ptr & 7)) ;
+   }
+
+   void storeTo(int ptr, int reg) {
+      cellRex(reg, ptr) ; byte(0x89) ; byte((reg & 7) << 3 | (ptr & 7)) ;
+   }
+
+   // mov reg, v
+   //
+   void loadImm(int reg, Cell v) {
+      if (v == (int32_t) v) {
+         if (sizeof(Cell) == 8) {
+            byte(0x48) ; byte(0xC7) ; byte(0xC0 + reg) ;   // sign extended
+         } else {
+            byte(0xB8 + reg) ;
+         }
+         imm32((int32_t) v) ;
+         return ;
+      }
+      byte(0x48) ; byte(0xB8 + reg) ;                   // movabs
+      for (int i = 0 ; i < 8 ; i++) byte(((int64_t) v >> (8 * i)) & 0xFF) ;
+   }
+
+   // mov reg, vars[v]   (rax, rcx or rdx)
+   //
+   void varPtr(int v, int reg = EAX) {
+      byte(0x48) ; byte(0x8B) ; byte(0x86 | reg << 3) ; imm32(v * sizeof(int *)) ;
+   }
+
+   // eax = 1 if condition cc holds, else 0
+   //
+   void setFlag(int cc) {
+      byte(0x0F) ; byte(0x90 | cc) ; byte(0xC0) ;   // setcc al
+      byte(0x0F) ; byte(0xB6) ; byte(0xC0) ;        // movzx eax, al
+   }
+
+   // return v from the generated function
+   //
+   void exit(int v) {
+      byte(0xB8 + EAX) ; imm32(v) ;
+      byte(0xC3) ;
+   }
+
+   // jump if cc, target filled in by patch(). returns where.
+   //
+   size_t jcc(int cc) {
+      byte(0x0F) ; byte(0x80 | cc) ; imm32(0) ;
+      return here() - 4 ;
+   }
+
+   void patch(size_t at, size_t target) {
+      int32_t rel = (int32_t) target - (int32_t) (at + 4) ;
+      memcpy(&m_code[at], &rel, 4) ;
+   }
+
+} ;
+
+
+// the comparison words, as condition codes on cmp second, top
+//
+static int compareCC(int op) {
+   switch (op) {
+   case OP_EE:  return CC_E ;
+   case OP_NE:  return CC_NE ;
+   case OP_LT:  return CC_L ;
+   case OP_LTE: return CC_LE ;
+   case OP_GT:  return CC_G ;
+   default:     return CC_GE ;
+   }
+}
+
+
+// return r, first writing the variables in registers that the
+// body stores back to where vars points
+//
+static void leave(Emitter& e, const vector<bool>& stored, int r) {
+   for (size_t v = 0 ; v < stored.size() && v < (size_t) JIT_VAR_REGS ; v++) {
+      if (!stored[v]) continue ;
+      e.varPtr(v, ECX) ;
+      e.storeTo(ECX, R8 + v) ;
+   }
+   e.exit(r) ;
+}
+
+
+// Generate code for a checked body, false if it cannot be mapped.
+//
+// The first JIT_VAR_REGS variables stay in registers while the
+// native code runs. They are loaded on every entry and, if the
+// body stores them, written back before every return, where the
+// interpreter (and DUMP) can see them. A variable the body only
+// reads is then loaded once per entry rather than once per time
+// round the loop.
+//
+static bool generate(JitLoop *loop, const vector<Token>& code) {
+   Emitter e ;
+   size_t n = loop->m_op.size() ;
+   vector<size_t> label(n, 0) ;
+   vector< pair<size_t, int> > exits ;     // jump to patch, body token to stop at
+   vector< pair<size_t, int> > entries ;   // jump to patch, body token to start at
+
+   // which variable each NAME token is, and is it ever stored
+   //
+   vector<int> var(n, -1) ;
+   vector<bool> stored(loop->m_vars.size(), false) ;
+   for (size_t k = 0 ; k < n ; k++) {
+      const Token& tk = code[loop->m_start + k] ;
+      if (tk.m_kind == INTEGER || loop->m_op[k] >= 0) continue ;
+
+      var[k] = 0 ;
+      while (loop->m_vars[var[k]].m_text != tk.m_text) var[k]++ ;
+      if (loop->m_op[k+1] == OP_EX) stored[var[k]] = true ;
+      k++ ;
+   }
+
+   for (size_t v = 0 ; v < loop->m_vars.size() && v < (size_t) JIT_VAR_REGS ; v++) {
+      e.varPtr(v) ;
+      e.loadFrom(R8 + v, EAX) ;
+   }
+
+   // pick the entry point: 0 is the top of the loop
+   //
+   for (size_t i = 1 ; i < loop->m_entries.size() ; i++) {
+      e.byte(0x81) ; e.byte(0xFA) ; e.imm32(i) ;   // cmp edx, i
+      entries.push_back( make_pair(e.jcc(CC_E), loop->m_entries[i]) ) ;
+   }
+
+   for (size_t k = 0 ; k < n ; k++) {
+      const Token& tk = code[loop->m_start + k] ;
+      int d = loop->m_depth[k] ;
+
+      label[k] = e.here() ;
+
+      if (tk.m_kind == INTEGER) {
+         e.loadImm(EAX, tk.m_value) ;
+         e.store(d, EAX) ;
+         continue ;
+      }
+
+      if (loop->m_op[k] < 0) {      // NAME @ or NAME !
+         int v = var[k] ;
+         if (v < JIT_VAR_REGS) {
+            if (loop->m_op[k+1] == OP_AT) {
+               e.store(d, R8 + v) ;
+            } else {
+               e.load(R8 + v, d-1) ;
+            }
+            k++ ;
+            continue ;
+         }
+         e.varPtr(v) ;
+         if (loop->m_op[k+1] == OP_AT) {
+            e.cell() ; e.byte(0x8B) ; e.byte(0x00) ;   // mov eax, [rax]
+            e.store(d, EAX) ;
+         } else {
+            e.load(ECX, d-1) ;
+            e.cell() ; e.byte(0x89) ; e.byte(0x08) ;   // mov [rax], ecx
+         }
+         k++ ;
+         continue ;
+      }
+
+      switch (loop->m_op[k]) {
+
+      case OP_PLUS:
+      case OP_MINUS:
+      case OP_TIMES:
+         e.load(EAX, d-2) ;
+         e.load(ECX, d-1) ;
+         e.cell() ;
+         if (loop->m_op[k] == OP_PLUS) {
+            e.byte(0x01) ; e.byte(0xC8) ;                  // add eax, ecx
+         } else if (loop->m_op[k] == OP_MINUS) {
+            e.byte(0x29) ; e.byte(0xC8) ;                  // sub eax, ecx
+         } else {
+            e.byte(0x0F) ; e.byte(0xAF) ; e.byte(0xC1) ;   // imul eax, ecx
+         }
+         if (SALLY_CHECKED) {
+            exits.push_back( make_pair(e.jcc(CC_O), (int) k) ) ;
+         }
+         e.store(d-2, EAX) ;
+         break ;
+
+      case OP_DIVIDE:
+      case OP_MOD:
+         // dividing by 0 or -1 is left to doDivide/doMod
+         //
+         e.load(EAX, d-2) ;
+         e.load(ECX, d-1) ;
+         e.cell() ; e.byte(0x85) ; e.byte(0xC9) ;          // test ecx, ecx
+         exits.push_back( make_pair(e.jcc(CC_E), (int) k) ) ;
+         e.cell() ; e.byte(0x83) ; e.byte(0xF9) ; e.byte(0xFF) ;   // cmp ecx, -1
+         exits.push_back( make_pair(e.jcc(CC_E), (int) k) ) ;
+         e.cell() ; e.byte(0x99) ;                         // cdq
+         e.cell() ; e.byte(0xF7) ; e.byte(0xF9) ;          // idiv ecx
+         e.store(d-2, loop->m_op[k] == OP_DIVIDE ? EAX : EDX) ;
+         break ;
+
+      case OP_NEG:
+         e.load(EAX, d-1) ;
+         e.cell() ; e.byte(0xF7) ; e.byte(0xD8) ;          // neg eax
+         if (SALLY_CHECKED) {
+            exits.push_back( make_pair(e.jcc(CC_O), (int) k) ) ;
+         }
+         e.store(d-1, EAX) ;
+         break ;
+
+      case OP_DUP:
+         e.load(EAX, d-1) ;
+         e.store(d, EAX) ;
+         break ;
+
+      case OP_DROP:
+         break ;
+
+      case OP_SWAP:
+         e.load(EAX, d-1) ;
+         e.load(ECX, d-2) ;
+         e.store(d-1, ECX) ;
+         e.store(d-2, EAX) ;
+         break ;
+
+      case OP_ROT:
+         e.load(EAX, d-3) ;
+         e.load(ECX, d-2) ;
+         e.load(EDX, d-1) ;
+         e.store(d-3, ECX) ;
+         e.store(d-2, EDX) ;
+         e.store(d-1, EAX) ;
+         break ;
+
+      case OP_EE:
+      case OP_NE:
+      case OP_LT:
+      case OP_LTE:
+      case OP_GT:
+      case OP_GTE:
+         e.load(EAX, d-2) ;
+         e.load(ECX, d-1) ;
+         e.cell() ; e.byte(0x39) ; e.byte(0xC8) ;          // cmp eax, ecx
+         e.setFlag(compareCC(loop->m_op[k])) ;
+         e.store(d-2, EAX) ;
+         break ;
+
+      case OP_AND:
+         e.load(EAX, d-2) ;
+         e.load(ECX, d-1) ;
+         e.cell() ; e.byte(0x83) ; e.byte(0xF8) ; e.byte(0x01) ;   // cmp eax, 1
+         e.byte(0x0F) ; e.byte(0x94) ; e.byte(0xC2) ;      // sete dl
+         e.cell() ; e.byte(0x83) ; e.byte(0xF9) ; e.byte(0x01) ;   // cmp ecx, 1
+         e.byte(0x0F) ; e.byte(0x94) ; e.byte(0xC0) ;      // sete al
+         e.byte(0x20) ; e.byte(0xD0) ;                     // and al, dl
+         e.byte(0x0F) ; e.byte(0xB6) ; e.byte(0xC0) ;      // movzx eax, al
+         e.store(d-2, EAX) ;
+         break ;
+
+      case OP_OR:
+         e.load(EAX, d-2) ;
+         e.load(ECX, d-1) ;
+         e.cell() ; e.byte(0x09) ; e.byte(0xC8) ;          // or eax, ecx
+         e.setFlag(CC_NE) ;
+         e.store(d-2, EAX) ;
+         break ;
+
+      case OP_NOT:
+         e.load(EAX, d-1) ;
+         e.cell() ; e.byte(0x85) ; e.byte(0xC0) ;          // test eax, eax
+         e.setFlag(CC_E) ;
+         e.store(d-1, EAX) ;
+         break ;
+
+      case OP_UNTIL:
+         e.load(EAX, d-1) ;
+         e.cell() ; e.byte(0x85) ; e.byte(0xC0) ;          // test eax, eax
+         e.patch(e.jcc(CC_E), label[0]) ;
+         leave(e, stored, -1) ;
+         break ;
+
+      default:       // output words are run by the interpreter
+         leave(e, stored, k) ;
+         break ;
+      }
+   }
+
+   for (size_t i = 0 ; i < exits.size() ; i++) {
+      e.patch(exits[i].first, e.here()) ;
+      leave(e, stored, exits[i].second) ;
+   }
+   for (size_t i = 0 ; i < entries.size() ; i++) {
+      e.patch(entries[i].first, label[entries[i].second]) ;
+   }
+
+   // write the code, then make it executable but not writable
+   //
+   size_t page = sysconf(_SC_PAGESIZE) ;
+   loop->m_size = (e.here() + page - 1) / page * page ;
+   loop->m_mem = mmap(NULL, loop->m_size, PROT_READ | PROT_WRITE,
+                      MAP_PRIVATE | MAP_ANONYMOUS, -1, 0) ;
+   if (loop->m_mem == MAP_FAILED) {
+      return false ;
+   }
+   memcpy(loop->m_mem, &e.m_code[0], e.here()) ;
+   if (mprotect(loop->m_mem, loop->m_size, PROT_READ | PROT_EXEC) != 0) {
+      munmap(loop->m_mem, loop->m_size) ;
+      return false ;
+   }
+   loop->m_fn = (jit_fn) loop->m_mem ;
+   return true ;
+}
+
+#endif
+
+
+// -------------------------------------------------------
+
+
+SallyJit::SallyJit(int threshold) : hot(threshold), ncompiled(0) {
+}
+
+
+SallyJit::~SallyJit() {
+   forgetAll() ;
+}
+
+
+void SallyJit::forget(const vector<Token> *code) {
+   map<SiteKey, Site>::iterator it = sites.lower_bound( SiteKey(code, 0) ) ;
+
+   while (it != sites.end() && it->first.first == code) {
+      if (it->second.m_loop != NULL) freeLoop(it->second.m_loop) ;
+      sites.erase(it++) ;
+   }
+}
+
+
+void SallyJit::forgetAll() {
+   map<SiteKey, Site>::iterator it ;
+
+   for (it = sites.begin() ; it != sites.end() ; it++) {
+      if (it->second.m_loop != NULL) freeLoop(it->second.m_loop) ;
+   }
+   sites.clear() ;
+}
+
+
+void SallyJit::loopEntry(Sally *Sptr) {
+   map<SiteKey, Site>::iterator it ;
+
+   it = sites.find( SiteKey(Sptr->curCode(), Sptr->loops.back().m_start) ) ;
+   if (it != sites.end() && it->second.m_loop != NULL) {
+      run(Sptr, it->second.m_loop) ;
+   }
+}
+
+
+void SallyJit::backEdge(Sally *Sptr, size_t until) {
+   const vector<Token> *code = Sptr->curCode() ;
+   Site& s = sites[ SiteKey(code, Sptr->loops.back().m_start) ] ;
+
+   if (s.m_loop == NULL) {
+      if (s.m_failed || ++s.m_count < hot) return ;
+
+      s.m_loop = compile(Sptr, *code, Sptr->loops.back().m_start, until) ;
+      if (s.m_loop == NULL) {
+         s.m_failed = true ;
+         return ;
+      }
+      ncompiled++ ;
+   }
+   run(Sptr, s.m_loop) ;
+}
+
+
+// Check the body code[start..until-1] and work out the window
+// depth at each token. NULL if the loop can't be compiled.
+//
+JitLoop *SallyJit::compile(Sally *Sptr, const vector<Token>& code, size_t start, size_t until) {
+#if defined(__x86_64__)
+   size_t n = until - start ;
+   int depth = 0 ;       // relative to the top of the stack at the top of the loop
+   int need = 0 ;        // how far below that the body reaches
+
+   if (n > JIT_MAX_BODY) return NULL ;
+
+   JitLoop *loop = new JitLoop ;
+   loop->m_start = start ;
+   loop->m_until = until ;
+   loop->m_stores = false ;
+   loop->m_entries.push_back(0) ;
+
+   vector<int> rel ;
+
+   for (size_t k = 0 ; k <= n ; k++) {
+      const Token& tk = code[start + k] ;
+      int pops, pushes ;
+
+      rel.push_back(depth) ;
+
+      if (tk.m_kind == INTEGER) {
+         loop->m_op.push_back(-1) ;
+         pops = 0 ;
+         pushes = 1 ;
+
+      } else if (tk.m_kind == KEYWORD) {
+         int op = tk.m_value ;
+
+         switch (op) {
+         case OP_PLUS: case OP_MINUS: case OP_TIMES: case OP_DIVIDE: case OP_MOD: case OP_NEG:
+         case OP_DUP: case OP_DROP: case OP_SWAP: case OP_ROT:
+         case OP_EE: case OP_NE: case OP_LT: case OP_LTE: case OP_GT: case OP_GTE:
+         case OP_AND: case OP_OR: case OP_NOT:
+            break ;
+
+         case OP_DOT: case OP_SP: case OP_CR: case OP_DUMP:
+            loop->m_entries.push_back(k + 1) ;
+            break ;
+
+         case OP_UNTIL:
+            if (k == n) break ;
+            // fall through
+
+         default:
+            delete loop ;
+            return NULL ;
+         }
+         loop->m_op.push_back(op) ;
+         pops = opTable[op].m_pops ;
+         pushes = opTable[op].m_pushes ;
+
+      } else {
+         // only NAME @ and NAME ! on existing variables
+         //
+         SymTabEntry *entry = Sptr->symtab->find(tk) ;
+         const Token *next = k + 1 < n ? &code[start + k + 1] : NULL ;
+
+         if (entry == NULL || entry->m_kind != VARIABLE || next == NULL
+             || next->m_kind != KEYWORD
+             || (next->m_value != OP_AT && next->m_value != OP_EX)) {
+            delete loop ;
+            return NULL ;
+         }
+
+         size_t v = 0 ;
+         while (v < loop->m_vars.size() && loop->m_vars[v].m_text != tk.m_text) v++ ;
+         if (v == loop->m_vars.size()) loop->m_vars.push_back(tk) ;
+
+         loop->m_op.push_back(-1) ;
+         loop->m_op.push_back(next->m_value) ;
+         if (next->m_value == OP_AT) {
+            pops = 0 ;
+            pushes = 1 ;
+         } else {
+            pops = 1 ;
+            pushes = 0 ;
+            loop->m_stores = true ;
+         }
+         k++ ;
+         rel.push_back(depth) ;
+      }
+
+      if (pops - depth > need) need = pops - depth ;
+      depth += pushes - pops ;
+   }
+   rel.push_back(depth) ;
+
+   // each time round has to leave the stack as it found it
+   //
+   if (depth != 0) {
+      delete loop ;
+      return NULL ;
+   }
+
+   // m_depth has one entry per body token, the UNTIL and after it
+   //
+   loop->m_maxDepth = 0 ;
+   for (size_t k = 0 ; k < rel.size() ; k++) {
+      loop->m_depth.push_back(need + rel[k]) ;
+      if (loop->m_depth[k] > loop->m_maxDepth) loop->m_maxDepth = loop->m_depth[k] ;
+   }
+
+   if (!generate(loop, code)) {
+      delete loop ;
+      return NULL ;
+   }
+   return loop ;
+#else
+   return NULL ;
+#endif
+}
+
+
+// Move the top depth parameters into window[0..depth-1], if
+// they are all there and are integers.
+//
+bool SallyJit::loadWindow(Sally *Sptr, int depth) {
+   if ((int) Sptr->params.size() < depth) return false ;
+
+   held.clear() ;
+   for (int i = 0 ; i < depth ; i++) {
+      held.push_back(Sptr->params.top()) ;
+      Sptr->params.pop() ;
+   }
+
+   for (int i = 0 ; i < depth ; i++) {
+      if (held[i].m_kind != INTEGER) {
+         while (!held.empty()) {
+            Sptr->params.push(held.back()) ;
+            held.pop_back() ;
+         }
+         return false ;
+      }
+      window[depth - 1 - i] = held[i].m_value ;
+   }
+   return true ;
+}
+
+
+void SallyJit::storeWindow(Sally *Sptr, int depth) {
+   for (int i = 0 ; i < depth ; i++) {
+      Sptr->params.push( Token(INTEGER, window[i], "") ) ;
+   }
+}
+
+
+// Run a compiled loop from its top until it ends or stops
+// at a token only the interpreter can run.
+//
+void SallyJit::run(Sally *Sptr, JitLoop *loop) {
+
+   // the variables may have moved since the last run
+   //
+   if (loop->m_stores) Sptr->ownSymtab() ;
+   vars.resize(loop->m_vars.size() + 1) ;
+   for (size_t i = 0 ; i < loop->m_vars.size() ; i++) {
+      const Token& name = loop->m_vars[i] ;
+      SymTabEntry *entry = Sptr->symtab->find(name) ;
+      if (entry == NULL || entry->m_kind != VARIABLE) return ;
+      vars[i] = &entry->m_value ;
+   }
+
+   window.resize(loop->m_maxDepth + 1) ;
+
+   size_t k = 0 ;       // body token we are at
+   int entry = 0 ;      // its entry point
+
+   while (loadWindow(Sptr, loop->m_depth[k])) {
+      int r = loop->m_fn(&window[0], &vars[0], entry) ;
+
+      if (r < 0) {      // UNTIL ended the loop
+         storeWindow(Sptr, loop->m_depth.back()) ;
+         Sptr->curPc() = loop->m_until + 1 ;
+         Sptr->endLoop() ;
+         return ;
+      }
+
+      k = r ;
+      storeWindow(Sptr, loop->m_depth[k]) ;
+      Sptr->curPc() = loop->m_start + k ;
+
+      switch (loop->m_op[k]) {
+      case OP_DOT:  Sally::doDot(Sptr) ;  break ;
+      case OP_SP:   Sally::doSP(Sptr) ;   break ;
+      case OP_CR:   Sally::doCR(Sptr) ;   break ;
+      case OP_DUMP: Sally::doDUMP(Sptr) ; break ;
+      default:
+         return ;    // the interpreter runs token k and what follows
+      }
+
+      Sptr->curPc() = loop->m_start + ++k ;
+      entry = 0 ;
+      while (loop->m_entries[entry] != (int) k) entry++ ;
+   }
+}
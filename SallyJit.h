@@ -0,0 +1,112 @@
+// File: SallyJit.h
+//
+// CMSC 341 Spring 2017 Project 2
+//
+// Native code for hot DO ... UNTIL loops (x86-64 only).
+//
+// Each DO site counts how often its UNTIL jumps back. Once a
+// site is hot its body is compiled, if every word in it is one
+// of
+//
+//    integer literals, + - * / % NEG, DUP DROP SWAP ROT,
+//    == != < <= > >=, AND OR NOT, NAME @ and NAME !
+//
+// or one of the output words . SP CR DUMP, and the body leaves
+// the parameter stack as deep as it found it. Stack depths are
+// then known at every point of the body, so each stack slot the
+// body uses lives at a fixed place in a small window of cells.
+//
+// The native code hands control back to the interpreter
+//  - at the output words, which the interpreter runs before
+//    going back into native code,
+//  - before a / or % by 0 or -1, which the interpreter then
+//    runs itself, failing the same way it always did,
+//  - with SALLY_CHECKED, before a + - * or NEG that overflows,
+//    so the interpreter throws for it,
+//  - when the loop ends.
+// Loops are only entered natively when the window's part of
+// the parameter stack holds INTEGER tokens and every variable
+// named in the body exists.
+//
+// Up to four of the body's variables are kept in registers
+// while the native code runs: loaded each time it is entered,
+// and written back each time it hands control back if the body
+// stores them. So "limit @" in the loop test reads a register,
+// not the symbol table entry, and nothing outside the native
+// code can tell.
+//
+
+#ifndef _SALLYJIT_H_
+#define _SALLYJIT_H_
+
+#include <map>
+#include <utility>
+#include <vector>
+using namespace std ;
+
+#include "SallyOps.h"
+
+class Sally ;
+class Token ;
+struct JitLoop ;
+
+
+// back-edges before a DO site gets compiled
+//
+const int JIT_HOT = 16 ;
+
+
+class SallyJit {
+
+public:
+
+   SallyJit(int threshold=JIT_HOT) ;
+   ~SallyJit() ;
+
+   // DO has just pushed its loop: run it natively if it
+   // has been compiled.
+   //
+   void loopEntry(Sally *Sptr) ;
+
+   // UNTIL at position until has just jumped back to the top
+   // of its loop: count it, compile the loop when it gets hot
+   // and run the rest of it natively if possible.
+   //
+   void backEdge(Sally *Sptr, size_t until) ;
+
+   // code is about to change or go away, drop its loops
+   //
+   void forget(const vector<Token> *code) ;
+   void forgetAll() ;
+
+   size_t compiled() const { return ncompiled ; }   // loops compiled so far
+
+private:
+
+   struct Site {
+      int m_count ;         // back-edges seen
+      JitLoop *m_loop ;     // NULL until compiled
+      bool m_failed ;       // not compilable, stop trying
+   } ;
+
+   typedef pair<const vector<Token> *, size_t> SiteKey ;   // code, start of body
+
+   map<SiteKey, Site> sites ;
+   int hot ;
+   size_t ncompiled ;
+
+   vector<Token> held ;     // tokens moved between the stack and a window
+   vector<Cell> window ;
+   vector<Cell *> vars ;
+
+   JitLoop *compile(Sally *Sptr, const vector<Token>& code, size_t start, size_t until) ;
+   void run(Sally *Sptr, JitLoop *loop) ;
+   bool loadWindow(Sally *Sptr, int depth) ;
+   void storeWindow(Sally *Sptr, int depth) ;
+
+   SallyJit(const SallyJit&) ;             // no copies
+   SallyJit& operator=(const SallyJit&) ;
+
+} ;
+
+#endif
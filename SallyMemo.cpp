@@ -0,0 +1,199 @@
+// File: SallyMemo.cpp
+//
+// CMSC 341 Spring 2017 Project 2
+//
+// Remembering what pure DO ... UNTIL loops leave on the stack
+//
+
+#include <string>
+#include <vector>
+using namespace std ;
+
+#include "Sally.h"
+#include "SallyMemo.h"
+
+
+// longest loop body we look at
+//
+const size_t MEMO_MAX_BODY = 4096 ;
+
+
+static void putCell(string& out, Cell v) {
+   out.append((const char *) &v, sizeof v) ;
+}
+
+
+SallyMemo::SallyMemo(size_t max_entries) :
+   maxEntries(max_entries), nhits(0), nmisses(0), waiting(false)
+{
+}
+
+
+// Check the body code[start..] up to its UNTIL, which until is
+// set to, and work out how many cells below the top of the stack
+// it reads. Appends the body, with the value of each variable it
+// reads, to key. False if the loop is not pure or its UNTIL has
+// not been read yet.
+//
+bool SallyMemo::pure(Sally *Sptr, const vector<Token>& code, size_t start,
+                     size_t& until, int& need) {
+   int depth = 0 ;       // relative to the top of the stack at the top of the loop
+   need = 0 ;
+
+   for (size_t k = start ; k < code.size() && k - start <= MEMO_MAX_BODY ; k++) {
+      const Token& tk = code[k] ;
+      int pops, pushes ;
+
+      if (tk.m_kind == INTEGER) {
+         key += 'i' ;
+         putCell(key, tk.m_value) ;
+         pops = 0 ;
+         pushes = 1 ;
+
+      } else if (tk.m_kind == KEYWORD) {
+         int op = tk.m_value ;
+
+         switch (op) {
+         case OP_PLUS: case OP_MINUS: case OP_TIMES: case OP_DIVIDE: case OP_MOD: case OP_NEG:
+         case OP_DUP: case OP_DROP: case OP_SWAP: case OP_ROT:
+         case OP_EE: case OP_NE: case OP_LT: case OP_LTE: case OP_GT: case OP_GTE:
+         case OP_AND: case OP_OR: case OP_NOT:
+         case OP_UNTIL:
+            break ;
+
+         default:
+            return false ;
+         }
+         key += 'k' ;
+         putCell(key, op) ;
+         pops = opTable[op].m_pops ;
+         pushes = opTable[op].m_pushes ;
+
+      } else {
+         // only NAME @ on existing variables, which the body
+         // cannot change
+         //
+         SymTabEntry *entry = Sptr->symtab->find(tk) ;
+         const Token *next = k + 1 < code.size() ? &code[k + 1] : NULL ;
+
+         if (tk.m_kind != UNKNOWN || entry == NULL || entry->m_kind != VARIABLE
+             || next == NULL || next->m_kind != KEYWORD || next->m_value != OP_AT) {
+            return false ;
+         }
+
+         key += 'v' ;
+         putCell(key, tk.m_text.size()) ;
+         key.append(tk.m_text.data(), tk.m_text.size()) ;
+         putCell(key, entry->m_value) ;
+         pops = 0 ;
+         pushes = 1 ;
+         k++ ;
+      }
+
+      if (pops - depth > need) need = pops - depth ;
+      depth += pushes - pops ;
+
+      // each time round has to leave the stack as it found it
+      //
+      if (tk.m_kind == KEYWORD && tk.m_value == OP_UNTIL) {
+         until = k ;
+         return depth == 0 ;
+      }
+   }
+   return false ;
+}
+
+
+// Copy the top depth parameters into held, bottom first, if they
+// are all there and are integers. The stack is left as it was.
+//
+bool SallyMemo::readCells(Sally *Sptr, int depth) {
+   if ((int) Sptr->params.size() < depth) return false ;
+
+   held.clear() ;
+   for (int i = 0 ; i < depth ; i++) {
+      held.push_back(Sptr->params.top()) ;
+      Sptr->params.pop() ;
+   }
+
+   bool ok = true ;
+   for (int i = depth - 1 ; i >= 0 ; i--) {
+      ok = ok && held[i].m_kind == INTEGER ;
+      Sptr->params.push(held[i]) ;
+   }
+   return ok ;
+}
+
+
+bool SallyMemo::loopEntry(Sally *Sptr) {
+   const vector<Token> *code = Sptr->curCode() ;
+   size_t start = Sptr->loops.back().m_start ;
+   size_t until ;
+   int depth ;
+
+   // a loop we were waiting for that never ended ran into an error
+   //
+   waiting = false ;
+
+   key.clear() ;
+   if (!pure(Sptr, *code, start, until, depth) || !readCells(Sptr, depth)) return false ;
+
+   for (int i = depth - 1 ; i >= 0 ; i--) putCell(key, held[i].m_value) ;
+
+   auto it = index.find(key) ;
+   if (it == index.end()) {
+      nmisses++ ;
+      Sptr->stats.memoMisses.add(1) ;
+      waiting = true ;
+      waitCode = code ;
+      waitStart = start ;
+      waitLoop = Sptr->loops.size() - 1 ;
+      waitDepth = depth ;
+      waitKey = key ;
+      return false ;
+   }
+
+   nhits++ ;
+   Sptr->stats.memoHits.add(1) ;
+   lru.splice(lru.begin(), lru, it->second) ;
+   const Result& r = *it->second ;
+
+   for (int i = 0 ; i < depth ; i++) Sptr->params.pop() ;
+   for (size_t i = 0 ; i < r.m_cells.size() ; i++) {
+      Sptr->params.push( Token(INTEGER, r.m_cells[i], "") ) ;
+   }
+
+   // end the loop as its UNTIL would have, having run r.m_runs times
+   //
+   Sptr->loops.back().m_runs = r.m_runs ;
+   Sptr->curPc() = until + 1 ;
+   Sptr->dropLoops(Sptr->loops.size() - 1, Sptr->cloops.size()) ;
+   return true ;
+}
+
+
+void SallyMemo::loopExit(Sally *Sptr) {
+   if (!waiting) return ;
+   waiting = false ;
+
+   if (Sptr->loops.size() != waitLoop + 1 || Sptr->loops.back().m_start != waitStart
+       || Sptr->curCode() != waitCode || !readCells(Sptr, waitDepth)) {
+      return ;
+   }
+
+   // make room, then remember it as the most recently used
+   //
+   while (!lru.empty() && lru.size() >= maxEntries) {
+      index.erase(lru.back().m_key) ;
+      lru.pop_back() ;
+   }
+   if (maxEntries == 0) return ;
+
+   Result r ;
+   r.m_key = waitKey ;
+   r.m_runs = Sptr->loops.back().m_runs ;
+   for (int i = waitDepth - 1 ; i >= 0 ; i--) r.m_cells.push_back(held[i].m_value) ;
+
+   lru.push_front(r) ;
+   index[waitKey] = lru.begin() ;
+}
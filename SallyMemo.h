@@ -0,0 +1,106 @@
+// File: SallyMemo.h
+//
+// CMSC 341 Spring 2017 Project 2
+//
+// Remembered results of pure DO ... UNTIL loops.
+//
+// A loop is pure if every word in its body is one of
+//
+//    integer literals, + - * / % NEG, DUP DROP SWAP ROT,
+//    == != < <= > >=, AND OR NOT and NAME @
+//
+// and the body leaves the parameter stack as deep as it found
+// it, the same bodies SallyJit compiles less the output words
+// and NAME !. Such a loop only reads a fixed number of cells off
+// the top of the stack and the variables it names, only changes
+// those cells, and prints nothing. So given the same body, cells
+// and variable values it always leaves the same cells behind.
+//
+// When DO starts a pure loop that has been run to its end before
+// from the same cells and variables (anywhere in the program,
+// since the body's text is part of the key), the cells it left
+// are put on the stack and the program carries on after the
+// UNTIL. Otherwise the loop runs as usual, and what it left is
+// remembered when its UNTIL ends it. A run that stops with an
+// error is not remembered.
+//
+// At most max_entries results are kept, the least recently used
+// going first. DUMP reports the hits and misses so far.
+//
+
+#ifndef _SALLYMEMO_H_
+#define _SALLYMEMO_H_
+
+#include <cstdint>
+#include <list>
+#include <string>
+#include <unordered_map>
+#include <vector>
+using namespace std ;
+
+#include "SallyOps.h"
+
+class Sally ;
+class Token ;
+
+
+const size_t MEMO_ENTRIES = 4096 ;
+
+
+class SallyMemo {
+
+public:
+
+   SallyMemo(size_t max_entries=MEMO_ENTRIES) ;
+
+   // DO has just pushed its loop. If the loop is pure and its
+   // result is known, leave it on the stack, end the loop after
+   // its UNTIL and return true.
+   //
+   bool loopEntry(Sally *Sptr) ;
+
+   // The innermost DO loop has ended at its UNTIL: remember what
+   // it left if loopEntry() missed it.
+   //
+   void loopExit(Sally *Sptr) ;
+
+   size_t size() const { return lru.size() ; }   // results kept
+   uint64_t hits() const { return nhits ; }
+   uint64_t misses() const { return nmisses ; }
+
+private:
+
+   struct Result {
+      string m_key ;          // body, cells and variable values
+      vector<Cell> m_cells ;  // what the loop left, bottom first
+      uint64_t m_runs ;       // times the body ran
+   } ;
+
+   list<Result> lru ;         // most recently used first
+   unordered_map<string, list<Result>::iterator> index ;
+   size_t maxEntries ;
+   uint64_t nhits ;
+   uint64_t nmisses ;
+
+   // the loop loopEntry() missed, until it ends
+   //
+   bool waiting ;
+   const vector<Token> *waitCode ;
+   size_t waitStart ;
+   size_t waitLoop ;          // its place in Sally::loops
+   int waitDepth ;            // cells it reads and leaves
+   string waitKey ;
+
+   vector<Token> held ;       // cells off the stack
+   string key ;
+
+   bool pure(Sally *Sptr, const vector<Token>& code, size_t start,
+             size_t& until, int& depth) ;
+   bool readCells(Sally *Sptr, int depth) ;
+
+   SallyMemo(const SallyMemo&) ;             // no copies
+   SallyMemo& operator=(const SallyMemo&) ;
+
+} ;
+
+#endif
@@ -0,0 +1,88 @@
+// File: SallyMetrics.cpp
+//
+// CMSC 341 Spring 2017 Project 2
+//
+// JSON output for SallyMetrics
+//
+
+#include "SallyMetrics.h"
+
+
+atomic<uint64_t> SallyMetrics::processInstructions(0) ;
+
+
+SallyMetrics::SallyMetrics() {
+   for (size_t i = 0 ; i < METRIC_LOOP_SITES ; i++) loopSites[i].m_line = 0 ;
+   overflowSite.m_line = -1 ;
+}
+
+
+// buckets up to the last one in use, as a JSON array
+//
+static void writeHistogram(ostream& out, const MetricHistogram& h) {
+   int used = 0 ;
+   for (int b = 0 ; b < METRIC_BUCKETS ; b++) {
+      if (h.bucket(b) != 0) used = b + 1 ;
+   }
+
+   out << "[" ;
+   for (int b = 0 ; b < used ; b++) {
+      out << (b > 0 ? ", " : "") << h.bucket(b) ;
+   }
+   out << "]" ;
+}
+
+
+void SallyMetrics::writeJson(ostream& out) const {
+   struct { const char *m_name ; const MetricCounter *m_counter ; } counters[] = {
+      { "runs", &runs },
+      { "errors", &errors },
+      { "tokens_lexed", &tokensLexed },
+      { "compile_cache_hits", &cacheHits },
+      { "compile_cache_misses", &cacheMisses },
+      { "instructions", &instructions },
+      { "word_calls", &wordCalls },
+      { "loop_memo_hits", &memoHits },
+      { "loop_memo_misses", &memoMisses },
+      { "peak_stack_depth", &peakDepth },
+      { "symtab_size", &symtabSize },
+      { "bytes_out", &bytesOut },
+      { "lex_ns", &lexNs },
+      { "exec_ns", &execNs },
+      { "allocations", &allocations }
+   } ;
+
+   out << "{\n" ;
+   for (size_t i = 0 ; i < sizeof counters / sizeof counters[0] ; i++) {
+      out << "  \"" << counters[i].m_name << "\": " << counters[i].m_counter->get() << ",\n" ;
+   }
+
+   // loop sites in line order
+   //
+   out << "  \"loop_iterations\": {" ;
+   const char *sep = "" ;
+   int last = 0 ;
+   while (true) {
+      const MetricLoopSite *next = NULL ;
+      for (size_t i = 0 ; i < METRIC_LOOP_SITES ; i++) {
+         int line = loopSites[i].m_line.load(memory_order_relaxed) ;
+         if (line > last && (next == NULL || line < next->m_line.load(memory_order_relaxed))) {
+            next = &loopSites[i] ;
+         }
+      }
+      if (next == NULL) break ;
+      last = next->m_line.load(memory_order_relaxed) ;
+      out << sep << "\"" << last << "\": " << next->m_iterations.get() ;
+      sep = ", " ;
+   }
+   if (overflowSite.m_iterations.get() != 0) {
+      out << sep << "\"other\": " << overflowSite.m_iterations.get() ;
+   }
+   out << "},\n" ;
+
+   out << "  \"run_ns_log2_histogram\": " ;
+   writeHistogram(out, runNs) ;
+   out << ",\n  \"lex_batch_ns_log2_histogram\": " ;
+   writeHistogram(out, lexBatchNs) ;
+   out << "\n}\n" ;
+}
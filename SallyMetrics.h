@@ -0,0 +1,156 @@
+// File: SallyMetrics.h
+//
+// CMSC 341 Spring 2017 Project 2
+//
+// Counters and histograms kept by every Sally interpreter,
+// read with Sally::metrics() or written as JSON by
+// SallyMetrics::writeJson().
+//
+// Only the thread running the interpreter writes them, so each
+// update is a relaxed load and store rather than a locked
+// read-modify-write, and any other thread (a server reporting on
+// its workers, say) can read them at any time without a lock.
+// A value read while the interpreter runs may be a few updates
+// behind.
+//
+// "allocations" counts the heap allocations made by the
+// interpreter's own structures: growing the token buffer, the
+// parameter and return stacks, word bodies, arrays and copies
+// of shared arrays and symbol tables. Iterations of loops the
+// JIT runs as native code are not counted.
+//
+
+#ifndef _SALLYMETRICS_H_
+#define _SALLYMETRICS_H_
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <iostream>
+using namespace std ;
+
+
+// a value written by one thread and read by any
+//
+class MetricCounter {
+
+public:
+
+   MetricCounter() : m_value(0) {}
+
+   void add(uint64_t n) {
+      m_value.store(m_value.load(memory_order_relaxed) + n, memory_order_relaxed) ;
+   }
+
+   void set(uint64_t n) { m_value.store(n, memory_order_relaxed) ; }
+
+   void atLeast(uint64_t n) {
+      if (n > m_value.load(memory_order_relaxed)) set(n) ;
+   }
+
+   uint64_t get() const { return m_value.load(memory_order_relaxed) ; }
+
+private:
+
+   atomic<uint64_t> m_value ;
+
+} ;
+
+
+// counts of values in power of 2 buckets: bucket b holds
+// values v with 2^(b-1) <= v < 2^b, bucket 0 holds 0
+//
+const int METRIC_BUCKETS = 40 ;
+
+class MetricHistogram {
+
+public:
+
+   void add(uint64_t v) {
+      int b = v == 0 ? 0 : 64 - __builtin_clzll(v) ;
+      m_buckets[b < METRIC_BUCKETS ? b : METRIC_BUCKETS - 1].add(1) ;
+   }
+
+   uint64_t bucket(int b) const { return m_buckets[b].get() ; }
+
+private:
+
+   MetricCounter m_buckets[METRIC_BUCKETS] ;
+
+} ;
+
+
+// how often the body of one loop ran. Loops are told apart by
+// the line of their FOR or DO, and add their count when they end.
+//
+const size_t METRIC_LOOP_SITES = 64 ;     // a power of 2
+
+struct MetricLoopSite {
+   atomic<int> m_line ;          // 0 while the slot is free
+   MetricCounter m_iterations ;
+} ;
+
+
+const uint64_t METRIC_BATCH = 256 ;     // a power of 2
+
+
+struct SallyMetrics {
+
+   SallyMetrics() ;
+
+   MetricCounter runs ;            // calls of mainLoop()
+   MetricCounter errors ;          // runs that stopped on an error
+   MetricCounter tokensLexed ;
+   MetricCounter cacheHits ;       // paragraphs the compile cache had
+   MetricCounter cacheMisses ;     // and the ones it lexed
+   MetricCounter instructions ;    // tokens run, updated every
+                                   // METRIC_BATCH and at the end of a run
+   MetricCounter wordCalls ;
+   MetricCounter memoHits ;        // pure loops the loop memo skipped
+   MetricCounter memoMisses ;      // and the ones it had to run
+   MetricCounter peakDepth ;       // most parameters ever on the stack
+   MetricCounter symtabSize ;      // as of the end of the last run
+   MetricCounter bytesOut ;        // written by . SP CR
+   MetricCounter lexNs ;           // time reading and lexing input
+   MetricCounter execNs ;          // time in mainLoop() otherwise
+   MetricCounter allocations ;
+
+   MetricHistogram runNs ;         // how long each run took
+   MetricHistogram lexBatchNs ;    // how long each fillBuffer() took
+
+   // tokens run by every interpreter in the process, added
+   // to at the end of each run by whichever thread ran it
+   //
+   static atomic<uint64_t> processInstructions ;
+
+   // the body of the loop on line ran n more times. Loops after
+   // the first METRIC_LOOP_SITES sites, and loops with no line,
+   // share overflowSite.
+   //
+   void loopIterations(int line, uint64_t n) {
+      size_t slot = (size_t) line & (METRIC_LOOP_SITES - 1) ;
+      for (size_t probes = 0 ; line > 0 && probes < METRIC_LOOP_SITES ; probes++) {
+         int at = loopSites[slot].m_line.load(memory_order_relaxed) ;
+         if (at == 0) {
+            loopSites[slot].m_line.store(line, memory_order_relaxed) ;
+            at = line ;
+         }
+         if (at == line) {
+            loopSites[slot].m_iterations.add(n) ;
+            return ;
+         }
+         slot = (slot + 1) & (METRIC_LOOP_SITES - 1) ;
+      }
+      overflowSite.m_iterations.add(n) ;
+   }
+
+   MetricLoopSite loopSites[METRIC_LOOP_SITES] ;
+   MetricLoopSite overflowSite ;
+
+   // everything above as one JSON object
+   //
+   void writeJson(ostream& out) const ;
+
+} ;
+
+#endif
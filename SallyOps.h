@@ -0,0 +1,336 @@
+// File: SallyOps.h
+//
+// CMSC 341 Spring 2017 Project 2
+//
+// The builtin words of Sally Forth, as one compile time table.
+//
+// Everything that needs to know about builtins works from opTable:
+// the lexer turns their names into KEYWORD tokens carrying the
+// opcode, mainLoop() dispatches on the opcode and checks the
+// parameter stack depth against m_pops before calling a handler.
+//
+
+#ifndef _SALLYOPS_H_
+#define _SALLYOPS_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <limits>
+#include <stdexcept>
+
+
+// hash of a symbol name (FNV-1a). Each token computes it once
+// and keeps it in m_hash for symbol table lookups.
+//
+constexpr uint32_t symHash(const char *s, size_t len) {
+   uint32_t h = 2166136261u ;
+   for (size_t i = 0 ; i < len ; i++) {
+      h = (h ^ (unsigned char) s[i]) * 16777619u ;
+   }
+   return h ;
+}
+
+
+enum Opcode {
+   OP_DUMP,
+
+   OP_PLUS, OP_MINUS, OP_TIMES, OP_DIVIDE, OP_MOD, OP_NEG,
+
+   OP_DOT, OP_SP, OP_CR,
+
+   OP_DUP, OP_DROP, OP_SWAP, OP_ROT,
+
+   OP_EE, OP_NE, OP_LT, OP_LTE, OP_GT, OP_GTE,
+
+   OP_SET, OP_AT, OP_EX,
+
+   OP_ARRAY, OP_AAT, OP_AEX, OP_ALEN,
+   OP_ASUM, OP_AMIN, OP_AMAX, OP_AFILL, OP_ACOPY, OP_APLUS, OP_ATIMES,
+
+   OP_AND, OP_OR, OP_NOT,
+
+   OP_IFTHEN, OP_ELSE, OP_ENDIF,
+
+   OP_DO, OP_UNTIL,
+
+   OP_FOR, OP_LOOP, OP_PLUSLOOP, OP_I, OP_J,
+
+   OP_COLON, OP_SEMI,
+
+   NUM_OPS
+} ;
+
+
+// stack effect: the word needs m_pops parameters on the
+// stack and leaves m_pushes in their place.
+// m_flow is set for words that change where the program
+// continues, or that depend on it.
+//
+struct OpInfo {
+   const char *m_name ;
+   Opcode m_op ;
+   int m_pops ;
+   int m_pushes ;
+   bool m_flow ;
+} ;
+
+
+constexpr OpInfo opTable[] = {
+   { "DUMP",    OP_DUMP,    0, 0, false },
+
+   { "+",       OP_PLUS,    2, 1, false },
+   { "-",       OP_MINUS,   2, 1, false },
+   { "*",       OP_TIMES,   2, 1, false },
+   { "/",       OP_DIVIDE,  2, 1, false },
+   { "%",       OP_MOD,     2, 1, false },
+   { "NEG",     OP_NEG,     1, 1, false },
+
+   { ".",       OP_DOT,     1, 0, false },
+   { "SP",      OP_SP,      0, 0, false },
+   { "CR",      OP_CR,      0, 0, false },
+
+   { "DUP",     OP_DUP,     1, 2, false },
+   { "DROP",    OP_DROP,    1, 0, false },
+   { "SWAP",    OP_SWAP,    2, 2, false },
+   { "ROT",     OP_ROT,     3, 3, false },
+
+   { "==",      OP_EE,      2, 1, false },
+   { "!=",      OP_NE,      2, 1, false },
+   { "<",       OP_LT,      2, 1, false },
+   { "<=",      OP_LTE,     2, 1, false },
+   { ">",       OP_GT,      2, 1, false },
+   { ">=",      OP_GTE,     2, 1, false },
+
+   { "SET",     OP_SET,     2, 0, false },
+   { "@",       OP_AT,      1, 1, false },
+   { "!",       OP_EX,      2, 0, false },
+
+   { "ARRAY",   OP_ARRAY,   2, 0, false },
+   { "A@",      OP_AAT,     2, 1, false },
+   { "A!",      OP_AEX,     3, 0, false },
+   { "ALEN",    OP_ALEN,    1, 1, false },
+   { "ASUM",    OP_ASUM,    1, 1, false },
+   { "AMIN",    OP_AMIN,    1, 1, false },
+   { "AMAX",    OP_AMAX,    1, 1, false },
+   { "AFILL",   OP_AFILL,   2, 0, false },
+   { "ACOPY",   OP_ACOPY,   2, 0, false },
+   { "A+",      OP_APLUS,   3, 0, false },
+   { "A*",      OP_ATIMES,  3, 0, false },
+
+   { "AND",     OP_AND,     2, 1, false },
+   { "OR",      OP_OR,      2, 1, false },
+   { "NOT",     OP_NOT,     1, 1, false },
+
+   { "IFTHEN",  OP_IFTHEN,  1, 0, true  },
+   { "ELSE",    OP_ELSE,    0, 0, true  },
+   { "ENDIF",   OP_ENDIF,   0, 0, true  },
+
+   { "DO",      OP_DO,      0, 0, true  },
+   { "UNTIL",   OP_UNTIL,   1, 0, true  },
+
+   { "FOR",     OP_FOR,     2, 0, true  },
+   { "LOOP",    OP_LOOP,    0, 0, true  },
+   { "+LOOP",   OP_PLUSLOOP,1, 0, true  },
+   { "I",       OP_I,       0, 1, false },
+   { "J",       OP_J,       0, 1, false },
+
+   { ":",       OP_COLON,   0, 0, true  },
+   { ";",       OP_SEMI,    0, 0, true  },
+} ;
+
+
+constexpr bool opTableInOrder() {
+   for (int i = 0 ; i < NUM_OPS ; i++) {
+      if (opTable[i].m_op != i) return false ;
+   }
+   return sizeof(opTable) / sizeof(OpInfo) == NUM_OPS ;
+}
+
+static_assert(opTableInOrder(), "opTable must list every Opcode in enum order") ;
+
+
+// -------------------------------------------------------
+//
+// Cells: the numbers Sally Forth computes with.
+//
+// SALLY_CELL_BITS (32 or 64) sets their width at build time.
+// With SALLY_CHECKED set, + - * / % and NEG throw instead of
+// overflowing or dividing by zero (using the compiler's overflow
+// builtins); without it each is the single instruction C++ makes
+// of it.
+//
+
+#ifndef SALLY_CELL_BITS
+#define SALLY_CELL_BITS 32
+#endif
+
+#ifndef SALLY_CHECKED
+#define SALLY_CHECKED 0
+#endif
+
+
+template <int BITS> struct CellOfWidth ;
+template <> struct CellOfWidth<32> { typedef int32_t type ; } ;
+template <> struct CellOfWidth<64> { typedef int64_t type ; } ;
+
+typedef CellOfWidth<SALLY_CELL_BITS>::type Cell ;
+
+
+template <typename T, bool CHECKED> struct CellArith ;
+
+template <typename T> struct CellArith<T, false> {
+   static constexpr T add(T a, T b) { return a + b ; }
+   static constexpr T sub(T a, T b) { return a - b ; }
+   static constexpr T mul(T a, T b) { return a * b ; }
+   static constexpr T div(T a, T b) { return a / b ; }
+   static constexpr T mod(T a, T b) { return a % b ; }
+   static constexpr T neg(T a) { return -a ; }
+} ;
+
+template <typename T> struct CellArith<T, true> {
+   static constexpr T add(T a, T b) {
+      T r = 0 ;
+      if (__builtin_add_overflow(a, b, &r)) throw std::overflow_error("Integer overflow??") ;
+      return r ;
+   }
+   static constexpr T sub(T a, T b) {
+      T r = 0 ;
+      if (__builtin_sub_overflow(a, b, &r)) throw std::overflow_error("Integer overflow??") ;
+      return r ;
+   }
+   static constexpr T mul(T a, T b) {
+      T r = 0 ;
+      if (__builtin_mul_overflow(a, b, &r)) throw std::overflow_error("Integer overflow??") ;
+      return r ;
+   }
+   static constexpr T div(T a, T b) {
+      if (b == 0) throw std::runtime_error("Division by zero??") ;
+      if (b == -1) return neg(a) ;
+      return a / b ;
+   }
+   static constexpr T mod(T a, T b) {
+      if (b == 0) throw std::runtime_error("Division by zero??") ;
+      if (b == -1) return 0 ;
+      return a % b ;
+   }
+   static constexpr T neg(T a) {
+      if (a == std::numeric_limits<T>::min()) throw std::overflow_error("Integer overflow??") ;
+      return -a ;
+   }
+} ;
+
+typedef CellArith<Cell, SALLY_CHECKED != 0> Arith ;
+
+
+// What the arithmetic, comparison and logic words compute.
+// a is the parameter below the top of the stack, b the top.
+// Shared by the interpreter and C++ generated from Sally programs,
+// and usable in constant expressions.
+//
+constexpr Cell applyBinary(int op, Cell a, Cell b) {
+   switch (op) {
+   case OP_PLUS:    return Arith::add(a, b) ;
+   case OP_MINUS:   return Arith::sub(a, b) ;
+   case OP_TIMES:   return Arith::mul(a, b) ;
+   case OP_DIVIDE:  return Arith::div(a, b) ;
+   case OP_MOD:     return Arith::mod(a, b) ;
+   case OP_EE:      return a == b ;
+   case OP_NE:      return a != b ;
+   case OP_LT:      return a < b ;
+   case OP_LTE:     return a <= b ;
+   case OP_GT:      return a > b ;
+   case OP_GTE:     return a >= b ;
+   case OP_AND:     return (a == 1 && b == 1) ? 1 : 0 ;   // true only if both are 1
+   case OP_OR:      return (a == 0 && b == 0) ? 0 : 1 ;   // false only if both are 0
+   default:         return 0 ;
+   }
+}
+
+constexpr Cell applyUnary(int op, Cell a) {
+   switch (op) {
+   case OP_NEG:     return Arith::neg(a) ;
+   case OP_NOT:     return a == 0 ? 1 : 0 ;
+   default:         return 0 ;
+   }
+}
+
+
+// -------------------------------------------------------
+//
+// Perfect hash from a name's symHash() to its opcode.
+// The multiplier is searched for by the compiler so that no two
+// builtin names land in the same slot.
+//
+
+// smallest table with at least 4 slots per builtin
+//
+constexpr int opHashBits(int n) {
+   int bits = 1 ;
+   while ((1 << bits) < 4 * n) bits++ ;
+   return bits ;
+}
+
+const int OPHASH_BITS = opHashBits(NUM_OPS) ;
+
+
+struct OpHash {
+   uint32_t mult ;                  // slot = (hash * mult) >> (32 - OPHASH_BITS)
+   short slot[1 << OPHASH_BITS] ;   // opcode or -1
+   uint32_t hash[NUM_OPS] ;         // symHash() of each name
+   unsigned char len[NUM_OPS] ;     // length of each name
+} ;
+
+
+constexpr size_t constLength(const char *s) {
+   size_t n = 0 ;
+   while (s[n] != '\0') n++ ;
+   return n ;
+}
+
+
+// try odd multipliers until every builtin gets its own slot
+//
+constexpr OpHash makeOpHash() {
+   OpHash ph {} ;
+
+   for (uint32_t mult = 0x9E3779B1u ; ; mult += 2) {
+      bool ok = true ;
+
+      ph.mult = mult ;
+      for (int i = 0 ; i < (1 << OPHASH_BITS) ; i++) ph.slot[i] = -1 ;
+
+      for (int op = 0 ; op < NUM_OPS && ok ; op++) {
+         size_t len = constLength(opTable[op].m_name) ;
+         uint32_t h = symHash(opTable[op].m_name, len) ;
+         uint32_t i = (h * mult) >> (32 - OPHASH_BITS) ;
+
+         ph.hash[op] = h ;
+         ph.len[op] = len ;
+         if (ph.slot[i] >= 0) {
+            ok = false ;
+         } else {
+            ph.slot[i] = op ;
+         }
+      }
+      if (ok) return ph ;
+   }
+}
+
+constexpr OpHash opHash = makeOpHash() ;
+
+
+// opcode of the builtin named s[0..len-1], or -1.
+// hash must be symHash(s, len).
+//
+inline int findOp(const char *s, size_t len, uint32_t hash) {
+   int op = opHash.slot[(hash * opHash.mult) >> (32 - OPHASH_BITS)] ;
+
+   if (op >= 0 && opHash.hash[op] == hash && opHash.len[op] == len
+       && memcmp(s, opTable[op].m_name, len) == 0) {
+      return op ;
+   }
+   return -1 ;
+}
+
+#endif
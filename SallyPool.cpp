@@ -0,0 +1,77 @@
+// File: SallyPool.cpp
+//
+// CMSC 341 Spring 2017 Project 2
+//
+// Implementation of the Sally Forth interpreter pool
+//
+
+#include <iostream>
+#include <sstream>
+using namespace std ;
+
+#include "SallyPool.h"
+
+
+// detached contexts read from here until acquired
+//
+static istringstream noInput ;
+
+
+SallyPool::SallyPool(size_t max_idle, size_t prealloc) : maxIdle(max_idle) {
+   pool.reserve(maxIdle) ;
+   for (size_t i = 0 ; i < prealloc && i < maxIdle ; i++) {
+      pool.push_back( new Sally(noInput) ) ;
+   }
+}
+
+
+SallyPool::~SallyPool() {
+   for (size_t i = 0 ; i < pool.size() ; i++) {
+      delete pool[i] ;
+   }
+}
+
+
+Sally *SallyPool::acquire(istream& input_stream, ostream& output_stream,
+                          ostream& error_stream) {
+   Sally *Sptr ;
+
+   if (pool.empty()) {
+      return new Sally(input_stream, output_stream, error_stream) ;
+   }
+
+   Sptr = pool.back() ;
+   pool.pop_back() ;
+   Sptr->reset(input_stream, output_stream, error_stream) ;
+   return Sptr ;
+}
+
+
+Sally *SallyPool::acquire(SallyInput& input_source, ostream& output_stream,
+                          ostream& error_stream) {
+   Sally *Sptr ;
+
+   if (pool.empty()) {
+      return new Sally(input_source, output_stream, error_stream) ;
+   }
+
+   Sptr = pool.back() ;
+   pool.pop_back() ;
+   Sptr->reset(input_source, output_stream, error_stream) ;
+   return Sptr ;
+}
+
+
+void SallyPool::release(Sally *Sptr) {
+   if (Sptr == NULL) return ;
+
+   if (pool.size() >= maxIdle) {
+      delete Sptr ;
+      return ;
+   }
+
+   // drop references to the caller's streams right away
+   //
+   Sptr->reset(noInput) ;
+   pool.push_back(Sptr) ;
+}
@@ -0,0 +1,55 @@
+// File: SallyPool.h
+//
+// CMSC 341 Spring 2017 Project 2
+//
+// A pool of ready-to-run Sally Forth interpreters.
+// Contexts are reset() on the way out instead of being
+// destroyed, so a request only pays for its own live state.
+// Not thread safe: use one pool per thread or process.
+//
+
+#ifndef _SALLYPOOL_H_
+#define _SALLYPOOL_H_
+
+#include <iostream>
+#include <vector>
+using namespace std ;
+
+#include "Sally.h"
+
+
+class SallyPool {
+
+public:
+
+   // keep up to max_idle contexts around, creating
+   // prealloc of them up front
+   //
+   SallyPool(size_t max_idle=8, size_t prealloc=1) ;
+   ~SallyPool() ;
+
+   // get an interpreter attached to the given streams
+   //
+   Sally *acquire(istream& input_stream, ostream& output_stream=cout,
+                  ostream& error_stream=cerr) ;
+   Sally *acquire(SallyInput& input_source, ostream& output_stream=cout,
+                  ostream& error_stream=cerr) ;
+
+   // hand an interpreter back. It is reset before being
+   // kept, or deleted if the pool is full.
+   //
+   void release(Sally *Sptr) ;
+
+   size_t idle() const { return pool.size() ; }
+
+private:
+
+   vector<Sally *> pool ;
+   size_t maxIdle ;
+
+   SallyPool(const SallyPool&) ;             // no copies
+   SallyPool& operator=(const SallyPool&) ;
+
+} ;
+
+#endif
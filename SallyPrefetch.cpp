@@ -0,0 +1,149 @@
+// File: SallyPrefetch.cpp
+//
+// CMSC 341 Spring 2017 Project 2
+//
+// Reader thread and token ring for prefetched input
+//
+
+#include <chrono>
+#include <string>
+using namespace std ;
+
+#include "SallyPrefetch.h"
+
+
+static_assert((PREFETCH_BATCHES & (PREFETCH_BATCHES - 1)) == 0,
+              "PREFETCH_BATCHES must be a power of 2") ;
+
+
+// wait a little for the other side of the ring: briefly by
+// yielding, then in short sleeps for input that is slow to come
+//
+static void backOff(int& waits) {
+   if (++waits < 64) {
+      this_thread::yield() ;
+   } else {
+      this_thread::sleep_for(chrono::microseconds(20)) ;
+   }
+}
+
+
+SallyPrefetch::SallyPrefetch() :
+   head(0), tail(0), stopping(false), source(NULL), ended(false), lines(0)
+{
+   pending.m_end = false ;
+}
+
+
+SallyPrefetch::~SallyPrefetch() {
+   int lineNo = 0 ;
+   vector<Token> dropped ;
+
+   stop(lineNo, dropped) ;
+}
+
+
+bool SallyPrefetch::fill(SallyInput& input_source, int lineNo, vector<Token>& tokens) {
+   if (ended) return false ;
+
+   if (source == NULL) {
+      source = &input_source ;
+      lines = lineNo ;
+      stopping.store(false, memory_order_relaxed) ;
+      reader = thread(&SallyPrefetch::readLoop, this) ;
+   }
+
+   size_t h = head.load(memory_order_relaxed) ;
+   int waits = 0 ;
+
+   while (tail.load(memory_order_acquire) == h) {
+      backOff(waits) ;
+   }
+
+   Batch& b = ring[h % PREFETCH_BATCHES] ;
+   tokens.insert(tokens.end(), b.m_tokens.begin(), b.m_tokens.end()) ;
+   b.m_tokens.clear() ;
+   ended = b.m_end ;
+
+   head.store(h + 1, memory_order_release) ;
+   return !ended ;
+}
+
+
+void SallyPrefetch::stop(int& lineNo, vector<Token>& tokens) {
+   if (source == NULL) return ;
+
+   stopping.store(true, memory_order_relaxed) ;
+   source->interrupt() ;
+   reader.join() ;
+   source->resume() ;
+
+   // the reader is gone, so everything can be read directly
+   //
+   size_t h = head.load(memory_order_relaxed) ;
+   size_t t = tail.load(memory_order_relaxed) ;
+
+   for ( ; h != t ; h++) {
+      Batch& b = ring[h % PREFETCH_BATCHES] ;
+      tokens.insert(tokens.end(), b.m_tokens.begin(), b.m_tokens.end()) ;
+      b.m_tokens.clear() ;
+   }
+   tokens.insert(tokens.end(), pending.m_tokens.begin(), pending.m_tokens.end()) ;
+   pending.m_tokens.clear() ;
+   pending.m_end = false ;
+
+   head.store(0, memory_order_relaxed) ;
+   tail.store(0, memory_order_relaxed) ;
+   lineNo = lines ;
+   source = NULL ;
+   ended = false ;
+}
+
+
+// Move pending into the ring, waiting for room.
+//
+bool SallyPrefetch::handOver() {
+   size_t t = tail.load(memory_order_relaxed) ;
+   int waits = 0 ;
+
+   while (t - head.load(memory_order_acquire) == PREFETCH_BATCHES) {
+      if (stopping.load(memory_order_relaxed)) return false ;
+      backOff(waits) ;
+   }
+
+   Batch& b = ring[t % PREFETCH_BATCHES] ;
+   b.m_tokens.swap(pending.m_tokens) ;
+   b.m_end = pending.m_end ;
+   pending.m_tokens.clear() ;
+
+   tail.store(t + 1, memory_order_release) ;
+   return true ;
+}
+
+
+// Read and lex lines the way Sally::fillBuffer() does until the
+// input ends or stop() is called.
+//
+void SallyPrefetch::readLoop() {
+   const char *line ;
+   size_t len ;
+
+   while (!stopping.load(memory_order_relaxed)) {
+      if (!source->line(line, len)) {
+         if (source->interrupted()) return ;     // by stop()
+         pending.m_end = true ;
+         handOver() ;
+         return ;
+      }
+      lines++ ;
+      Sally::lexLine(line, len, lines, pending.m_tokens) ;
+
+      // hand over full batches, or anything at all if the
+      // interpreter has run out
+      //
+      bool idle = tail.load(memory_order_relaxed) == head.load(memory_order_acquire) ;
+      if (pending.m_tokens.size() >= PREFETCH_TOKENS || (idle && !pending.m_tokens.empty())) {
+         if (!handOver()) return ;
+      }
+   }
+}
@@ -0,0 +1,96 @@
+// File: SallyPrefetch.h
+//
+// CMSC 341 Spring 2017 Project 2
+//
+// Reading and lexing a Sally Forth program on a separate thread,
+// so a program fed through a slow pipe or a large file does not
+// wait for its input every time it runs out of tokens.
+//
+// The reader thread runs Sally::lexLine() on each line and hands
+// the tokens over in batches through a fixed size single producer,
+// single consumer ring. Neither side takes a lock: each owns one
+// of the two positions in the ring and only reads the other. When
+// the ring is full the reader waits, so it is never more than
+// PREFETCH_BATCHES batches ahead.
+//
+// The reader only runs while mainLoop() does. When mainLoop()
+// returns it stops the reader and takes the tokens it had read
+// ahead into tkBuffer. A reader waiting on a pipe for more input
+// is interrupted (see SallyInput::interrupt()), leaving any line
+// it had started for whoever reads the input next. Other inputs
+// cannot be interrupted, so stop() waits for the line they are
+// reading. The input is not touched after that.
+//
+
+#ifndef _SALLYPREFETCH_H_
+#define _SALLYPREFETCH_H_
+
+#include <atomic>
+#include <iostream>
+#include <thread>
+#include <vector>
+using namespace std ;
+
+#include "Sally.h"
+
+
+// batches the reader may be ahead by, a power of 2
+//
+const size_t PREFETCH_BATCHES = 64 ;
+
+// the reader hands over a batch once it has this many tokens,
+// or sooner if the interpreter has nothing to do
+//
+const size_t PREFETCH_TOKENS = 1024 ;
+
+
+class SallyPrefetch {
+
+public:
+
+   SallyPrefetch() ;
+   ~SallyPrefetch() ;
+
+   // Append the next batch of tokens to tokens, starting the
+   // reader on input_source if it is not running. lineNo is the
+   // number of lines read from input_source so far. Returns false
+   // at the end of the input, like Sally::fillBuffer().
+   //
+   bool fill(SallyInput& input_source, int lineNo, vector<Token>& tokens) ;
+
+   // Stop the reader. Tokens it read that fill() has not handed
+   // out yet are appended to tokens, and lineNo becomes the number
+   // of lines it got to.
+   //
+   void stop(int& lineNo, vector<Token>& tokens) ;
+
+private:
+
+   struct Batch {
+      vector<Token> m_tokens ;
+      bool m_end ;            // the input ends after these tokens
+   } ;
+
+   Batch ring[PREFETCH_BATCHES] ;
+   atomic<size_t> head ;      // next batch to take, moved by fill()
+   atomic<size_t> tail ;      // next batch to fill, moved by the reader
+   atomic<bool> stopping ;
+
+   thread reader ;
+   SallyInput *source ;       // NULL when the reader is not running
+   bool ended ;               // fill() has handed out the last batch
+
+   // the reader's own state
+   //
+   Batch pending ;            // tokens not handed over yet
+   int lines ;                // lines read
+
+   void readLoop() ;
+   bool handOver() ;          // false if stopped while waiting
+
+   SallyPrefetch(const SallyPrefetch&) ;             // no copies
+   SallyPrefetch& operator=(const SallyPrefetch&) ;
+
+} ;
+
+#endif
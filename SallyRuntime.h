@@ -0,0 +1,537 @@
+// File: SallyRuntime.h
+//
+// CMSC 341 Spring 2017 Project 2
+//
+// Runtime for C++ translations of Sally Forth programs
+// (proj2 --emit-cpp, see SallyTranspiler.h). Header only, so a
+// translation builds with just
+//
+//    g++ -O2 -I<this directory> program.cpp
+//
+// Every operation does what the matching Sally handler does,
+// down to its messages; the arithmetic itself comes from
+// SallyOps.h like the interpreter's.
+//
+
+#ifndef _SALLYRUNTIME_H_
+#define _SALLYRUNTIME_H_
+
+#include <iostream>
+#include <map>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include <cstdlib>
+#include <cstring>
+using namespace std ;
+
+#include "SallyArray.h"
+#include "SallyOps.h"
+
+
+// what a parameter is. Names are what a variable name
+// pushes, or any word nobody has defined.
+//
+enum ValueKind { V_INTEGER, V_STRING, V_NAME } ;
+
+struct SallyValue {
+   ValueKind m_kind ;
+   Cell m_value ;         // 0 for strings and names
+   const char *m_text ;   // text of the token that made it
+   int m_name ;           // entry in the name table, -1 if not known yet
+} ;
+
+
+class SallyRuntime ;
+typedef void (*sally_word_t)(SallyRuntime& rt) ;
+
+
+class SallyRuntime {
+
+public:
+
+   // names[] lists the names used by the program, NULL terminated
+   //
+   SallyRuntime(ostream& out, ostream& err, const char *const *names) :
+      m_out(out), m_err(err), m_stack(NULL), m_sp(0), m_cap(0), m_depth(0)
+   {
+      for (int i = 0 ; names[i] != NULL ; i++) {
+         addName(names[i]) ;
+      }
+      grow() ;
+   }
+
+   ~SallyRuntime() { free(m_stack) ; }
+
+
+   // run the program and report how it ended, like Sally::mainLoop()
+   //
+   int run(sally_word_t program) {
+      try {
+         program(*this) ;
+
+         m_err << "End of Program\n" ;
+         if (m_sp == 0) {
+            m_err << "Parameter stack empty.\n" ;
+         } else {
+            m_err << "Parameter stack has " << m_sp << " token(s).\n" ;
+         }
+      } catch (out_of_range& e) {
+         m_err << "Parameter stack underflow??\n" ;
+      } catch (runtime_error& e) {
+         m_err << e.what() << "\n" ;
+      } catch (...) {
+         m_err << "Unexpected exception caught\n" ;
+      }
+      return 0 ;
+   }
+
+
+   // ---- pushing tokens of the program ----
+
+   void push(Cell value, const char *text) {
+      SallyValue v = { V_INTEGER, value, text, -1 } ;
+      pushValue(v) ;
+   }
+
+   void pushString(const char *text) {
+      SallyValue v = { V_STRING, 0, text, -1 } ;
+      pushValue(v) ;
+   }
+
+   void pushName(int name) {
+      SallyValue v = { V_NAME, 0, m_names[name], name } ;
+      pushValue(v) ;
+   }
+
+   // a name that is a word somewhere in the program: call it if it
+   // has been defined by now, otherwise it is just pushed.
+   // tail is set when it is the last thing in a word, which then
+   // does not need a return stack entry any more.
+   //
+   void name(int name, bool tail=false) {
+      if (m_kind[name] != WORD_NAME) {
+         pushName(name) ;
+         return ;
+      }
+      if (tail) m_depth-- ;
+      if (m_depth >= MAX_DEPTH) {
+         throw runtime_error("Return stack overflow??") ;
+      }
+      m_depth++ ;
+      m_word[name](*this) ;
+      m_depth-- ;
+      if (tail) m_depth++ ;
+   }
+
+   // : NAME ... ; being run
+   //
+   void define(int name, sally_word_t word) {
+      if (m_kind[name] != NO_NAME) {
+         m_out << "word: " << m_names[name] << " has already been defined" << endl ;
+         return ;
+      }
+      m_kind[name] = WORD_NAME ;
+      m_word[name] = word ;
+   }
+
+   void message(const char *text) {
+      m_out << text << endl ;
+   }
+
+
+   // ---- builtin words ----
+
+   void binary(int op) {
+      need(2) ;
+      SallyValue& a = m_stack[m_sp-2] ;
+      Cell answer = applyBinary(op, a.m_value, m_stack[m_sp-1].m_value) ;
+      m_sp-- ;
+      a.m_kind = V_INTEGER ;
+      a.m_value = answer ;
+      a.m_text = "" ;
+      a.m_name = -1 ;
+   }
+
+   void unary(int op) {
+      need(1) ;
+      SallyValue& a = m_stack[m_sp-1] ;
+      a.m_value = applyUnary(op, a.m_value) ;
+      a.m_kind = V_INTEGER ;
+      a.m_text = "" ;
+      a.m_name = -1 ;
+   }
+
+   void dot() {
+      need(1) ;
+      const SallyValue& p = m_stack[--m_sp] ;
+      if (p.m_kind == V_INTEGER) {
+         m_out << p.m_value ;
+      } else {
+         m_out << p.m_text ;
+      }
+   }
+
+   void space() { m_out << " " ; }
+   void cr() { m_out << endl ; }
+
+   void dup() {
+      need(1) ;
+      pushValue(m_stack[m_sp-1]) ;
+   }
+
+   void drop() {
+      need(1) ;
+      m_sp-- ;
+   }
+
+   void swap() {
+      need(2) ;
+      SallyValue t = m_stack[m_sp-1] ;
+      m_stack[m_sp-1] = m_stack[m_sp-2] ;
+      m_stack[m_sp-2] = t ;
+   }
+
+   void rot() {
+      need(3) ;
+      SallyValue r = m_stack[m_sp-3] ;
+      m_stack[m_sp-3] = m_stack[m_sp-2] ;
+      m_stack[m_sp-2] = m_stack[m_sp-1] ;
+      m_stack[m_sp-1] = r ;
+   }
+
+   void set() {
+      need(2) ;
+      SallyValue p1 = m_stack[--m_sp] ;
+      SallyValue p2 = m_stack[--m_sp] ;
+      int name = findName(p1) ;
+
+      if (name < 0 || m_kind[name] == NO_NAME) {
+         if (name < 0) name = addName(p1.m_text) ;
+         m_kind[name] = VARIABLE_NAME ;
+         m_var[name] = p2.m_value ;
+      } else {
+         m_out << "variable: " << p1.m_text << "has already been set" << endl ;
+      }
+   }
+
+   void at() {
+      need(1) ;
+      SallyValue p1 = m_stack[--m_sp] ;
+      int name = findName(p1) ;
+
+      if (name < 0 || m_kind[name] != VARIABLE_NAME) {
+         m_out << "variable not found" << endl ;
+         push(0, "") ;
+         return ;
+      }
+      push(m_var[name], "") ;
+   }
+
+   void ex() {
+      need(2) ;
+      SallyValue p1 = m_stack[--m_sp] ;
+      SallyValue p2 = m_stack[--m_sp] ;
+      int name = findName(p1) ;
+
+      if (name < 0 || m_kind[name] != VARIABLE_NAME) {
+         m_out << "variable has not been declared yet" << endl ;
+      } else {
+         m_var[name] = p2.m_value ;
+      }
+   }
+
+
+   // NAME @ and NAME ! for a name that is never a word
+   //
+   void fetch(int name) {
+      if (m_kind[name] != VARIABLE_NAME) {
+         m_out << "variable not found" << endl ;
+         push(0, "") ;
+         return ;
+      }
+      push(m_var[name], "") ;
+   }
+
+   void store(int name) {
+      need(1) ;
+      Cell value = m_stack[--m_sp].m_value ;
+
+      if (m_kind[name] != VARIABLE_NAME) {
+         m_out << "variable has not been declared yet" << endl ;
+      } else {
+         m_var[name] = value ;
+      }
+   }
+
+
+   // ---- arrays ----
+
+   void array() {
+      need(2) ;
+      SallyValue p1 = m_stack[--m_sp] ;
+      SallyValue p2 = m_stack[--m_sp] ;
+      int name = findName(p1) ;
+
+      if (p2.m_value < 0) throw runtime_error("Array size out of range??") ;
+      if (name < 0 || m_kind[name] == NO_NAME) {
+         if (name < 0) name = addName(p1.m_text) ;
+         m_kind[name] = ARRAY_NAME ;
+         m_array[name].assign((size_t) p2.m_value, 0) ;
+      } else {
+         m_out << "array: " << p1.m_text << " has already been set" << endl ;
+      }
+   }
+
+   void arrayAt() {
+      need(2) ;
+      SallyValue p1 = m_stack[--m_sp] ;
+      SallyValue p2 = m_stack[--m_sp] ;
+      vector<Cell> *cells = findArray(p1) ;
+
+      if (cells == NULL) {
+         push(0, "") ;
+         return ;
+      }
+      checkIndex(p2.m_value, *cells) ;
+      push((*cells)[p2.m_value], "") ;
+   }
+
+   void arrayStore() {
+      need(3) ;
+      SallyValue p1 = m_stack[--m_sp] ;
+      SallyValue p2 = m_stack[--m_sp] ;
+      SallyValue p3 = m_stack[--m_sp] ;
+      vector<Cell> *cells = findArray(p1) ;
+
+      if (cells == NULL) return ;
+      checkIndex(p2.m_value, *cells) ;
+      (*cells)[p2.m_value] = p3.m_value ;
+   }
+
+   void arrayLen() {
+      need(1) ;
+      vector<Cell> *cells = findArray(m_stack[--m_sp]) ;
+      push(cells == NULL ? 0 : (Cell) cells->size(), "") ;
+   }
+
+   void arraySum() {
+      need(1) ;
+      vector<Cell> *cells = findArray(m_stack[--m_sp]) ;
+      push(cells == NULL ? 0 : cellSum(cells->data(), cells->size()), "") ;
+   }
+
+   void arrayMin() {
+      need(1) ;
+      vector<Cell> *cells = findArray(m_stack[--m_sp]) ;
+      if (cells == NULL) {
+         push(0, "") ;
+         return ;
+      }
+      if (cells->empty()) throw runtime_error("Array is empty??") ;
+      push(cellMin(cells->data(), cells->size()), "") ;
+   }
+
+   void arrayMax() {
+      need(1) ;
+      vector<Cell> *cells = findArray(m_stack[--m_sp]) ;
+      if (cells == NULL) {
+         push(0, "") ;
+         return ;
+      }
+      if (cells->empty()) throw runtime_error("Array is empty??") ;
+      push(cellMax(cells->data(), cells->size()), "") ;
+   }
+
+   void arrayFill() {
+      need(2) ;
+      SallyValue p1 = m_stack[--m_sp] ;
+      SallyValue p2 = m_stack[--m_sp] ;
+      vector<Cell> *cells = findArray(p1) ;
+
+      if (cells != NULL) cellFill(cells->data(), cells->size(), p2.m_value) ;
+   }
+
+   void arrayCopy() {
+      need(2) ;
+      SallyValue p1 = m_stack[--m_sp] ;
+      SallyValue p2 = m_stack[--m_sp] ;
+      vector<Cell> *dst = findArray(p1) ;
+      if (dst == NULL) return ;
+      vector<Cell> *src = findArray(p2) ;
+      if (src == NULL) return ;
+
+      size_t n = min(src->size(), dst->size()) ;
+      memmove(dst->data(), src->data(), n * sizeof(Cell)) ;
+   }
+
+   void arrayAdd() { combine(&cellAdd) ; }
+   void arrayMul() { combine(&cellMul) ; }
+
+
+   // ---- control flow: the generated code does the jumping ----
+
+   bool ifThen() {
+      need(1) ;
+      return m_stack[--m_sp].m_value != 0 ;
+   }
+
+   // true to go round again
+   //
+   bool until() {
+      need(1) ;
+      return m_stack[--m_sp].m_value == 0 ;
+   }
+
+   // true if the body runs at all
+   //
+   bool forBegin() {
+      need(2) ;
+      Cell start = m_stack[--m_sp].m_value ;
+      Cell limit = m_stack[--m_sp].m_value ;
+
+      if (start == limit) return false ;
+      Counted c = { start, limit } ;
+      m_loops.push_back(c) ;
+      return true ;
+   }
+
+   bool loop() {
+      Counted& c = m_loops.back() ;
+      if (++c.m_index < c.m_limit) return true ;
+      m_loops.pop_back() ;
+      return false ;
+   }
+
+   bool plusLoop() {
+      need(1) ;
+      Cell step = m_stack[--m_sp].m_value ;
+      Counted& c = m_loops.back() ;
+
+      c.m_index += step ;
+      if ((step >= 0) ? (c.m_index < c.m_limit) : (c.m_index >= c.m_limit)) return true ;
+      m_loops.pop_back() ;
+      return false ;
+   }
+
+   void indexI() {
+      if (m_loops.size() < 1) throw out_of_range("I outside of a FOR loop") ;
+      push(m_loops.back().m_index, "") ;
+   }
+
+   void indexJ() {
+      if (m_loops.size() < 2) throw out_of_range("J outside of two FOR loops") ;
+      push(m_loops[m_loops.size()-2].m_index, "") ;
+   }
+
+
+private:
+
+   enum NameKind { NO_NAME, VARIABLE_NAME, WORD_NAME, ARRAY_NAME } ;
+
+   // same limit as the interpreter's return stack
+   //
+   static const int MAX_DEPTH = 65536 ;
+
+   struct Counted {
+      Cell m_index ;
+      Cell m_limit ;
+   } ;
+
+   ostream& m_out ;
+   ostream& m_err ;
+
+   SallyValue *m_stack ;      // parameter stack
+   size_t m_sp ;
+   size_t m_cap ;
+
+   // the symbol table: one entry per name. Names are the
+   // program's string literals, so they never move.
+   //
+   vector<const char *> m_names ;
+   vector<NameKind> m_kind ;
+   vector<Cell> m_var ;
+   vector<sally_word_t> m_word ;
+   vector< vector<Cell> > m_array ;
+   map<string, int> m_byText ;
+
+   vector<Counted> m_loops ;  // FOR loops being run
+   int m_depth ;              // words being run
+
+   void need(size_t n) {
+      if (m_sp < n) throw out_of_range("Parameter stack underflow") ;
+   }
+
+   void grow() {
+      m_cap = m_cap == 0 ? 256 : 2 * m_cap ;
+      m_stack = (SallyValue *) realloc(m_stack, m_cap * sizeof(SallyValue)) ;
+      if (m_stack == NULL) throw bad_alloc() ;
+   }
+
+   void pushValue(const SallyValue& v) {
+      if (m_sp == m_cap) {
+         SallyValue copy = v ;   // v may live in the old stack
+         grow() ;
+         m_stack[m_sp++] = copy ;
+         return ;
+      }
+      m_stack[m_sp++] = v ;
+   }
+
+   void combine(void (*kernel)(Cell *, const Cell *, const Cell *, size_t)) {
+      need(3) ;
+      SallyValue p1 = m_stack[--m_sp] ;
+      SallyValue p2 = m_stack[--m_sp] ;
+      SallyValue p3 = m_stack[--m_sp] ;
+      vector<Cell> *dst = findArray(p1) ;
+      if (dst == NULL) return ;
+      vector<Cell> *b = findArray(p2) ;
+      if (b == NULL) return ;
+      vector<Cell> *a = findArray(p3) ;
+      if (a == NULL) return ;
+
+      size_t n = min(dst->size(), min(a->size(), b->size())) ;
+      kernel(dst->data(), a->data(), b->data(), n) ;
+   }
+
+   int addName(const char *text) {
+      int name = m_names.size() ;
+      m_names.push_back(text) ;
+      m_kind.push_back(NO_NAME) ;
+      m_var.push_back(0) ;
+      m_word.push_back(NULL) ;
+      m_array.push_back(vector<Cell>()) ;
+      m_byText[text] = name ;
+      return name ;
+   }
+
+   // elements of the array a parameter names, NULL if none
+   //
+   vector<Cell> *findArray(const SallyValue& v) {
+      int name = findName(v) ;
+      if (name < 0 || m_kind[name] != ARRAY_NAME) {
+         m_out << "array not found" << endl ;
+         return NULL ;
+      }
+      return &m_array[name] ;
+   }
+
+   void checkIndex(Cell i, const vector<Cell>& cells) {
+      if (i < 0 || (size_t) i >= cells.size()) throw runtime_error("Array index out of range??") ;
+   }
+
+   // the symbol table entry for a parameter's text, -1 if none.
+   // like the interpreter, any token's text can name a variable.
+   //
+   int findName(const SallyValue& v) {
+      if (v.m_name >= 0) return v.m_name ;
+      map<string, int>::iterator it = m_byText.find(v.m_text) ;
+      return it == m_byText.end() ? -1 : it->second ;
+   }
+
+   SallyRuntime(const SallyRuntime&) ;            // no copies
+   SallyRuntime& operator=(const SallyRuntime&) ;
+
+} ;
+
+#endif
@@ -0,0 +1,301 @@
+// File: SallyServer.cpp
+//
+// CMSC 341 Spring 2017 Project 2
+//
+// Implementation of the Sally Forth socket server and client
+//
+
+#include <iostream>
+#include <streambuf>
+#include <string>
+#include <cstring>
+#include <cerrno>
+#include <cstdio>
+#include <csignal>
+#include <stdint.h>
+
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <arpa/inet.h>
+using namespace std ;
+
+#include "Sally.h"
+#include "SallyServer.h"
+
+
+// write all of buf, retrying on short writes and EINTR
+//
+static bool writeAll(int fd, const char *buf, size_t len) {
+   while (len > 0) {
+      ssize_t n = send(fd, buf, len, MSG_NOSIGNAL) ;
+      if (n < 0) {
+         if (errno == EINTR) continue ;
+         return false ;
+      }
+      buf += n ;
+      len -= n ;
+   }
+   return true ;
+}
+
+
+// read exactly len bytes. false on error or early EOF.
+//
+static bool readAll(int fd, char *buf, size_t len) {
+   while (len > 0) {
+      ssize_t n = read(fd, buf, len) ;
+      if (n < 0 && errno == EINTR) continue ;
+      if (n <= 0) return false ;
+      buf += n ;
+      len -= n ;
+   }
+   return true ;
+}
+
+
+static bool sendFrame(int fd, char channel, const char *data, size_t len) {
+   char hdr[5] ;
+   uint32_t nlen = htonl((uint32_t) len) ;
+
+   hdr[0] = channel ;
+   memcpy(hdr+1, &nlen, 4) ;
+   return writeAll(fd, hdr, 5) && writeAll(fd, data, len) ;
+}
+
+
+// streambuf that sends everything written to it as frames
+// on one channel. Output is only pushed to the socket when the
+// buffer fills up or flushFrames() is called, so the endl
+// written by CR does not turn into one frame per line.
+//
+class FrameBuf : public streambuf {
+public:
+   FrameBuf(int fd, char channel) : m_fd(fd), m_channel(channel), m_ok(true) {
+      setp(m_buf, m_buf + sizeof(m_buf)) ;
+   }
+
+   bool flushFrames() {
+      size_t len = pptr() - pbase() ;
+      if (len > 0 && m_ok) {
+         m_ok = sendFrame(m_fd, m_channel, pbase(), len) ;
+      }
+      setp(m_buf, m_buf + sizeof(m_buf)) ;
+      return m_ok ;
+   }
+
+protected:
+   int overflow(int c) {
+      flushFrames() ;
+      if (c != EOF) {
+         *pptr() = (char) c ;
+         pbump(1) ;
+      }
+      return m_ok ? 0 : EOF ;
+   }
+
+private:
+   int m_fd ;
+   char m_channel ;
+   bool m_ok ;
+   char m_buf[8192] ;
+} ;
+
+
+// -------------------------------------------------------
+
+
+SallyServer::SallyServer(const string& socket_path, int workers) :
+   path(socket_path), nworkers(workers), listenfd(-1)
+{
+}
+
+
+SallyServer::~SallyServer() {
+   if (listenfd >= 0) {
+      close(listenfd) ;
+      unlink(path.c_str()) ;
+   }
+}
+
+
+bool SallyServer::run() {
+   struct sockaddr_un addr ;
+
+   if (path.size() >= sizeof(addr.sun_path)) {
+      cerr << "Socket path too long: " << path << endl ;
+      return false ;
+   }
+
+   listenfd = socket(AF_UNIX, SOCK_STREAM, 0) ;
+   if (listenfd < 0) {
+      cerr << "socket: " << strerror(errno) << endl ;
+      return false ;
+   }
+
+   memset(&addr, 0, sizeof(addr)) ;
+   addr.sun_family = AF_UNIX ;
+   strcpy(addr.sun_path, path.c_str()) ;
+   unlink(path.c_str()) ;
+
+   if (bind(listenfd, (struct sockaddr *) &addr, sizeof(addr)) < 0
+       || listen(listenfd, 128) < 0) {
+      cerr << "bind/listen " << path << ": " << strerror(errno) << endl ;
+      return false ;
+   }
+
+   signal(SIGPIPE, SIG_IGN) ;
+
+   if (nworkers <= 1) {
+      workerLoop() ;
+      return true ;
+   }
+
+   // pre-forked workers all accept on the same socket.
+   // replace any worker that dies.
+   //
+   for (int i = 0 ; i < nworkers ; i++) {
+      if (fork() == 0) {
+         workerLoop() ;
+         _exit(0) ;
+      }
+   }
+
+   while (true) {
+      int status ;
+      pid_t pid = wait(&status) ;
+      if (pid < 0) {
+         if (errno == EINTR) continue ;
+         break ;
+      }
+      if (fork() == 0) {
+         workerLoop() ;
+         _exit(0) ;
+      }
+   }
+   return true ;
+}
+
+
+void SallyServer::workerLoop() {
+   SallyPool pool ;   // each worker reuses its own contexts
+   SallyCompileCache cache ;   // and lexes a paragraph it has seen once
+
+   while (true) {
+      int fd = accept(listenfd, NULL, NULL) ;
+      if (fd < 0) {
+         if (errno == EINTR || errno == ECONNABORTED) continue ;
+         cerr << "accept: " << strerror(errno) << endl ;
+         return ;
+      }
+      struct timeval tv = { SALLY_IO_TIMEOUT, 0 } ;
+      setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv)) ;
+      setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv)) ;
+
+      serveOne(fd, pool, cache) ;
+      close(fd) ;
+   }
+}
+
+
+void SallyServer::serveOne(int fd, SallyPool& pool, SallyCompileCache& cache) {
+   string script ;
+   char buf[8192] ;
+   ssize_t n ;
+
+   // read the script until the client shuts down its side
+   //
+   while (true) {
+      n = read(fd, buf, sizeof(buf)) ;
+      if (n < 0 && errno == EINTR) continue ;
+      if (n <= 0) break ;
+      script.append(buf, n) ;
+      if (script.size() > SALLY_MAX_SCRIPT) {
+         string msg = "Script too large\n" ;
+         sendFrame(fd, 'E', msg.data(), msg.size()) ;
+         sendFrame(fd, 'Z', "", 0) ;
+         return ;
+      }
+   }
+   if (n < 0) {
+      if (errno == EAGAIN || errno == EWOULDBLOCK) {
+         string msg = "Timed out reading script\n" ;
+         sendFrame(fd, 'E', msg.data(), msg.size()) ;
+         sendFrame(fd, 'Z', "", 0) ;
+      }
+      return ;
+   }
+
+   SallyMemoryInput in(script.data(), script.size()) ;
+   FrameBuf outbuf(fd, 'O') ;
+   FrameBuf errbuf(fd, 'E') ;
+   ostream out(&outbuf) ;
+   ostream err(&errbuf) ;
+
+   Sally *Sptr = pool.acquire(in, out, err) ;
+   Sptr->setCompileCache(&cache) ;
+   Sptr->setTimeLimit(SALLY_RUN_LIMIT) ;
+   Sptr->mainLoop() ;
+   pool.release(Sptr) ;
+
+   if (outbuf.flushFrames() && errbuf.flushFrames()) {
+      sendFrame(fd, 'Z', "", 0) ;
+   }
+}
+
+
+// -------------------------------------------------------
+
+
+SallyClient::SallyClient(const string& socket_path) : path(socket_path) {
+}
+
+
+bool SallyClient::run(const string& script, string& out, string& err) {
+   struct sockaddr_un addr ;
+   int fd ;
+
+   out.clear() ;
+   err.clear() ;
+
+   if (path.size() >= sizeof(addr.sun_path)) return false ;
+
+   fd = socket(AF_UNIX, SOCK_STREAM, 0) ;
+   if (fd < 0) return false ;
+
+   memset(&addr, 0, sizeof(addr)) ;
+   addr.sun_family = AF_UNIX ;
+   strcpy(addr.sun_path, path.c_str()) ;
+
+   if (connect(fd, (struct sockaddr *) &addr, sizeof(addr)) < 0
+       || !writeAll(fd, script.data(), script.size())) {
+      close(fd) ;
+      return false ;
+   }
+   shutdown(fd, SHUT_WR) ;
+
+   bool done = false ;
+   char hdr[5] ;
+   uint32_t nlen ;
+   string payload ;
+
+   while (!done && readAll(fd, hdr, 5)) {
+      memcpy(&nlen, hdr+1, 4) ;
+      payload.resize(ntohl(nlen)) ;
+      if (!payload.empty() && !readAll(fd, &payload[0], payload.size())) break ;
+
+      if (hdr[0] == 'O') {
+         out += payload ;
+      } else if (hdr[0] == 'E') {
+         err += payload ;
+      } else if (hdr[0] == 'Z') {
+         done = true ;
+      }
+   }
+
+   close(fd) ;
+   return done ;
+}
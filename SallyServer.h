@@ -0,0 +1,97 @@
+// File: SallyServer.h
+//
+// CMSC 341 Spring 2017 Project 2
+//
+// Long-lived Sally Forth server over a Unix domain socket,
+// and the matching client used by sallyc and sallybench.
+//
+// Wire protocol: the client connects, writes the whole script
+// and shuts down its write side. The server runs the script and
+// streams back frames of the form
+//
+//    1 byte channel ('O' = stdout, 'E' = stderr, 'Z' = done)
+//    4 bytes payload length (network byte order)
+//    payload
+//
+// and then closes the connection. A 'Z' frame always ends a
+// complete reply.
+//
+// A client has SALLY_IO_TIMEOUT seconds for each read or write
+// of its connection, and a script SALLY_RUN_LIMIT to run, after
+// which it stops with "Time limit exceeded??" on the 'E' channel
+// like any other error. So a client that never shuts down its
+// side, or a script that never ends, cannot keep a worker.
+//
+// Each worker keeps the paragraphs it has lexed in a compile
+// cache (see SallyCompileCache.h), so a large script sent again
+// with a few lines changed only has those lexed again.
+//
+
+#ifndef _SALLYSERVER_H_
+#define _SALLYSERVER_H_
+
+#include <cstdint>
+#include <string>
+using namespace std ;
+
+#include "SallyCompileCache.h"
+#include "SallyPool.h"
+
+
+// largest script the server accepts in one request
+//
+const size_t SALLY_MAX_SCRIPT = 16 * 1024 * 1024 ;
+
+const int SALLY_IO_TIMEOUT = 10 ;                        // seconds
+const uint64_t SALLY_RUN_LIMIT = 10000000000ull ;        // ns
+
+
+class SallyServer {
+
+public:
+
+   // listen on socket_path, serving with the given number of
+   // worker processes. An existing socket file is replaced.
+   //
+   SallyServer(const string& socket_path, int workers=1) ;
+   ~SallyServer() ;
+
+   // accept and serve requests forever.
+   // returns false if the socket could not be set up.
+   //
+   bool run() ;
+
+private:
+
+   string path ;
+   int nworkers ;
+   int listenfd ;
+
+   void workerLoop() ;          // accept/serve until killed
+
+   // handle one connection
+   //
+   void serveOne(int fd, SallyPool& pool, SallyCompileCache& cache) ;
+
+} ;
+
+
+
+class SallyClient {
+
+public:
+
+   SallyClient(const string& socket_path) ;
+
+   // send script, collect the reply.
+   // returns false on connection or protocol errors.
+   //
+   bool run(const string& script, string& out, string& err) ;
+
+private:
+
+   string path ;
+
+} ;
+
+#endif
@@ -0,0 +1,155 @@
+// File: SallyText.h
+//
+// CMSC 341 Spring 2017 Project 2
+//
+// The text of a Token. Immutable once made. Header only.
+//
+// Texts of up to TEXT_INLINE characters (names, numbers, builtin
+// words) are kept in the SallyText itself. Longer ones, mostly ."
+// string literals, are slices of a reference counted block holding
+// the input line they were lexed from. Pushing one, DUP, SWAP or
+// copying it into a loop body then moves a pointer and bumps a
+// count instead of copying the characters, and . writes the slice
+// out as it is.
+//
+// The counts are atomic, since tokens lexed by preload() or the
+// prefetch thread are run, copied and dropped on another thread.
+//
+
+#ifndef _SALLYTEXT_H_
+#define _SALLYTEXT_H_
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <iostream>
+#include <new>
+#include <string>
+using namespace std ;
+
+
+const size_t TEXT_INLINE = 24 ;
+
+
+class SallyText {
+
+public:
+
+   SallyText() : m_size(0) { memset(m_inline, 0, TEXT_INLINE) ; }
+   SallyText(const char *s) { make(s, strlen(s)) ; }
+   SallyText(const string& s) { make(s.data(), s.size()) ; }
+   SallyText(const char *s, size_t len) { make(s, len) ; }
+
+   SallyText(const SallyText& other) : m_size(other.m_size) {
+      memcpy(m_inline, other.m_inline, TEXT_INLINE) ;
+      if (shared()) m_slice.m_block->m_refs.fetch_add(1, memory_order_relaxed) ;
+   }
+
+   SallyText(SallyText&& other) noexcept : m_size(other.m_size) {
+      memcpy(m_inline, other.m_inline, TEXT_INLINE) ;
+      other.m_size = 0 ;
+   }
+
+   SallyText& operator=(const SallyText& other) {
+      SallyText copy(other) ;
+      swap(copy) ;
+      return *this ;
+   }
+
+   SallyText& operator=(SallyText&& other) noexcept {
+      swap(other) ;
+      return *this ;
+   }
+
+   ~SallyText() {
+      if (shared()) release(m_slice.m_block) ;
+   }
+
+   const char *data() const { return shared() ? m_slice.m_chars : m_inline ; }
+   size_t size() const { return m_size ; }
+   bool empty() const { return m_size == 0 ; }
+
+   // a copy as a string, for code that keeps or builds on it
+   //
+   string str() const { return string(data(), m_size) ; }
+
+   // characters pos .. pos+len-1, sharing this text's block
+   //
+   SallyText substr(size_t pos, size_t len) const {
+      if (len <= TEXT_INLINE || !shared()) return SallyText(data() + pos, len) ;
+
+      SallyText s ;
+      s.m_size = len ;
+      s.m_slice.m_chars = m_slice.m_chars + pos ;
+      s.m_slice.m_block = m_slice.m_block ;
+      m_slice.m_block->m_refs.fetch_add(1, memory_order_relaxed) ;
+      return s ;
+   }
+
+   bool operator==(const SallyText& other) const {
+      return m_size == other.m_size && memcmp(data(), other.data(), m_size) == 0 ;
+   }
+
+   bool operator!=(const SallyText& other) const { return !(*this == other) ; }
+
+private:
+
+   // the characters follow the count
+   //
+   struct Block {
+      atomic<long> m_refs ;
+   } ;
+
+   union {
+      char m_inline[TEXT_INLINE] ;
+      struct {
+         const char *m_chars ;
+         Block *m_block ;
+      } m_slice ;
+   } ;
+   uint32_t m_size ;
+
+   bool shared() const { return m_size > TEXT_INLINE ; }
+
+   void make(const char *s, size_t len) {
+      m_size = len ;
+      if (!shared()) {
+         // all of it set, since copies and swap() move all of it
+         //
+         memset(m_inline, 0, TEXT_INLINE) ;
+         memcpy(m_inline, s, len) ;
+         return ;
+      }
+      void *mem = ::operator new(sizeof(Block) + len) ;
+      m_slice.m_block = new (mem) Block ;
+      m_slice.m_block->m_refs.store(1, memory_order_relaxed) ;
+      m_slice.m_chars = (char *) (m_slice.m_block + 1) ;
+      memcpy((char *) (m_slice.m_block + 1), s, len) ;
+   }
+
+   static void release(Block *b) {
+      if (b->m_refs.fetch_sub(1, memory_order_acq_rel) == 1) {
+         b->~Block() ;
+         ::operator delete(b) ;
+      }
+   }
+
+   void swap(SallyText& other) noexcept {
+      char t[TEXT_INLINE] ;
+      memcpy(t, m_inline, TEXT_INLINE) ;
+      memcpy(m_inline, other.m_inline, TEXT_INLINE) ;
+      memcpy(other.m_inline, t, TEXT_INLINE) ;
+      uint32_t n = m_size ;
+      m_size = other.m_size ;
+      other.m_size = n ;
+   }
+
+} ;
+
+
+inline ostream& operator<<(ostream& out, const SallyText& text) {
+   return out.write(text.data(), text.size()) ;
+}
+
+#endif
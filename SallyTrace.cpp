@@ -0,0 +1,159 @@
+// File: SallyTrace.cpp
+//
+// CMSC 341 Spring 2017 Project 2
+//
+// Trace ring, dumps and the signal handler that writes them
+//
+
+#include <cstring>
+#include <csignal>
+#include <mutex>
+using namespace std ;
+
+#include <unistd.h>
+#include <sys/uio.h>
+
+#include "SallyTrace.h"
+
+
+// traces the signal handler dumps. A trace that finds no free
+// place is only dumped by DUMP and on errors.
+//
+const size_t TRACE_CONTEXTS = 64 ;
+static atomic<SallyTrace *> traces[TRACE_CONTEXTS] ;
+static atomic<uint32_t> contexts(0) ;
+
+
+static uint64_t nowNs() {
+   timespec ts ;
+   clock_gettime(CLOCK_MONOTONIC, &ts) ;
+   return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec ;
+}
+
+
+static void onSignal(int sig) {
+   for (size_t i = 0 ; i < TRACE_CONTEXTS ; i++) {
+      SallyTrace *t = traces[i].load(memory_order_acquire) ;
+      if (t != NULL) t->dump(TRACE_ON_SIGNAL, sig) ;
+   }
+
+   // a crash: the handler has been reset, so this ends the
+   // process the way the signal would have
+   //
+   if (sig != SIGUSR1) raise(sig) ;
+}
+
+
+static void catchSignals() {
+   struct sigaction sa ;
+   const int fatal[] = { SIGSEGV, SIGBUS, SIGFPE, SIGILL, SIGABRT } ;
+
+   memset(&sa, 0, sizeof sa) ;
+   sa.sa_handler = onSignal ;
+   sigemptyset(&sa.sa_mask) ;
+
+   sa.sa_flags = SA_RESTART ;
+   sigaction(SIGUSR1, &sa, NULL) ;
+
+   sa.sa_flags = SA_RESETHAND | SA_NODEFER ;
+   for (size_t i = 0 ; i < sizeof fatal / sizeof fatal[0] ; i++) {
+      sigaction(fatal[i], &sa, NULL) ;
+   }
+}
+
+
+SallyTrace::SallyTrace(int fd, size_t capacity) : m_count(0), m_namesSize(0), m_fd(fd) {
+   static once_flag installed ;
+   call_once(installed, catchSignals) ;
+
+   size_t size = 1 ;
+   while (size < capacity) size *= 2 ;
+
+   m_ring = new TraceRecord[size]() ;
+   m_mask = size - 1 ;
+   m_names = new char[TRACE_NAME_BYTES] ;
+   memset(m_named, 0, sizeof m_named) ;
+
+   m_context = ++contexts ;
+   m_startTicks = traceTicks() ;
+   m_startNs = nowNs() ;
+
+   for (size_t i = 0 ; i < TRACE_CONTEXTS ; i++) {
+      SallyTrace *none = NULL ;
+      if (traces[i].compare_exchange_strong(none, this)) break ;
+   }
+}
+
+
+SallyTrace::~SallyTrace() {
+   for (size_t i = 0 ; i < TRACE_CONTEXTS ; i++) {
+      SallyTrace *self = this ;
+      if (traces[i].compare_exchange_strong(self, NULL)) break ;
+   }
+   close(m_fd) ;
+   delete [] m_ring ;
+   delete [] m_names ;
+}
+
+
+// Remember a word's name, unless it is there already under
+// another slot. When m_names is full the decoder shows the
+// hash instead.
+//
+void SallyTrace::addName(const char *name, size_t len, uint32_t hash) {
+   size_t slot = hash & (TRACE_NAME_SLOTS - 1) ;
+   size_t probes = 0 ;
+
+   while (m_named[slot] != 0 && m_named[slot] != hash) {
+      if (++probes == TRACE_NAME_SLOTS) return ;
+      slot = (slot + 1) & (TRACE_NAME_SLOTS - 1) ;
+   }
+   if (m_named[slot] == hash) return ;
+
+   if (len > 255) len = 255 ;
+   size_t at = m_namesSize.load(memory_order_relaxed) ;
+   if (at + 5 + len > TRACE_NAME_BYTES) return ;
+
+   memcpy(m_names + at, &hash, 4) ;
+   m_names[at + 4] = (char) len ;
+   memcpy(m_names + at + 5, name, len) ;
+   m_namesSize.store(at + 5 + len, memory_order_release) ;
+   m_named[slot] = hash ;
+}
+
+
+void SallyTrace::dump(TraceReason reason, int signal) const {
+   TraceHeader h ;
+   uint64_t count = m_count.load(memory_order_acquire) ;
+   uint64_t kept = count < m_mask + 1 ? count : m_mask + 1 ;
+   uint64_t first = (count - kept) & m_mask ;
+   uint64_t before = m_mask + 1 - first ;        // records up to the end of the ring
+   if (before > kept) before = kept ;
+
+   memset(&h, 0, sizeof h) ;
+   memcpy(h.m_magic, TRACE_MAGIC, sizeof h.m_magic) ;
+   h.m_version = TRACE_VERSION ;
+   h.m_recordSize = sizeof(TraceRecord) ;
+   h.m_reason = reason ;
+   h.m_signal = signal ;
+   h.m_context = m_context ;
+   h.m_capacity = m_mask + 1 ;
+   h.m_count = count ;
+   h.m_namesSize = m_namesSize.load(memory_order_acquire) ;
+   h.m_startTicks = m_startTicks ;
+   h.m_startNs = m_startNs ;
+   h.m_dumpTicks = traceTicks() ;
+   h.m_dumpNs = nowNs() ;
+
+   // one writev, so dumps of interpreters sharing a file are
+   // not interleaved
+   //
+   iovec parts[4] = {
+      { &h, sizeof h },
+      { m_names, h.m_namesSize },
+      { m_ring + first, before * sizeof(TraceRecord) },
+      { m_ring, (kept - before) * sizeof(TraceRecord) }
+   } ;
+   ssize_t written = writev(m_fd, parts, 4) ;
+   (void) written ;
+}
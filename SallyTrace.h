@@ -0,0 +1,174 @@
+// File: SallyTrace.h
+//
+// CMSC 341 Spring 2017 Project 2
+//
+// Execution trace for Sally Forth programs.
+//
+// With tracing on (Sally::setTrace()), mainLoop() writes one
+// fixed size TraceRecord for every token it runs into a ring
+// owned by that interpreter: the opcode, the source line, the
+// value on top of the parameter stack and a timestamp. Calls and
+// returns of words defined with : are recorded as well, so the
+// decoder can rebuild the call stack. Recording stores into the
+// ring and nothing else: no allocation, no locks, no I/O.
+// Loops run by the JIT are not traced.
+//
+// The ring, holding the last TRACE_RECORDS records, is written
+// to the trace file
+//  - by DUMP,
+//  - when a program stops on an error,
+//  - on SIGUSR1, and on a crash (SIGSEGV SIGBUS SIGFPE SIGILL
+//    SIGABRT) before the process dies.
+// Writing a dump only uses calls that are safe in a signal
+// handler. Each dump is appended to the file as a TraceHeader,
+// the names of the words called, then the records oldest first.
+//
+// "sallytrace FILE" prints the dumps as text and
+// "sallytrace --folded FILE" writes folded stacks for
+// flamegraph.pl (see trace.cpp).
+//
+
+#ifndef _SALLYTRACE_H_
+#define _SALLYTRACE_H_
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <ctime>
+using namespace std ;
+
+#include "SallyOps.h"
+
+
+// records kept by default, a power of 2
+//
+const size_t TRACE_RECORDS = 1 << 16 ;
+
+// room for the names of called words
+//
+const size_t TRACE_NAME_BYTES = 1 << 14 ;
+const size_t TRACE_NAME_SLOTS = 1 << 10 ;   // a power of 2
+
+
+// m_op of records that are not builtin words
+//
+enum TraceOp { TRACE_PUSH = -1, TRACE_CALL = -2, TRACE_RETURN = -3 } ;
+
+// why a dump was written
+//
+enum TraceReason { TRACE_ON_DUMP, TRACE_ON_ERROR, TRACE_ON_SIGNAL } ;
+
+
+struct TraceRecord {
+   uint64_t m_time ;        // clock ticks, see TraceHeader
+   int64_t m_top ;          // top of the parameter stack before the token
+                            // ran (0 if empty), or the value pushed
+   uint32_t m_word ;        // TRACE_CALL: symHash() of the word's name
+   int32_t m_line ;         // input line of the token
+   int16_t m_op ;           // opcode or TraceOp
+   uint16_t m_depth ;       // words being run, before a call or return
+   uint32_t m_pad ;
+} ;
+
+
+struct TraceHeader {
+   char m_magic[8] ;        // TRACE_MAGIC
+   uint32_t m_version ;     // TRACE_VERSION
+   uint32_t m_recordSize ;  // sizeof(TraceRecord)
+   uint32_t m_reason ;      // TraceReason
+   int32_t m_signal ;       // the signal, for TRACE_ON_SIGNAL
+   uint32_t m_context ;     // which interpreter, numbered from 1
+   uint32_t m_pad ;
+   uint64_t m_capacity ;    // size of the ring
+   uint64_t m_count ;       // records ever made, the last min(m_count,
+                            // m_capacity) of which follow
+   uint64_t m_namesSize ;   // bytes of names before the records: each
+                            // a 4 byte hash, a length byte and up to
+                            // 255 characters
+
+   // the clock at two points, to turn ticks into time
+   //
+   uint64_t m_startTicks ;
+   uint64_t m_startNs ;
+   uint64_t m_dumpTicks ;
+   uint64_t m_dumpNs ;
+} ;
+
+const char TRACE_MAGIC[8] = { 'S', 'A', 'L', 'L', 'Y', 'T', 'R', 'C' } ;
+const uint32_t TRACE_VERSION = 1 ;
+
+
+// timestamp for records: the TSC on x86-64, nanoseconds elsewhere
+//
+inline uint64_t traceTicks() {
+#if defined(__x86_64__)
+   return __builtin_ia32_rdtsc() ;
+#else
+   timespec ts ;
+   clock_gettime(CLOCK_MONOTONIC, &ts) ;
+   return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec ;
+#endif
+}
+
+
+class SallyTrace {
+
+public:
+
+   // Trace into a ring of capacity records (rounded up to a power
+   // of 2), dumping to fd, which the trace closes when done.
+   //
+   SallyTrace(int fd, size_t capacity = TRACE_RECORDS) ;
+   ~SallyTrace() ;
+
+   void record(int op, int line, Cell top, size_t depth, uint32_t word = 0) {
+      uint64_t n = m_count.load(memory_order_relaxed) ;
+      TraceRecord& r = m_ring[n & m_mask] ;
+
+      r.m_time = traceTicks() ;
+      r.m_top = top ;
+      r.m_word = word ;
+      r.m_line = line ;
+      r.m_op = (int16_t) op ;
+      r.m_depth = (uint16_t) depth ;
+      m_count.store(n + 1, memory_order_release) ;
+   }
+
+   // record a call of the word with this name
+   //
+   void call(const char *name, size_t len, uint32_t hash, int line, Cell top, size_t depth) {
+      if (m_named[hash & (TRACE_NAME_SLOTS - 1)] != hash) addName(name, len, hash) ;
+      record(TRACE_CALL, line, top, depth, hash) ;
+   }
+
+   // Append the ring to the trace file. Safe in a signal handler.
+   //
+   void dump(TraceReason reason, int signal = 0) const ;
+
+private:
+
+   TraceRecord *m_ring ;
+   uint64_t m_mask ;
+   atomic<uint64_t> m_count ;
+
+   // names of the words called so far, and which hashes have
+   // one (probed linearly from hash & (TRACE_NAME_SLOTS - 1)).
+   // Filled in place, so a dump can write them as they are.
+   //
+   char *m_names ;
+   atomic<size_t> m_namesSize ;
+   uint32_t m_named[TRACE_NAME_SLOTS] ;
+
+   int m_fd ;
+   uint32_t m_context ;
+   uint64_t m_startTicks ;
+   uint64_t m_startNs ;
+
+   void addName(const char *name, size_t len, uint32_t hash) ;
+
+   SallyTrace(const SallyTrace&) ;             // no copies
+   SallyTrace& operator=(const SallyTrace&) ;
+
+} ;
+
+#endif
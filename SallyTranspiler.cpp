@@ -0,0 +1,396 @@
+// File: SallyTranspiler.cpp
+//
+// CMSC 341 Spring 2017 Project 2
+//
+// Translating Sally Forth programs to C++
+//
+
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <climits>
+#include <limits>
+#include <cstdio>
+using namespace std ;
+
+#include "Sally.h"
+#include "SallyTranspiler.h"
+
+
+// C++ string literal for text. ? is escaped so nothing turns
+// into a trigraph.
+//
+static string quote(const string& text) {
+   string q = "\"" ;
+   char buf[8] ;
+
+   for (size_t i = 0 ; i < text.size() ; i++) {
+      unsigned char c = text[i] ;
+      if (c == '"' || c == '\\' || c == '?') {
+         q += '\\' ;
+         q += c ;
+      } else if (c < ' ' || c >= 127) {
+         snprintf(buf, sizeof(buf), "\\%03o", c) ;
+         q += buf ;
+      } else {
+         q += c ;
+      }
+   }
+   return q + "\"" ;
+}
+
+
+// C++ expression for a Cell, the most negative one included
+//
+static string intLiteral(Cell v) {
+   ostringstream s ;
+   if (v == numeric_limits<Cell>::min()) {
+      s << "(" << v + 1 << (v < INT_MIN ? "LL" : "") << " - 1)" ;
+   } else {
+      s << v << (v < INT_MIN || v > INT_MAX ? "LL" : "") ;
+   }
+   return s.str() ;
+}
+
+
+// the Opcode spelled as in SallyOps.h, for the words that
+// translate to rt.binary() and rt.unary()
+//
+static const char *opcodeName(int op) {
+   switch (op) {
+   case OP_PLUS:    return "OP_PLUS" ;
+   case OP_MINUS:   return "OP_MINUS" ;
+   case OP_TIMES:   return "OP_TIMES" ;
+   case OP_DIVIDE:  return "OP_DIVIDE" ;
+   case OP_MOD:     return "OP_MOD" ;
+   case OP_EE:      return "OP_EE" ;
+   case OP_NE:      return "OP_NE" ;
+   case OP_LT:      return "OP_LT" ;
+   case OP_LTE:     return "OP_LTE" ;
+   case OP_GT:      return "OP_GT" ;
+   case OP_GTE:     return "OP_GTE" ;
+   case OP_AND:     return "OP_AND" ;
+   case OP_OR:      return "OP_OR" ;
+   case OP_NEG:     return "OP_NEG" ;
+   default:         return "OP_NOT" ;
+   }
+}
+
+
+static bool isOp(const Token& tk, int op) {
+   return tk.m_kind == KEYWORD && tk.m_value == op ;
+}
+
+
+// -------------------------------------------------------
+
+
+SallyTranspiler::SallyTranspiler(istream& input_stream) {
+   Sally S(input_stream) ;
+
+   while (S.fillBuffer()) {
+   }
+   program.swap(S.tkBuffer) ;
+
+   // every name defined as a word somewhere might be a call
+   //
+   for (size_t i = 0 ; i + 1 < program.size() ; i++) {
+      if (isOp(program[i], OP_COLON) && program[i+1].m_kind == UNKNOWN) {
+         words.insert(program[i+1].m_text.str()) ;
+      }
+   }
+}
+
+
+int SallyTranspiler::nameId(const string& name) {
+   map<string, int>::iterator it = names.find(name) ;
+
+   if (it != names.end()) return it->second ;
+   names[name] = nameList.size() ;
+   nameList.push_back(name) ;
+   return nameList.size() - 1 ;
+}
+
+
+bool SallyTranspiler::emit(ostream& output_stream, ostream& error_stream, const string& source) {
+   ostringstream main ;
+   size_t i = 0 ;
+
+   names.clear() ;
+   nameList.clear() ;
+   functions.clear() ;
+
+   if (!block(program, i, program.size(), -1, -1, 1, false, main)) {
+      error_stream << "cannot translate " << source << ": " << error << endl ;
+      return false ;
+   }
+
+   ostream& out = output_stream ;
+
+   out << "// Sally Forth program " << source << ", translated by proj2 --emit-cpp\n"
+       << "//\n"
+       << "// Build with:  g++ -O2 -I<directory of SallyRuntime.h> thisfile.cpp\n"
+       << "//\n\n"
+       << "#define SALLY_CELL_BITS " << SALLY_CELL_BITS << "\n"
+       << "#define SALLY_CHECKED " << SALLY_CHECKED << "\n"
+       << "#include \"SallyRuntime.h\"\n\n\n" ;
+
+   out << "static const char *const names[] = {\n" ;
+   for (size_t n = 0 ; n < nameList.size() ; n++) {
+      out << "   " << quote(nameList[n]) << ",\n" ;
+   }
+   out << "   NULL\n} ;\n\n\n" ;
+
+   for (size_t f = 0 ; f < functions.size() ; f++) {
+      out << functions[f] << "\n\n" ;
+   }
+
+   out << "static void program(SallyRuntime& rt) {\n"
+       << main.str()
+       << "}\n\n\n"
+       << "int main() {\n"
+       << "   SallyRuntime rt(cout, cerr, names) ;\n"
+       << "   return rt.run(program) ;\n"
+       << "}\n" ;
+   return true ;
+}
+
+
+// Translate code[i..] until one of the stop words (left at
+// code[i]) or end. stop1 < 0 means run to end.
+//
+bool SallyTranspiler::block(const vector<Token>& code, size_t& i, size_t end,
+                            int stop1, int stop2, int indent, bool inWord, ostream& out) {
+   while (i < end) {
+      if (stop1 >= 0 && (isOp(code[i], stop1) || isOp(code[i], stop2))) {
+         return true ;
+      }
+      if (!statement(code, i, end, indent, inWord, out)) {
+         return false ;
+      }
+   }
+
+   if (stop1 >= 0) {
+      error = string("missing ") + opTable[stop1].m_name ;
+      return false ;
+   }
+   return true ;
+}
+
+
+// Translate the token at code[i] and whatever it controls
+//
+bool SallyTranspiler::statement(const vector<Token>& code, size_t& i, size_t end,
+                                int indent, bool inWord, ostream& out) {
+   string pad(3 * indent, ' ') ;
+   const Token& tk = code[i] ;
+
+   if (tk.m_kind == INTEGER) {
+      out << pad << "rt.push(" << intLiteral(tk.m_value) << ", " << quote(tk.m_text.str()) << ") ;\n" ;
+      i++ ;
+      return true ;
+   }
+
+   if (tk.m_kind == STRING) {
+      out << pad << "rt.pushString(" << quote(tk.m_text.str()) << ") ;\n" ;
+      i++ ;
+      return true ;
+   }
+
+   if (tk.m_kind != KEYWORD) {
+      int id = nameId(tk.m_text.str()) ;
+      bool word = words.count(tk.m_text.str()) > 0 ;
+
+      // a variable and what is done with it, in one step
+      //
+      if (!word && i + 1 < end && (isOp(code[i+1], OP_AT) || isOp(code[i+1], OP_EX))) {
+         out << pad << (isOp(code[i+1], OP_AT) ? "rt.fetch(" : "rt.store(") << id << ") ;   // "
+             << tk.m_text << " " << code[i+1].m_text << "\n" ;
+         i += 2 ;
+         return true ;
+      }
+
+      if (!word) {
+         out << pad << "rt.pushName(" << id << ") ;" ;
+      } else if (inWord && i + 1 == code.size()) {
+         out << pad << "rt.name(" << id << ", true) ;" ;
+      } else {
+         out << pad << "rt.name(" << id << ") ;" ;
+      }
+      out << "   // " << tk.m_text << "\n" ;
+      i++ ;
+      return true ;
+   }
+
+   int op = tk.m_value ;
+
+   switch (op) {
+
+   case OP_PLUS: case OP_MINUS: case OP_TIMES: case OP_DIVIDE: case OP_MOD:
+   case OP_EE: case OP_NE: case OP_LT: case OP_LTE: case OP_GT: case OP_GTE:
+   case OP_AND: case OP_OR:
+      out << pad << "rt.binary(" << opcodeName(op) << ") ;   // " << tk.m_text << "\n" ;
+      i++ ;
+      return true ;
+
+   case OP_NEG: case OP_NOT:
+      out << pad << "rt.unary(" << opcodeName(op) << ") ;   // " << tk.m_text << "\n" ;
+      i++ ;
+      return true ;
+
+   case OP_DOT:   out << pad << "rt.dot() ;\n" ;      i++ ; return true ;
+   case OP_SP:    out << pad << "rt.space() ;\n" ;    i++ ; return true ;
+   case OP_CR:    out << pad << "rt.cr() ;\n" ;       i++ ; return true ;
+   case OP_DUP:   out << pad << "rt.dup() ;\n" ;      i++ ; return true ;
+   case OP_DROP:  out << pad << "rt.drop() ;\n" ;     i++ ; return true ;
+   case OP_SWAP:  out << pad << "rt.swap() ;\n" ;     i++ ; return true ;
+   case OP_ROT:   out << pad << "rt.rot() ;\n" ;      i++ ; return true ;
+   case OP_SET:   out << pad << "rt.set() ;\n" ;      i++ ; return true ;
+   case OP_AT:    out << pad << "rt.at() ;\n" ;       i++ ; return true ;
+   case OP_EX:    out << pad << "rt.ex() ;\n" ;       i++ ; return true ;
+
+   case OP_ARRAY:  out << pad << "rt.array() ;\n" ;       i++ ; return true ;
+   case OP_AAT:    out << pad << "rt.arrayAt() ;\n" ;     i++ ; return true ;
+   case OP_AEX:    out << pad << "rt.arrayStore() ;\n" ;  i++ ; return true ;
+   case OP_ALEN:   out << pad << "rt.arrayLen() ;\n" ;    i++ ; return true ;
+   case OP_ASUM:   out << pad << "rt.arraySum() ;\n" ;    i++ ; return true ;
+   case OP_AMIN:   out << pad << "rt.arrayMin() ;\n" ;    i++ ; return true ;
+   case OP_AMAX:   out << pad << "rt.arrayMax() ;\n" ;    i++ ; return true ;
+   case OP_AFILL:  out << pad << "rt.arrayFill() ;\n" ;   i++ ; return true ;
+   case OP_ACOPY:  out << pad << "rt.arrayCopy() ;\n" ;   i++ ; return true ;
+   case OP_APLUS:  out << pad << "rt.arrayAdd() ;\n" ;    i++ ; return true ;
+   case OP_ATIMES: out << pad << "rt.arrayMul() ;\n" ;    i++ ; return true ;
+
+   case OP_I:     out << pad << "rt.indexI() ;\n" ;   i++ ; return true ;
+   case OP_J:     out << pad << "rt.indexJ() ;\n" ;   i++ ; return true ;
+
+   case OP_DUMP:
+   case OP_SEMI:      // a ; outside of a definition does nothing
+      i++ ;
+      return true ;
+
+   case OP_IFTHEN: {
+      ostringstream thenPart, elsePart ;
+      size_t elseAt, endifAt ;
+
+      i++ ;
+      if (!block(code, i, end, OP_ELSE, OP_ELSE, indent + 1, inWord, thenPart)) return false ;
+      elseAt = i++ ;
+      if (!block(code, i, end, OP_ENDIF, OP_ENDIF, indent + 1, inWord, elsePart)) return false ;
+      endifAt = i++ ;
+
+      // a true IFTHEN runs on from the first ENDIF after its ELSE,
+      // which may be in the middle of the ELSE part
+      //
+      for (size_t f = elseAt + 1 ; f < endifAt ; f++) {
+         if (isOp(code[f], OP_ENDIF)) {
+            size_t j = f + 1 ;
+            if (!block(code, j, endifAt, -1, -1, indent + 1, inWord, thenPart)) return false ;
+            break ;
+         }
+      }
+
+      out << pad << "if (rt.ifThen()) {\n" << thenPart.str()
+          << pad << "} else {\n" << elsePart.str()
+          << pad << "}\n" ;
+      return true ;
+   }
+
+   case OP_DO:
+      i++ ;
+      out << pad << "do {\n" ;
+      if (!block(code, i, end, OP_UNTIL, OP_UNTIL, indent + 1, inWord, out)) return false ;
+      i++ ;
+      out << pad << "} while (rt.until()) ;\n" ;
+      return true ;
+
+   case OP_FOR:
+      i++ ;
+      out << pad << "if (rt.forBegin()) {\n"
+          << pad << "   do {\n" ;
+      if (!block(code, i, end, OP_LOOP, OP_PLUSLOOP, indent + 2, inWord, out)) return false ;
+      out << pad << "   } while (rt." << (isOp(code[i], OP_LOOP) ? "loop" : "plusLoop") << "()) ;\n"
+          << pad << "}\n" ;
+      i++ ;
+      return true ;
+
+   case OP_COLON:
+      return definition(code, i, end, indent, out) ;
+
+   default:
+      error = string(opTable[op].m_name) + " out of place" ;
+      return false ;
+   }
+}
+
+
+// A definition reached end before it was complete: the end of
+// the program if end is, where the interpreter just stops, and
+// otherwise an error.
+//
+bool SallyTranspiler::endsProgram(const vector<Token>& code, size_t end, const string& pad,
+                                  ostream& out) {
+   if (end != code.size()) {
+      error = "missing ;" ;
+      return false ;
+   }
+   out << pad << "return ;\n" ;
+   return true ;
+}
+
+
+// : NAME ... ; at code[i], as doCOLON() sees it, with its ;
+// before end
+//
+bool SallyTranspiler::definition(const vector<Token>& code, size_t& i, size_t end,
+                                 int indent, ostream& out) {
+   string pad(3 * indent, ' ') ;
+
+   i++ ;
+   if (i == end) {   // the program ends looking for the name
+      return endsProgram(code, end, pad, out) ;
+   }
+
+   const Token& name = code[i++] ;
+
+   if (isOp(name, OP_SEMI)) {
+      out << pad << "rt.message(" << quote("cannot define word: ;") << ") ;\n" ;
+      return true ;
+   }
+
+   size_t start = i ;
+   bool ok = (name.m_kind == UNKNOWN) ;
+
+   while (i < end && !isOp(code[i], OP_SEMI)) {
+      if (isOp(code[i], OP_COLON)) ok = false ;   // definitions do not nest
+      i++ ;
+   }
+   if (i == end) {   // ... or looking for the ;
+      return endsProgram(code, end, pad, out) ;
+   }
+
+   vector<Token> body(code.begin() + start, code.begin() + i) ;
+   i++ ;
+
+   if (!ok) {
+      out << pad << "rt.message(" << quote("cannot define word: " + name.m_text.str()) << ") ;\n" ;
+      return true ;
+   }
+
+   ostringstream fn ;
+   size_t j = 0 ;
+   int f = functions.size() ;
+
+   functions.push_back("") ;
+   fn << "// : " << name.m_text << " ... ;\n"
+      << "//\n"
+      << "static void w" << f << "(SallyRuntime& rt) {\n" ;
+   if (!block(body, j, body.size(), -1, -1, 1, true, fn)) return false ;
+   fn << "}\n" ;
+   functions[f] = fn.str() ;
+
+   out << pad << "rt.define(" << nameId(name.m_text.str()) << ", w" << f << ") ;   // "
+       << name.m_text << "\n" ;
+   return true ;
+}
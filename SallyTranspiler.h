@@ -0,0 +1,72 @@
+// File: SallyTranspiler.h
+//
+// CMSC 341 Spring 2017 Project 2
+//
+// Ahead-of-time translation of a Sally Forth program to a
+// standalone C++ program that uses SallyRuntime.h.
+//
+// Builtin words become calls of inline SallyRuntime members on a
+// plain array stack, IFTHEN ... ELSE ... ENDIF becomes if/else,
+// DO ... UNTIL becomes do { } while, FOR ... LOOP becomes a do
+// loop guarded by the FOR test, and each : NAME ... ; becomes a
+// function the program defines as NAME when it gets there.
+//
+// Programs whose IFTHEN, DO and FOR words do not nest properly
+// are refused: the interpreter skips tokens one at a time, which
+// has no C++ equivalent.
+//
+
+#ifndef _SALLYTRANSPILER_H_
+#define _SALLYTRANSPILER_H_
+
+#include <iostream>
+#include <map>
+#include <set>
+#include <sstream>
+#include <string>
+#include <vector>
+using namespace std ;
+
+#include "Sally.h"
+
+
+class SallyTranspiler {
+
+public:
+
+   // read the whole program from input_stream
+   //
+   SallyTranspiler(istream& input_stream) ;
+
+   // write the C++ program to output_stream. Returns false, with
+   // the reason on error_stream, if it cannot be translated.
+   // source is mentioned in the generated code's header comment.
+   //
+   bool emit(ostream& output_stream, ostream& error_stream, const string& source="") ;
+
+private:
+
+   vector<Token> program ;      // all of the program's tokens
+
+   map<string, int> names ;     // name -> its entry in the runtime's table
+   vector<string> nameList ;
+   set<string> words ;          // names that some : NAME ... ; defines
+
+   vector<string> functions ;   // one per word definition
+   string error ;               // why translation failed
+
+   int nameId(const string& name) ;
+
+   bool block(const vector<Token>& code, size_t& i, size_t end,
+              int stop1, int stop2, int indent, bool inWord, ostream& out) ;
+
+   bool statement(const vector<Token>& code, size_t& i, size_t end,
+                  int indent, bool inWord, ostream& out) ;
+
+   bool definition(const vector<Token>& code, size_t& i, size_t end,
+                   int indent, ostream& out) ;
+   bool endsProgram(const vector<Token>& code, size_t end, const string& pad, ostream& out) ;
+
+} ;
+
+#endif
@@ -0,0 +1,2066 @@
+// File: bench.cpp
+//
+// CMSC 341 Spring 2017 Project 2
+//
+// Benchmark driver for the Sally Forth interpreter.
+//
+// Usage: sallybench [--counters] [--counters-json FILE] WORKLOAD [options]
+//
+// --counters reads hardware counters around the workload
+// (cycles, instructions, branch misses, L1d read misses) and
+// prints them with IPC and the counts per token the interpreter
+// ran. --counters-json FILE also appends them to FILE as a line
+// of JSON. Counters the machine does not have are reported as
+// unavailable.
+//
+//   server SOCKET [-n requests] [-c clients] [-f script]
+//       load generator for a running "proj2 --serve SOCKET".
+//       Reports requests/sec and latency percentiles.
+//
+//   setup [-n runs]
+//       cost of running a tiny script on a freshly constructed
+//       interpreter versus one taken from a SallyPool.
+//
+//   fork [-n runs] [-v variables]
+//       scenario runs that re-execute a setup script defining
+//       many variables, versus forking from a snapshot taken
+//       after the setup.
+//
+//   symtab [-v variables] [-n lookups]
+//       variable lookup cost in the old std::map symbol table
+//       versus SymTab, using the names' cached hashes.
+//
+//   loop [-n size]
+//       nested loops in the example9 style (indices on the
+//       parameter stack, DO ... UNTIL) versus FOR ... LOOP
+//       with I and J.
+//
+//   jit [-n iterations]
+//       a numeric DO ... UNTIL loop run by the interpreter
+//       versus compiled to native code, and another that
+//       reads its step and limit from variables.
+//
+//   array [-n elements]
+//       summing an array with a FOR loop of A@ and + versus
+//       the ASUM word.
+//
+//   errors [-n runs]
+//       pooled runs of tiny scripts that end normally, underflow
+//       the parameter stack or stop on an error.
+//
+//   prefetch [-n lines] [-l latency_us] [-w iterations]
+//       a script read a line at a time from a slow stream, each
+//       line a loop, run with input read as it is needed versus
+//       read ahead by the prefetch thread. Then a program that
+//       stops on an error while its pipe is still open.
+//
+//   lex [-n lines] [-t threads]
+//       a large generated script run with its lines lexed as
+//       it goes versus all lexed up front by preload() on
+//       threads threads (default one per core).
+//
+//   input [-n lines]
+//       the lex workload's script run from a file read through
+//       an istream, from memory, mapped, through a pipe and
+//       gzip compressed (see SallyInput.h), as it is read and
+//       preloaded.
+//
+//   cache [-n lines] [-e edits]
+//       the lex workload's script, in paragraphs, run without a
+//       compile cache, to fill one, and again from it after
+//       edits of its lines, read as it runs and preloaded.
+//
+//   trace [-n iterations]
+//       a loop calling words, run with and without an execution
+//       trace (to /dev/null, dumped once at the end).
+//
+//   memo [-n loops] [-d different]
+//       a script of pure loops filling in a table, each run from
+//       one of only a few different starting values, with and
+//       without the loop memo and the JIT.
+//
+//   fuzz [-n programs] [-s seed] [-r repeats] [-t dir]
+//       random programs, half of them mutated into invalid
+//       ones, each run on the interpreter, the JIT, the
+//       prefetch thread, preload, the JIT with prefetch, the
+//       loop memo and the JIT with the memo, in a child process. Any difference from the interpreter in
+//       output, diagnostics or final stack depth, a crash or a
+//       hang is a mismatch. Prints every engine's speedup for each
+//       program, fastest of repeats runs. With -t the programs
+//       are also translated to C++ and built against the
+//       SallyRuntime.h in dir (timed with process start).
+//
+
+
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <map>
+#include <cstring>
+#include <cstdlib>
+#include <ctime>
+#include <cstdio>
+#include <cmath>
+#include <csignal>
+#include <iomanip>
+
+#include <cerrno>
+
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+#include <linux/perf_event.h>
+using namespace std ;
+
+#include "Sally.h"
+#include "SallyCompileCache.h"
+#include "SallyPool.h"
+#include "SallyServer.h"
+#include "SallyTranspiler.h"
+
+
+// monotonic wall clock in seconds
+//
+static double now() {
+   struct timespec ts ;
+   clock_gettime(CLOCK_MONOTONIC, &ts) ;
+   return ts.tv_sec + ts.tv_nsec * 1e-9 ;
+}
+
+
+// small counting loop, used when no script is given
+//
+static const char *defaultScript =
+   "0 j SET\n"
+   "\n"
+   "DO\n"
+   "  j @ 1 + j !\n"
+   "  j @ . CR\n"
+   "j @ 10 >= UNTIL\n" ;
+
+
+// percentile of an already sorted vector
+//
+static double percentile(const vector<double>& v, double p) {
+   if (v.empty()) return 0.0 ;
+   size_t i = (size_t) (p * (v.size() - 1) + 0.5) ;
+   return v[i] ;
+}
+
+
+static void usage() {
+   cerr << "usage: sallybench server SOCKET [-n requests] [-c clients] [-f script]" << endl ;
+   cerr << "       sallybench setup [-n runs]" << endl ;
+   cerr << "       sallybench fork [-n runs] [-v variables]" << endl ;
+   cerr << "       sallybench symtab [-v variables] [-n lookups]" << endl ;
+   cerr << "       sallybench loop [-n size]" << endl ;
+   cerr << "       sallybench strings [-n iterations]" << endl ;
+   cerr << "       sallybench jit [-n iterations]" << endl ;
+   cerr << "       sallybench array [-n elements]" << endl ;
+   cerr << "       sallybench errors [-n runs]" << endl ;
+   cerr << "       sallybench prefetch [-n lines] [-l latency_us] [-w iterations]" << endl ;
+   cerr << "       sallybench lex [-n lines] [-t threads]" << endl ;
+   cerr << "       sallybench input [-n lines]" << endl ;
+   cerr << "       sallybench cache [-n lines] [-e edits]" << endl ;
+   cerr << "       sallybench trace [-n iterations]" << endl ;
+   cerr << "       sallybench memo [-n loops] [-d different]" << endl ;
+   cerr << "       sallybench fuzz [-n programs] [-s seed] [-r repeats] [-t dir]" << endl ;
+   cerr << "any workload may follow --counters or --counters-json FILE" << endl ;
+   exit(2) ;
+}
+
+
+// -------------------------------------------------------
+
+
+static int benchServer(int argc, char *argv[]) {
+   int requests = 10000 ;
+   int clients = 4 ;
+   string script = defaultScript ;
+
+   if (argc < 1) usage() ;
+   string socket = argv[0] ;
+
+   for (int i = 1 ; i + 1 < argc ; i += 2) {
+      if (strcmp(argv[i], "-n") == 0) {
+         requests = atoi(argv[i+1]) ;
+      } else if (strcmp(argv[i], "-c") == 0) {
+         clients = atoi(argv[i+1]) ;
+      } else if (strcmp(argv[i], "-f") == 0) {
+         ifstream ifile(argv[i+1]) ;
+         ostringstream ss ;
+         ss << ifile.rdbuf() ;
+         script = ss.str() ;
+      } else {
+         usage() ;
+      }
+   }
+   if (clients < 1) clients = 1 ;
+
+   // each client is a child process that sends its share of
+   // the requests and reports its latencies through a pipe
+   //
+   vector<int> pipes ;
+   double start = now() ;
+
+   for (int c = 0 ; c < clients ; c++) {
+      int fds[2] ;
+      if (pipe(fds) < 0) {
+         perror("pipe") ;
+         return 1 ;
+      }
+      if (fork() == 0) {
+         close(fds[0]) ;
+         SallyClient client(socket) ;
+         string out, err ;
+         int mine = requests / clients + (c < requests % clients ? 1 : 0) ;
+
+         for (int r = 0 ; r < mine ; r++) {
+            double t0 = now() ;
+            double lat = client.run(script, out, err) ? now() - t0 : -1.0 ;
+            if (write(fds[1], &lat, sizeof(lat)) != sizeof(lat)) break ;
+         }
+         _exit(0) ;
+      }
+      close(fds[1]) ;
+      pipes.push_back(fds[0]) ;
+   }
+
+   vector<double> lat ;
+   int failures = 0 ;
+   for (size_t c = 0 ; c < pipes.size() ; c++) {
+      double d ;
+      while (read(pipes[c], &d, sizeof(d)) == sizeof(d)) {
+         if (d < 0) {
+            failures++ ;
+         } else {
+            lat.push_back(d) ;
+         }
+      }
+      close(pipes[c]) ;
+   }
+   while (wait(NULL) > 0) { }
+
+   double elapsed = now() - start ;
+   sort(lat.begin(), lat.end()) ;
+
+   cout << "requests:   " << lat.size() << " ok, " << failures << " failed" << endl ;
+   cout << "clients:    " << clients << endl ;
+   cout << "elapsed:    " << elapsed << " s" << endl ;
+   cout << "throughput: " << lat.size() / elapsed << " req/s" << endl ;
+   cout << "latency:    p50 " << percentile(lat, 0.50) * 1e6 << " us, "
+        << "p99 " << percentile(lat, 0.99) * 1e6 << " us, "
+        << "max " << (lat.empty() ? 0.0 : lat.back() * 1e6) << " us" << endl ;
+
+   return failures == 0 ? 0 : 1 ;
+}
+
+
+// -------------------------------------------------------
+
+
+static int benchSetup(int argc, char *argv[]) {
+   int runs = 100000 ;
+   const string script = "1 2 + DROP\n" ;
+
+   if (argc >= 2 && strcmp(argv[0], "-n") == 0) runs = atoi(argv[1]) ;
+
+   ostringstream out, err ;
+   double t0 = now() ;
+   for (int r = 0 ; r < runs ; r++) {
+      istringstream in(script) ;
+      Sally S(in, out, err) ;
+      S.mainLoop() ;
+   }
+   double fresh = now() - t0 ;
+
+   SallyPool pool ;
+   t0 = now() ;
+   for (int r = 0 ; r < runs ; r++) {
+      istringstream in(script) ;
+      Sally *Sptr = pool.acquire(in, out, err) ;
+      Sptr->mainLoop() ;
+      pool.release(Sptr) ;
+   }
+   double pooled = now() - t0 ;
+
+   cout << "fresh:  " << fresh / runs * 1e6 << " us/run" << endl ;
+   cout << "pooled: " << pooled / runs * 1e6 << " us/run" << endl ;
+   return 0 ;
+}
+
+
+// -------------------------------------------------------
+
+
+static int benchFork(int argc, char *argv[]) {
+   int runs = 2000 ;
+   int nvars = 1000 ;
+
+   for (int i = 0 ; i + 1 < argc ; i += 2) {
+      if (strcmp(argv[i], "-n") == 0) {
+         runs = atoi(argv[i+1]) ;
+      } else if (strcmp(argv[i], "-v") == 0) {
+         nvars = atoi(argv[i+1]) ;
+      } else {
+         usage() ;
+      }
+   }
+
+   // setup: v0 .. vN-1 each computed from the previous one
+   //
+   ostringstream ss ;
+   ss << "1 v0 SET\n" ;
+   for (int v = 1 ; v < nvars ; v++) {
+      ss << "v" << v-1 << " @ 3 * 7 % v" << v << " SET\n" ;
+   }
+   const string setup = ss.str() ;
+   const string scenario = "\nv1 @ 5 + v1 ! v1 @ v2 @ + DROP\n" ;
+
+   ostringstream out, err ;
+   double t0 = now() ;
+   for (int r = 0 ; r < runs ; r++) {
+      istringstream in(setup + scenario) ;
+      Sally S(in, out, err) ;
+      S.mainLoop() ;
+   }
+   double rerun = now() - t0 ;
+
+   istringstream setupIn(setup) ;
+   Sally S(setupIn, out, err) ;
+   S.mainLoop() ;
+   SallySnapshot snap ;
+   S.snapshot(snap) ;
+
+   t0 = now() ;
+   for (int r = 0 ; r < runs ; r++) {
+      istringstream in(scenario) ;
+      S.fork(snap, in, out, err) ;
+      S.mainLoop() ;
+   }
+   double forked = now() - t0 ;
+
+   cout << "variables: " << nvars << endl ;
+   cout << "re-run setup: " << rerun / runs * 1e6 << " us/scenario" << endl ;
+   cout << "fork:         " << forked / runs * 1e6 << " us/scenario" << endl ;
+   return 0 ;
+}
+
+
+// -------------------------------------------------------
+
+
+static int benchSymtab(int argc, char *argv[]) {
+   int nvars = 5000 ;
+   int lookups = 5000000 ;
+
+   for (int i = 0 ; i + 1 < argc ; i += 2) {
+      if (strcmp(argv[i], "-n") == 0) {
+         lookups = atoi(argv[i+1]) ;
+      } else if (strcmp(argv[i], "-v") == 0) {
+         nvars = atoi(argv[i+1]) ;
+      } else {
+         usage() ;
+      }
+   }
+
+   // names as the lexer would hand them over
+   //
+   vector<Token> names ;
+   vector<string> keys ;      // the same, for std::map
+   for (int v = 0 ; v < nvars ; v++) {
+      ostringstream ss ;
+      ss << "counter_" << v ;
+      names.push_back( Token(UNKNOWN, 0, ss.str()) ) ;
+      keys.push_back(ss.str()) ;
+   }
+
+   map<string,SymTabEntry> before ;
+   SymTab after ;
+   for (int v = 0 ; v < nvars ; v++) {
+      before[keys[v]] = SymTabEntry(VARIABLE, v, NULL) ;
+      after.insert(names[v].m_text, names[v].m_hash, SymTabEntry(VARIABLE, v, NULL)) ;
+   }
+
+   // same pseudo-random access order for both
+   //
+   vector<int> order(lookups) ;
+   unsigned int r = 12345 ;
+   for (int i = 0 ; i < lookups ; i++) {
+      r = r * 1103515245u + 12345u ;
+      order[i] = (r >> 8) % nvars ;
+   }
+
+   long sum1 = 0, sum2 = 0 ;
+   double t0 = now() ;
+   for (int i = 0 ; i < lookups ; i++) {
+      sum1 += before.find(keys[order[i]])->second.m_value ;
+   }
+   double tmap = now() - t0 ;
+
+   t0 = now() ;
+   for (int i = 0 ; i < lookups ; i++) {
+      const Token& tk = names[order[i]] ;
+      sum2 += after.find(tk.m_text, tk.m_hash)->m_value ;
+   }
+   double thash = now() - t0 ;
+
+   // through the tokens' inline caches, as mainLoop() looks names up
+   //
+   long sum3 = 0 ;
+   t0 = now() ;
+   for (int i = 0 ; i < lookups ; i++) {
+      sum3 += after.find(names[order[i]])->m_value ;
+   }
+   double tcached = now() - t0 ;
+
+   if (sum1 != sum2 || sum1 != sum3) {
+      cerr << "lookup results differ!" << endl ;
+      return 1 ;
+   }
+
+   cout << "variables: " << nvars << ", lookups: " << lookups << endl ;
+   cout << "std::map: " << tmap / lookups * 1e9 << " ns/lookup" << endl ;
+   cout << "SymTab:   " << thash / lookups * 1e9 << " ns/lookup" << endl ;
+   cout << "cached:   " << tcached / lookups * 1e9 << " ns/lookup" << endl ;
+   return 0 ;
+}
+
+
+// -------------------------------------------------------
+
+
+// run script on a fresh interpreter, return seconds taken
+// and what it printed
+//
+static double timeScript(const string& script, string& output) {
+   istringstream in(script) ;
+   ostringstream out, err ;
+   Sally S(in, out, err) ;
+
+   double t0 = now() ;
+   S.mainLoop() ;
+   double t = now() - t0 ;
+
+   output = out.str() ;
+   return t ;
+}
+
+
+static int benchLoop(int argc, char *argv[]) {
+   int n = 1000 ;
+
+   if (argc >= 2 && strcmp(argv[0], "-n") == 0) n = atoi(argv[1]) ;
+
+   // sum of i*j for i, j in 1..n, both ways
+   //
+   ostringstream doUntil ;
+   doUntil << "0 s SET\n"
+           << "1 DO\n"
+           << "   1 DO\n"
+           << "      SWAP DUP ROT DUP ROT * s @ + s !\n"
+           << "      1 + DUP " << n << " > UNTIL\n"
+           << "   DROP\n"
+           << "   1 + DUP " << n << " > UNTIL\n"
+           << "DROP\n"
+           << "s @ .\n" ;
+
+   ostringstream forLoop ;
+   forLoop << "0 s SET\n"
+           << n + 1 << " 1 FOR\n"
+           << "   " << n + 1 << " 1 FOR\n"
+           << "      I J * s @ + s !\n"
+           << "   LOOP\n"
+           << "LOOP\n"
+           << "s @ .\n" ;
+
+   string out1, out2 ;
+   double t1 = timeScript(doUntil.str(), out1) ;
+   double t2 = timeScript(forLoop.str(), out2) ;
+
+   if (out1 != out2) {
+      cerr << "results differ: " << out1 << " vs " << out2 << endl ;
+      return 1 ;
+   }
+
+   double iters = (double) n * n ;
+   cout << "iterations: " << iters << " (result " << out1 << ")" << endl ;
+   cout << "DO/UNTIL:  " << t1 / iters * 1e9 << " ns/iteration" << endl ;
+   cout << "FOR/LOOP:  " << t2 / iters * 1e9 << " ns/iteration" << endl ;
+   return 0 ;
+}
+
+
+// -------------------------------------------------------
+
+
+// the same stack shuffling with labels short enough to be kept
+// in their tokens and with labels shared with the line they
+// came from
+//
+static int benchStrings(int argc, char *argv[]) {
+   int n = 1000000 ;
+
+   if (argc >= 2 && strcmp(argv[0], "-n") == 0) n = atoi(argv[1]) ;
+
+   const char *body = "DUP ROT SWAP DROP ROT SWAP DROP DROP DROP" ;
+   ostringstream shortLabels, longLabels ;
+   shortLabels << n << " 0 FOR .\"first\" .\"second\" .\"third\" " << body << " LOOP\n" ;
+   longLabels << n << " 0 FOR .\"the first label, too long to be inline\" "
+              << ".\"the second label, too long to be inline\" "
+              << ".\"the third label, too long to be inline\" " << body << " LOOP\n" ;
+
+   string out1, out2 ;
+   double t1 = timeScript(shortLabels.str(), out1) ;
+   double t2 = timeScript(longLabels.str(), out2) ;
+
+   cout << "iterations: " << n << endl ;
+   cout << "short labels: " << t1 / n * 1e9 << " ns/iteration" << endl ;
+   cout << "long labels:  " << t2 / n * 1e9 << " ns/iteration" << endl ;
+   return 0 ;
+}
+
+
+// -------------------------------------------------------
+
+
+// run script with or without the JIT, return seconds taken
+// and what it printed
+//
+static double timeJit(const string& script, bool jit, string& output) {
+   istringstream in(script) ;
+   ostringstream out, err ;
+   Sally S(in, out, err) ;
+
+   S.setJit(jit) ;
+
+   double t0 = now() ;
+   S.mainLoop() ;
+   double t = now() - t0 ;
+
+   output = out.str() ;
+   return t ;
+}
+
+
+static int benchJit(int argc, char *argv[]) {
+   int n = 1000000 ;
+
+   if (argc >= 2 && strcmp(argv[0], "-n") == 0) n = atoi(argv[1]) ;
+
+   // a counter on the stack, a sum in a variable
+   //
+   ostringstream script ;
+   script << "0 s SET\n"
+          << "0 DO\n"
+          << "   1 + DUP 7 % DUP * s @ + s !\n"
+          << "   DUP " << n << " >= UNTIL\n"
+          << ". SP s @ .\n" ;
+
+   // step and limit read from variables every time round
+   //
+   ostringstream vars ;
+   vars << "0 s SET 1 step SET " << n << " limit SET\n"
+        << "0 DO\n"
+        << "   step @ + DUP s @ + s !\n"
+        << "   DUP limit @ >= UNTIL\n"
+        << ". SP s @ .\n" ;
+
+   string out1, out2, out3, out4 ;
+   double t1 = timeJit(script.str(), false, out1) ;
+   double t2 = timeJit(script.str(), true, out2) ;
+   double t3 = timeJit(vars.str(), false, out3) ;
+   double t4 = timeJit(vars.str(), true, out4) ;
+
+   if (out1 != out2 || out3 != out4) {
+      cerr << "results differ: " << out1 << " vs " << out2 << ", "
+           << out3 << " vs " << out4 << endl ;
+      return 1 ;
+   }
+
+   cout << "iterations: " << n << " (result " << out1 << ")" << endl ;
+   cout << "interpreter:  " << t1 / n * 1e9 << " ns/iteration" << endl ;
+   cout << "JIT:          " << t2 / n * 1e9 << " ns/iteration" << endl ;
+   cout << "with step @ and limit @:" << endl ;
+   cout << "interpreter:  " << t3 / n * 1e9 << " ns/iteration" << endl ;
+   cout << "JIT:          " << t4 / n * 1e9 << " ns/iteration" << endl ;
+   return 0 ;
+}
+
+
+// -------------------------------------------------------
+
+
+// run script in a fork of snap, return seconds taken and
+// what it printed
+//
+static double timeFork(Sally& S, const SallySnapshot& snap, const string& script, string& output) {
+   istringstream in(script) ;
+   ostringstream out, err ;
+
+   double t0 = now() ;
+   S.fork(snap, in, out, err) ;
+   S.mainLoop() ;
+   double t = now() - t0 ;
+
+   output = out.str() ;
+   return t ;
+}
+
+
+static int benchArray(int argc, char *argv[]) {
+   int n = 100000 ;
+   int reps = 20 ;
+
+   if (argc >= 2 && strcmp(argv[0], "-n") == 0) n = atoi(argv[1]) ;
+
+   ostringstream setup, loop, bulk ;
+   setup << n << " a ARRAY\n"
+         << n << " 0 FOR I 13 * 7 % I a A! LOOP\n" ;
+
+   // the same sums, element by element and with ASUM
+   //
+   loop << reps << " 0 FOR 0 " << n << " 0 FOR I a A@ + LOOP . SP LOOP\n" ;
+   bulk << reps << " 0 FOR a ASUM . SP LOOP\n" ;
+
+   istringstream in(setup.str()) ;
+   ostringstream out, err ;
+   Sally S(in, out, err) ;
+   SallySnapshot snap ;
+
+   S.mainLoop() ;
+   S.snapshot(snap) ;
+
+   string out1, out2 ;
+   double t1 = timeFork(S, snap, loop.str(), out1) ;
+   double t2 = timeFork(S, snap, bulk.str(), out2) ;
+
+   if (out1 != out2) {
+      cerr << "results differ: " << out1 << " vs " << out2 << endl ;
+      return 1 ;
+   }
+
+   double cells = (double) n * reps ;
+   cout << "elements: " << n << ", sums: " << reps << endl ;
+   cout << "FOR ... A@ + LOOP:  " << t1 / cells * 1e9 << " ns/element" << endl ;
+   cout << "ASUM:               " << t2 / cells * 1e9 << " ns/element" << endl ;
+   return 0 ;
+}
+
+
+// -------------------------------------------------------
+
+
+static int benchErrors(int argc, char *argv[]) {
+   int runs = 200000 ;
+
+   if (argc >= 2 && strcmp(argv[0], "-n") == 0) runs = atoi(argv[1]) ;
+
+   // one script each that ends normally, runs out of
+   // parameters and stops on an error
+   //
+   const char *names[] = { "end", "underflow", "error" } ;
+   const string scripts[] = {
+      "1 2 + DROP\n",
+      "1 2 + DROP +\n",
+      "1 2 + DROP 2 a ARRAY 5 a A@\n"
+   } ;
+
+   SallyPool pool ;
+   for (int s = 0 ; s < 3 ; s++) {
+      ostringstream out, err ;
+      double t0 = now() ;
+      for (int r = 0 ; r < runs ; r++) {
+         istringstream in(scripts[s]) ;
+         Sally *Sptr = pool.acquire(in, out, err) ;
+         Sptr->mainLoop() ;
+         pool.release(Sptr) ;
+         if (r % 1024 == 0) {
+            out.str("") ;
+            err.str("") ;
+         }
+      }
+      double t = now() - t0 ;
+      cout << names[s] << ": " << string(10 - strlen(names[s]), ' ')
+           << t / runs * 1e6 << " us/run" << endl ;
+   }
+   return 0 ;
+}
+
+
+// -------------------------------------------------------
+
+
+// a stream that gives out its text a line at a time, waiting
+// before each line as if it came down a slow pipe
+//
+class SlowLines : public streambuf {
+public:
+   SlowLines(const string& text, int latency) : m_text(text), m_pos(0), m_latency(latency) {}
+
+protected:
+   int_type underflow() {
+      if (m_pos >= m_text.size()) return traits_type::eof() ;
+
+      size_t end = m_text.find('\n', m_pos) ;
+      end = (end == string::npos) ? m_text.size() : end + 1 ;
+      usleep(m_latency) ;
+
+      char *p = &m_text[0] ;
+      setg(p + m_pos, p + m_pos, p + end) ;
+      m_pos = end ;
+      return traits_type::to_int_type(*gptr()) ;
+   }
+
+private:
+   string m_text ;
+   size_t m_pos ;
+   int m_latency ;
+} ;
+
+
+static double timePrefetch(const string& script, int latency, bool prefetch, string& output) {
+   SlowLines buf(script, latency) ;
+   istream in(&buf) ;
+   ostringstream out, err ;
+   Sally S(in, out, err) ;
+
+   S.setPrefetch(prefetch) ;
+
+   double t0 = now() ;
+   S.mainLoop() ;
+   double t = now() - t0 ;
+
+   output = out.str() ;
+   return t ;
+}
+
+
+// A program that stops on an error while its pipe is still open,
+// with half of the next line in the pipe: mainLoop() has to return
+// without waiting for more, and the next run finish that line.
+// Returns the time the first run took, or < 0 if it went wrong.
+//
+static double stopPrefetch(string& output) {
+   int fds[2] ;
+   if (pipe(fds) < 0) {
+      perror("pipe") ;
+      return -1 ;
+   }
+
+   const char start[] = "DROP\n1 2" ;
+   const char finish[] = " + .\n" ;
+   ssize_t n = write(fds[1], start, sizeof start - 1) ;
+
+   SallyPipeInput in(fds[0], true) ;
+   ostringstream out, err ;
+   Sally S(in, out, err) ;
+   S.setPrefetch(true) ;
+
+   double t0 = now() ;
+   S.mainLoop() ;
+   double t = now() - t0 ;
+
+   n += write(fds[1], finish, sizeof finish - 1) ;
+   close(fds[1]) ;
+   S.mainLoop() ;
+
+   output = err.str() + out.str() ;
+   if (n != (ssize_t) (sizeof start + sizeof finish - 2)) return -1 ;
+   if (err.str().find("underflow") == string::npos || out.str().find("3") == string::npos) return -1 ;
+   return t ;
+}
+
+
+static int benchPrefetch(int argc, char *argv[]) {
+   int lines = 500 ;
+   int latency = 200 ;
+   int work = 2000 ;
+
+   for (int i = 0 ; i + 1 < argc ; i += 2) {
+      if (strcmp(argv[i], "-n") == 0) {
+         lines = atoi(argv[i + 1]) ;
+      } else if (strcmp(argv[i], "-l") == 0) {
+         latency = atoi(argv[i + 1]) ;
+      } else if (strcmp(argv[i], "-w") == 0) {
+         work = atoi(argv[i + 1]) ;
+      } else {
+         usage() ;
+      }
+   }
+
+   // every line is a loop of work iterations
+   //
+   ostringstream script ;
+   script << "0 s SET\n" ;
+   for (int i = 0 ; i < lines ; i++) {
+      script << work + i << " " << i << " FOR I s @ + s ! LOOP\n" ;
+   }
+   script << "s @ .\n" ;
+
+   string out1, out2 ;
+   double t1 = timePrefetch(script.str(), latency, false, out1) ;
+   double t2 = timePrefetch(script.str(), latency, true, out2) ;
+
+   if (out1 != out2) {
+      cerr << "results differ: " << out1 << " vs " << out2 << endl ;
+      return 1 ;
+   }
+
+   cout << "lines: " << lines << ", " << latency << " us each to read (result " << out1 << ")" << endl ;
+   cout << "reading as it runs:  " << t1 * 1e3 << " ms" << endl ;
+   cout << "prefetch thread:     " << t2 * 1e3 << " ms" << endl ;
+
+   string out3 ;
+   double t3 = stopPrefetch(out3) ;
+   if (t3 < 0) {
+      cerr << "stopping early on an open pipe went wrong: " << out3 << endl ;
+      return 1 ;
+   }
+   cout << "stopped on an open pipe in " << t3 * 1e3 << " ms" << endl ;
+   return 0 ;
+}
+
+
+// -------------------------------------------------------
+
+
+// a generated script: counting, strings, comments and
+// IFTHEN ... ENDIF blocks that span lines
+//
+static string lexScript(int lines) {
+   ostringstream gen ;
+   gen << "0 x SET\n" ;
+   for (int i = 0 ; i < lines ; i += 4) {
+      gen << "x @ " << i % 7 << " + x !   // step " << i << "\n"
+          << "x @ 2 % 0 == IFTHEN ." << '"' << " even " << i << '"' << " DROP\n"
+          << "ELSE x @ 1 + x ! // odd\n"
+          << "ENDIF\n" ;
+   }
+   gen << "x @ .\n" ;
+   return gen.str() ;
+}
+
+
+static int benchLex(int argc, char *argv[]) {
+   int lines = 2000000 ;
+   unsigned threads = 0 ;
+
+   for (int i = 0 ; i + 1 < argc ; i += 2) {
+      if (strcmp(argv[i], "-n") == 0) {
+         lines = atoi(argv[i + 1]) ;
+      } else if (strcmp(argv[i], "-t") == 0) {
+         threads = atoi(argv[i + 1]) ;
+      } else {
+         usage() ;
+      }
+   }
+
+   const string script = lexScript(lines) ;
+
+   string out[2] ;
+   double total[2], lexing = 0 ;
+
+   for (int p = 0 ; p < 2 ; p++) {
+      istringstream in(script) ;
+      ostringstream o, err ;
+      Sally S(in, o, err) ;
+
+      double t0 = now() ;
+      if (p == 1) {
+         S.preload(threads) ;
+         lexing = now() - t0 ;
+      }
+      S.mainLoop() ;
+      total[p] = now() - t0 ;
+      out[p] = o.str() ;
+   }
+
+   if (out[0] != out[1]) {
+      cerr << "results differ: " << out[0] << " vs " << out[1] << endl ;
+      return 1 ;
+   }
+
+   cout << "script: " << script.size() / 1e6 << " MB, " << lines << " lines (result " << out[0] << ")" << endl ;
+   cout << "fillBuffer as it runs:  " << total[0] * 1e3 << " ms" << endl ;
+   cout << "preload:                " << total[1] * 1e3 << " ms, "
+        << lexing * 1e3 << " ms of it lexing" << endl ;
+   return 0 ;
+}
+
+
+// -------------------------------------------------------
+
+
+// the input sources benchInput compares
+//
+enum InputKind { IN_STREAM, IN_MEMORY, IN_MMAP, IN_PIPE, IN_GZIP, IN_KINDS } ;
+
+static const char *inputNames[IN_KINDS] = {
+   "istream", "memory", "mmap", "pipe", "gzip"
+} ;
+
+
+// Run the script saved at path (and at path.gz) from one kind
+// of input, preloaded or not. Returns seconds taken, or -1 if
+// the input cannot be opened.
+//
+static double timeInput(InputKind kind, const string& script, const string& path,
+                        bool preload, string& output) {
+   ostringstream out, err ;
+   ifstream file ;
+   SallyInput *in = NULL ;
+   pid_t writer = -1 ;
+   int fds[2] ;
+
+   double t0 = now() ;
+
+   if (kind == IN_STREAM) {
+      file.open(path.c_str()) ;
+      if (!file) return -1 ;
+      in = new SallyStreamInput(file) ;
+   } else if (kind == IN_MEMORY) {
+      in = new SallyMemoryInput(script.data(), script.size()) ;
+   } else if (kind == IN_MMAP) {
+      in = SallyInput::open(path) ;
+   } else if (kind == IN_GZIP) {
+      in = SallyInput::open(path + ".gz") ;
+   } else if (pipe(fds) == 0) {
+      writer = fork() ;
+      if (writer == 0) {
+         close(fds[0]) ;
+         ifstream f(path.c_str()) ;
+         char buf[1 << 16] ;
+         while (f.read(buf, sizeof buf) || f.gcount() > 0) {
+            if (write(fds[1], buf, f.gcount()) < 0) break ;
+         }
+         _exit(0) ;
+      }
+      close(fds[1]) ;
+      in = new SallyPipeInput(fds[0], true) ;
+   }
+   if (in == NULL) return -1 ;
+
+   {
+      Sally S(*in, out, err) ;
+      if (preload) S.preload() ;
+      S.mainLoop() ;
+   }
+   double t = now() - t0 ;
+
+   delete in ;
+   if (writer > 0) waitpid(writer, NULL, 0) ;
+   output = out.str() ;
+   return t ;
+}
+
+
+static int benchInput(int argc, char *argv[]) {
+   int lines = 2000000 ;
+
+   if (argc >= 2 && strcmp(argv[0], "-n") == 0) lines = atoi(argv[1]) ;
+
+   const string script = lexScript(lines) ;
+
+   char tmp[] = "/tmp/sallyinputXXXXXX" ;
+   if (mkdtemp(tmp) == NULL) {
+      cerr << "cannot make a directory in /tmp" << endl ;
+      return 1 ;
+   }
+   string path = string(tmp) + "/script.sally" ;
+   {
+      ofstream f(path.c_str()) ;
+      f << script ;
+   }
+   string gz = "gzip -k " + path ;
+   if (system(gz.c_str()) != 0) cerr << "gzip failed, no gzip row" << endl ;
+
+   cout << "script: " << script.size() / 1e6 << " MB, " << lines << " lines" << endl ;
+   cout << "            as read     preloaded" << endl ;
+
+   string expected ;
+   int status = 0 ;
+   for (int k = 0 ; k < IN_KINDS ; k++) {
+      double t[2] ;
+      string out[2] ;
+
+      for (int p = 0 ; p < 2 ; p++) {
+         t[p] = timeInput((InputKind) k, script, path, p == 1, out[p]) ;
+      }
+      if (t[0] < 0 || t[1] < 0) continue ;
+
+      if (expected.empty()) expected = out[0] ;
+      if (out[0] != expected || out[1] != expected) {
+         cerr << inputNames[k] << " results differ: " << out[0] << " / " << out[1]
+              << " vs " << expected << endl ;
+         status = 1 ;
+      }
+      cout << setw(10) << left << inputNames[k] << right << setw(10) << t[0] * 1e3 << " ms"
+           << setw(10) << t[1] * 1e3 << " ms" << endl ;
+   }
+
+   string clean = string("rm -rf ") + tmp ;
+   if (system(clean.c_str()) != 0) cerr << "could not remove " << tmp << endl ;
+   return status ;
+}
+
+
+// -------------------------------------------------------
+
+
+// run script through cache (NULL for none), return seconds
+// taken and what it printed
+//
+static double timeCache(const string& script, SallyCompileCache *cache, bool preload,
+                        string& output) {
+   SallyMemoryInput in(script.data(), script.size()) ;
+   ostringstream out, err ;
+   Sally S(in, out, err) ;
+
+   S.setCompileCache(cache) ;
+
+   double t0 = now() ;
+   if (preload) S.preload() ;
+   S.mainLoop() ;
+   double t = now() - t0 ;
+
+   output = out.str() ;
+   return t ;
+}
+
+
+static int benchCache(int argc, char *argv[]) {
+   int lines = 200000 ;      // cached, about a third of COMPILE_CACHE_BYTES
+   int edits = 10 ;
+
+   for (int i = 0 ; i + 1 < argc ; i += 2) {
+      if (strcmp(argv[i], "-n") == 0) {
+         lines = atoi(argv[i + 1]) ;
+      } else if (strcmp(argv[i], "-e") == 0) {
+         edits = atoi(argv[i + 1]) ;
+      } else {
+         usage() ;
+      }
+   }
+
+   // the lex script with its IFTHEN blocks as paragraphs
+   //
+   string script ;
+   const string text = lexScript(lines) ;
+   for (size_t at = 0, n = 0 ; at < text.size() ; n++) {
+      size_t nl = text.find('\n', at) + 1 ;
+      script.append(text, at, nl - at) ;
+      if (n % 4 == 0) script += '\n' ;
+      at = nl ;
+   }
+
+   // the same with edits changed numbers, spread over it
+   //
+   string edited = script ;
+   for (int e = 0 ; e < edits ; e++) {
+      size_t at = edited.find("+ x !", edited.size() / (edits + 1) * (e + 1)) ;
+      if (at != string::npos) edited[at - 2] = edited[at - 2] == '0' ? '1' : '0' ;
+   }
+
+   cout << "script: " << script.size() / 1e6 << " MB, " << lines << " lines, "
+        << edits << " edits" << endl ;
+   double t[3][2] ;
+   uint64_t misses = 0 ;
+   size_t cached = 0, bytes = 0 ;
+   int status = 0 ;
+
+   for (int p = 0 ; p < 2 ; p++) {
+      SallyCompileCache cache ;
+      string plain, edits, filled, reloaded ;
+
+      timeCache(script, NULL, p == 1, plain) ;
+      t[0][p] = timeCache(edited, NULL, p == 1, edits) ;
+      t[1][p] = timeCache(script, &cache, p == 1, filled) ;
+      uint64_t had = cache.misses() ;
+      t[2][p] = timeCache(edited, &cache, p == 1, reloaded) ;
+      misses = cache.misses() - had ;
+      cached = cache.size() ;
+      bytes = cache.bytes() ;
+
+      if (filled != plain || reloaded != edits) {
+         cerr << "results differ with" << (p == 1 ? " preload and" : "") << " a cache" << endl ;
+         status = 1 ;
+      }
+   }
+
+   const char *rows[3] = { "no cache", "filling it", "after edits" } ;
+   cout << "                 as read      preloaded" << endl ;
+   for (int r = 0 ; r < 3 ; r++) {
+      cout << setw(12) << left << rows[r] << right << setw(10) << t[r][0] * 1e3 << " ms"
+           << setw(10) << t[r][1] * 1e3 << " ms" << endl ;
+   }
+   cout << "paragraphs cached: " << cached << ", " << bytes / 1e6 << " MB" << endl ;
+   cout << "paragraphs lexed again after the edits: " << misses << endl ;
+   return status ;
+}
+
+
+// -------------------------------------------------------
+
+
+// run script with or without tracing into path, return seconds
+// taken and what it printed
+//
+static double timeTrace(const string& script, const char *path, string& output) {
+   istringstream in(script) ;
+   ostringstream out, err ;
+   Sally S(in, out, err) ;
+
+   S.setTrace(path) ;
+
+   double t0 = now() ;
+   S.mainLoop() ;
+   double t = now() - t0 ;
+
+   output = out.str() ;
+   return t ;
+}
+
+
+static int benchTrace(int argc, char *argv[]) {
+   int n = 1000000 ;
+
+   if (argc >= 2 && strcmp(argv[0], "-n") == 0) n = atoi(argv[1]) ;
+
+   // the jit workload's loop, with a word call in it
+   //
+   ostringstream script ;
+   script << ": SQ DUP * ;\n"
+          << ": STEP 7 % SQ s @ + s ! ;\n"
+          << "0 s SET\n"
+          << "0 DO\n"
+          << "   1 + DUP STEP\n"
+          << "   DUP " << n << " >= UNTIL\n"
+          << ". SP s @ . DUMP\n" ;
+
+   string out1, out2 ;
+   double t1 = timeTrace(script.str(), NULL, out1) ;
+   double t2 = timeTrace(script.str(), "/dev/null", out2) ;
+
+   if (out1 != out2) {
+      cerr << "results differ: " << out1 << " vs " << out2 << endl ;
+      return 1 ;
+   }
+
+   cout << "iterations: " << n << " (result " << out1 << ")" << endl ;
+   cout << "untraced:  " << t1 / n * 1e9 << " ns/iteration" << endl ;
+   cout << "traced:    " << t2 / n * 1e9 << " ns/iteration" << endl ;
+   return 0 ;
+}
+
+
+// -------------------------------------------------------
+
+
+// run script with or without the loop memo and the JIT, return
+// seconds taken, what it printed and the memo's hits
+//
+static double timeMemo(const string& script, bool memo, bool jit, string& output, uint64_t& hits) {
+   istringstream in(script) ;
+   ostringstream out, err ;
+   Sally S(in, out, err) ;
+
+   S.setMemo(memo) ;
+   S.setJit(jit) ;
+
+   double t0 = now() ;
+   S.mainLoop() ;
+   double t = now() - t0 ;
+
+   output = out.str() ;
+   hits = S.metrics().memoHits.get() ;
+   return t ;
+}
+
+
+static int benchMemo(int argc, char *argv[]) {
+   int n = 10000 ;
+   int different = 16 ;
+
+   for (int i = 0 ; i + 1 < argc ; i += 2) {
+      if (strcmp(argv[i], "-n") == 0) {
+         n = atoi(argv[i + 1]) ;
+      } else if (strcmp(argv[i], "-d") == 0) {
+         different = atoi(argv[i + 1]) ;
+      } else {
+         usage() ;
+      }
+   }
+   if (different < 1) different = 1 ;
+
+   // table entry i is 100 steps of x = (x * 31 + 7) % m from
+   // x = i % different
+   //
+   ostringstream script ;
+   script << "1009 m SET\n" ;
+   for (int i = 0 ; i < n ; i++) {
+      script << i % different << " 0 DO SWAP 31 * 7 + m @ % SWAP 1 + DUP 100 >= UNTIL DROP . "
+             << (i % 16 == 15 ? "CR" : "SP") << "\n" ;
+   }
+
+   const char *names[4] = { "interpreter", "memo", "jit", "jit+memo" } ;
+   string out[4] ;
+   double t[4] ;
+   uint64_t hits[4] ;
+   for (int e = 0 ; e < 4 ; e++) {
+      t[e] = timeMemo(script.str(), e % 2 == 1, e >= 2, out[e], hits[e]) ;
+   }
+
+   cout << "loops: " << n << ", " << different << " different, 100 iterations each" << endl ;
+   int status = 0 ;
+   for (int e = 0 ; e < 4 ; e++) {
+      cout << setw(12) << left << names[e] << right << setw(10) << t[e] / n * 1e9 << " ns/loop" ;
+      if (e % 2 == 1) cout << "   " << hits[e] << " hits" ;
+      cout << endl ;
+      if (out[e] != out[0]) {
+         cerr << "results differ with " << names[e] << endl ;
+         status = 1 ;
+      }
+   }
+   return status ;
+}
+
+
+// -------------------------------------------------------
+
+
+// Random programs for the fuzz workload. A valid program keeps
+// track of the stack depth so it never underflows, with both
+// sides of an IFTHEN and every loop body leaving the depth as
+// they found it. A mutated one then has a few tokens deleted or
+// inserted.
+//
+// Each DO ... UNTIL counts down a variable of its own (c0, c1,
+// ...) and the tokens that do it are never mutated, so every
+// UNTIL that jumps back has just decremented a counter.
+// Divisors are nonzero literals, fixed like the counters, so
+// builds without checked arithmetic never see SIGFPE.
+//
+// Some loops count down on the stack instead, with a body that
+// only works on the cell under the count: pure loops, for the
+// loop memo. All of their tokens are fixed.
+//
+class ProgramGen {
+
+public:
+
+   ProgramGen(unsigned seed) : m_r(seed) {}
+
+   string make(bool mutate) ;
+
+private:
+
+   struct Piece {
+      string m_text ;
+      bool m_fixed ;       // never deleted or inserted before
+   } ;
+
+   unsigned m_r ;
+   vector<Piece> m_code ;
+   int m_loops ;
+
+   unsigned rnd(unsigned n) {
+      m_r = m_r * 1103515245u + 12345u ;
+      return (m_r >> 8) % n ;
+   }
+
+   void put(const string& text, bool fixed = false) {
+      Piece p = { text, fixed } ;
+      m_code.push_back(p) ;
+   }
+
+   string literal() ;
+   void statement(int nest, long runs, bool ifs, int& depth) ;
+   void pureLoop(long runs, int& depth) ;
+   void block(int nest, long runs, bool ifs, int& depth, int length) ;
+   void balance(int& depth, int want) ;
+
+} ;
+
+
+const long FUZZ_RUNS = 20000 ;      // most times any one token runs
+
+
+string ProgramGen::literal() {
+   static const char *big[] = { "2147483647", "-2147483647", "1073741824", "65536", "-1" } ;
+
+   if (rnd(8) == 0) return big[rnd(5)] ;
+   ostringstream ss ;
+   ss << (int) rnd(110) - 10 ;
+   return ss.str() ;
+}
+
+
+// pushes and DROPs bringing depth to want
+//
+void ProgramGen::balance(int& depth, int want) {
+   for ( ; depth < want ; depth++) put(literal()) ;
+   for ( ; depth > want ; depth--) put("DROP") ;
+}
+
+
+void ProgramGen::block(int nest, long runs, bool ifs, int& depth, int length) {
+   for (int i = 0 ; i < length ; i++) statement(nest, runs, ifs, depth) ;
+}
+
+
+// nest is how many IFTHENs and DOs the statement is inside,
+// runs how many times it will run at most. ifs is false in
+// ELSE parts: ELSE skips to the first ENDIF, so they cannot
+// hold an IFTHEN.
+//
+void ProgramGen::statement(int nest, long runs, bool ifs, int& depth) {
+   static const char *binary[] = { "+", "-", "*", "==", "!=", "<", "<=", ">", ">=", "AND", "OR" } ;
+   static const char *unary[] = { "NEG", "NOT", "DUP" } ;
+
+   // keep the stack shallow
+   //
+   unsigned pick = depth > 6 ? 1 + rnd(2) : rnd(12) ;
+
+   if (pick == 0 || depth == 0) {
+      put(literal()) ;
+      depth++ ;
+   } else if (pick == 1 && depth >= 2) {
+      put(binary[rnd(11)]) ;
+      depth-- ;
+   } else if (pick == 2) {
+      if (rnd(2) == 0) {
+         put(".") ;
+         put(rnd(2) == 0 ? "SP" : "CR") ;
+      } else {
+         put("DROP") ;
+      }
+      depth-- ;
+   } else if (pick == 3) {
+      const char *op = unary[rnd(3)] ;
+      put(op) ;
+      if (op[0] == 'D') depth++ ;
+   } else if (pick == 4 && depth >= 2) {
+      put(depth >= 3 && rnd(2) == 0 ? "ROT" : "SWAP") ;
+   } else if (pick == 5) {
+      ostringstream ss ;
+      ss << 1 + rnd(9) ;
+      put(ss.str(), true) ;
+      put(rnd(2) == 0 ? "/" : "%", true) ;
+   } else if (pick == 6) {
+      ostringstream ss ;
+      ss << "v" << rnd(3) ;
+      put(ss.str()) ;
+      put(rnd(2) == 0 ? "@" : "!") ;
+      if (m_code.back().m_text == "@") {
+         depth++ ;
+      } else {
+         depth-- ;
+      }
+   } else if (pick == 7) {
+      ostringstream ss ;
+      ss << ".\"s" << rnd(100) << "\"" ;
+      put(ss.str()) ;
+      put(".") ;
+   } else if (pick >= 8 && pick <= 9 && nest < 3 && ifs) {
+
+      // cond IFTHEN ... ELSE ... ENDIF, both sides ending
+      // at the same depth
+      //
+      put("IFTHEN") ;
+      depth-- ;
+      int before = depth ;
+      block(nest + 1, runs, true, depth, 1 + rnd(4)) ;
+      int after = depth ;
+      put("ELSE") ;
+      depth = before ;
+      block(nest + 1, runs, false, depth, rnd(4)) ;
+      balance(depth, after) ;
+      put("ENDIF") ;
+      put("\n", true) ;
+
+   } else if (pick == 11 && nest < 3 && rnd(2) == 0) {
+      pureLoop(runs, depth) ;
+
+   } else if (pick >= 10 && nest < 3) {
+
+      // n cK ! DO ... cK @ 1 - cK ! cK @ 0 <= UNTIL, the body
+      // leaving the stack as it found it
+      //
+      long most = FUZZ_RUNS / runs ;
+      if (most < 2) return ;
+      long n = 1 + rnd(most < 300 ? most : 300) ;
+
+      ostringstream k ;
+      k << "c" << m_loops++ ;
+      ostringstream count ;
+      count << n ;
+
+      put(count.str(), true) ;
+      put(k.str(), true) ;
+      put("!", true) ;
+      put("DO", true) ;
+      put("\n", true) ;
+      int before = depth ;
+      block(nest + 1, runs * n, ifs, depth, 2 + rnd(6)) ;
+      balance(depth, before) ;
+      const char *tail[] = { "", "@", "1", "-", "", "!", "", "@", "0", "<=", "UNTIL" } ;
+      for (int i = 0 ; i < 11 ; i++) put(tail[i][0] == '\0' ? k.str() : tail[i], true) ;
+      put("\n", true) ;
+
+   } else {
+      put(literal()) ;
+      depth++ ;
+   }
+}
+
+
+// x n DO SWAP ... SWAP 1 - DUP 0 <= UNTIL DROP, the body doing
+// arithmetic on x with literals and variables
+//
+void ProgramGen::pureLoop(long runs, int& depth) {
+   static const char *binary[] = { "+", "-", "*", "==", "<", ">=", "AND", "OR" } ;
+   static const char *unary[] = { "NEG", "NOT" } ;
+
+   long most = FUZZ_RUNS / runs ;
+   if (most < 2) return ;
+   ostringstream count ;
+   count << 1 + rnd(most < 300 ? most : 300) ;
+
+   if (depth == 0) {
+      put(literal(), true) ;
+      depth++ ;
+   }
+   put(count.str(), true) ;
+   put("DO", true) ;
+   put("SWAP", true) ;
+   for (int i = 1 + rnd(4) ; i > 0 ; i--) {
+      unsigned pick = rnd(3) ;
+      if (pick == 0) {
+         put(literal(), true) ;
+         put(binary[rnd(8)], true) ;
+      } else if (pick == 1) {
+         ostringstream v ;
+         v << "v" << rnd(3) ;
+         put(v.str(), true) ;
+         put("@", true) ;
+         put(binary[rnd(8)], true) ;
+      } else {
+         put(unary[rnd(2)], true) ;
+      }
+   }
+   const char *tail[] = { "SWAP", "1", "-", "DUP", "0", "<=", "UNTIL", "DROP" } ;
+   for (int i = 0 ; i < 8 ; i++) put(tail[i], true) ;
+   put("\n", true) ;
+}
+
+
+// The program: variables, a random body, and its stack
+// printed at the end.
+//
+string ProgramGen::make(bool mutate) {
+   static const char *insert[] = { "DROP", "+", "SWAP", "ROT", "IFTHEN", "ELSE", "ENDIF",
+                                   "zz", "zz @", "7 v0 SET", "." } ;
+   m_code.clear() ;
+   m_loops = 0 ;
+
+   int depth = 0 ;
+   block(0, 1, true, depth, 4 + rnd(12)) ;
+   for ( ; depth > 0 ; depth--) {
+      put(".") ;
+      put("SP") ;
+   }
+
+   for (int m = mutate ? 1 + rnd(3) : 0 ; m > 0 ; m--) {
+      size_t at = rnd(m_code.size()) ;
+      if (m_code[at].m_fixed) continue ;
+      if (rnd(2) == 0) {
+         m_code.erase(m_code.begin() + at) ;
+      } else {
+         Piece p = { insert[rnd(11)], false } ;
+         m_code.insert(m_code.begin() + at, p) ;
+      }
+   }
+
+   ostringstream out ;
+   out << "0 v0 SET 0 v1 SET 0 v2 SET\n" ;
+   for (int k = 0 ; k < m_loops ; k++) out << "0 c" << k << " SET\n" ;
+   for (size_t i = 0 ; i < m_code.size() ; i++) {
+      out << m_code[i].m_text << (m_code[i].m_text == "\n" ? "" : " ") ;
+   }
+   out << "\n" ;
+   return out.str() ;
+}
+
+
+// the engines every program runs on: the interpreter first,
+// then everything that must behave exactly like it
+//
+struct Engine {
+   const char *m_name ;
+   bool m_jit ;
+   bool m_prefetch ;
+   bool m_preload ;
+   bool m_memo ;
+} ;
+
+static const Engine engines[] = {
+   { "interpreter",  false, false, false, false },
+   { "jit",          true,  false, false, false },
+   { "prefetch",     false, true,  false, false },
+   { "preload",      false, false, true,  false },
+   { "jit+prefetch", true,  true,  false, false },
+   { "memo",         false, false, false, true  },
+   { "jit+memo",     true,  false, false, true  },
+} ;
+
+const int NUM_ENGINES = sizeof(engines) / sizeof(Engine) ;
+
+
+// what one engine did with a program
+//
+struct EngineRun {
+   string m_out ;
+   string m_err ;
+   long m_depth ;         // left on the stack, -1 if not known
+   double m_seconds ;     // fastest of the repeats
+} ;
+
+
+static void runEngine(const Engine& e, const string& script, int repeats, EngineRun& run) {
+   run.m_seconds = 1e99 ;
+   for (int r = 0 ; r < repeats ; r++) {
+      istringstream in(script) ;
+      ostringstream out, err ;
+      Sally S(in, out, err) ;
+
+      S.setJit(e.m_jit) ;
+      S.setPrefetch(e.m_prefetch) ;
+      S.setMemo(e.m_memo) ;
+
+      double t0 = now() ;
+      if (e.m_preload) S.preload() ;
+      S.mainLoop() ;
+      double t = now() - t0 ;
+
+      if (t < run.m_seconds) run.m_seconds = t ;
+      run.m_out = out.str() ;
+      run.m_err = err.str() ;
+      run.m_depth = S.depth() ;
+   }
+}
+
+
+// The program translated to C++ (see SallyTranspiler.h), built
+// against SallyRuntime.h in dir and run. Its time includes
+// starting the process. False if the translator refuses it.
+//
+static bool runTranslated(const string& script, const string& dir, int repeats, EngineRun& run) {
+   char tmp[] = "/tmp/sallyfuzzXXXXXX" ;
+   if (mkdtemp(tmp) == NULL) return false ;
+   string base = tmp ;
+
+   istringstream in(script) ;
+   SallyTranspiler translator(in) ;
+   ofstream src((base + "/p.cpp").c_str()) ;
+   ostringstream why ;
+   bool ok = translator.emit(src, why) ;
+   src.close() ;
+
+   const char *cxx = getenv("CXX") ;
+   string build = string(cxx != NULL ? cxx : "c++") + " -O2 -I" + dir + " -o " + base + "/p "
+                  + base + "/p.cpp" ;
+   run.m_out.clear() ;
+   run.m_err = "(did not build)" ;
+   run.m_seconds = 1e99 ;
+
+   if (ok && system(build.c_str()) == 0) {
+      string cmd = base + "/p >" + base + "/out 2>" + base + "/err" ;
+      for (int r = 0 ; r < repeats ; r++) {
+         double t0 = now() ;
+         if (system(cmd.c_str()) == -1) break ;
+         double t = now() - t0 ;
+         if (t < run.m_seconds) run.m_seconds = t ;
+      }
+      ifstream o((base + "/out").c_str()), e((base + "/err").c_str()) ;
+      ostringstream so, se ;
+      so << o.rdbuf() ;
+      se << e.rdbuf() ;
+      run.m_out = so.str() ;
+      run.m_err = se.str() ;
+   }
+   run.m_depth = -1 ;
+
+   string clean = "rm -rf " + base ;
+   if (system(clean.c_str()) != 0) cerr << "could not remove " << base << endl ;
+   return ok ;
+}
+
+
+// strings through a pipe, each after its length
+//
+static void putString(string& buf, const string& s) {
+   uint64_t n = s.size() ;
+   buf.append((const char *) &n, sizeof n) ;
+   buf += s ;
+}
+
+static bool getString(const string& buf, size_t& at, string& s) {
+   uint64_t n ;
+   if (at + sizeof n > buf.size()) return false ;
+   memcpy(&n, &buf[at], sizeof n) ;
+   at += sizeof n ;
+   if (at + n > buf.size()) return false ;
+   s = buf.substr(at, n) ;
+   at += n ;
+   return true ;
+}
+
+
+// Run script on every engine in a child process, so a crash or
+// a program that never ends is reported rather than fatal.
+// translated is set if the C++ translation ran too.
+//
+static string runAll(const string& script, const string& cppDir, int repeats,
+                     vector<EngineRun>& runs, bool& translated) {
+   int fds[2] ;
+   if (pipe(fds) < 0) return "pipe failed" ;
+
+   pid_t pid = fork() ;
+   if (pid == 0) {
+      close(fds[0]) ;
+      alarm(cppDir.empty() ? 20 : 300) ;
+
+      string buf ;
+      EngineRun run ;
+      for (int e = 0 ; e < NUM_ENGINES ; e++) {
+         runEngine(engines[e], script, repeats, run) ;
+         putString(buf, run.m_out) ;
+         putString(buf, run.m_err) ;
+         buf.append((const char *) &run.m_depth, sizeof run.m_depth) ;
+         buf.append((const char *) &run.m_seconds, sizeof run.m_seconds) ;
+      }
+      if (!cppDir.empty() && runTranslated(script, cppDir, repeats, run)) {
+         putString(buf, run.m_out) ;
+         putString(buf, run.m_err) ;
+         buf.append((const char *) &run.m_depth, sizeof run.m_depth) ;
+         buf.append((const char *) &run.m_seconds, sizeof run.m_seconds) ;
+      }
+      for (size_t at = 0 ; at < buf.size() ; ) {
+         ssize_t n = write(fds[1], buf.data() + at, buf.size() - at) ;
+         if (n <= 0) break ;
+         at += n ;
+      }
+      _exit(0) ;
+   }
+   close(fds[1]) ;
+
+   string buf ;
+   char block[1 << 14] ;
+   ssize_t n ;
+   while ((n = read(fds[0], block, sizeof block)) > 0) buf.append(block, n) ;
+   close(fds[0]) ;
+
+   int status ;
+   waitpid(pid, &status, 0) ;
+   if (WIFSIGNALED(status)) {
+      return WTERMSIG(status) == SIGALRM ? "did not finish" : string("died on ") + strsignal(WTERMSIG(status)) ;
+   }
+
+   runs.clear() ;
+   size_t at = 0 ;
+   EngineRun run ;
+   while (getString(buf, at, run.m_out) && getString(buf, at, run.m_err)
+          && at + sizeof run.m_depth + sizeof run.m_seconds <= buf.size()) {
+      memcpy(&run.m_depth, &buf[at], sizeof run.m_depth) ;
+      at += sizeof run.m_depth ;
+      memcpy(&run.m_seconds, &buf[at], sizeof run.m_seconds) ;
+      at += sizeof run.m_seconds ;
+      runs.push_back(run) ;
+   }
+   if ((int) runs.size() < NUM_ENGINES) return "lost the results" ;
+   translated = (int) runs.size() > NUM_ENGINES ;
+   return "" ;
+}
+
+
+// how run differs from the interpreter's, "" if not at all
+//
+static string differences(const EngineRun& ref, const EngineRun& run) {
+   string d ;
+   if (run.m_out != ref.m_out) d += " stdout" ;
+   if (run.m_err != ref.m_err) d += " stderr" ;
+   if (run.m_depth >= 0 && run.m_depth != ref.m_depth) d += " stack" ;
+   return d ;
+}
+
+
+static int benchFuzz(int argc, char *argv[]) {
+   int programs = 200 ;
+   unsigned seed = (unsigned) time(NULL) ;
+   int repeats = 3 ;
+   string cppDir ;
+
+   for (int i = 0 ; i + 1 < argc ; i += 2) {
+      if (strcmp(argv[i], "-n") == 0) {
+         programs = atoi(argv[i + 1]) ;
+      } else if (strcmp(argv[i], "-s") == 0) {
+         seed = strtoul(argv[i + 1], NULL, 10) ;
+      } else if (strcmp(argv[i], "-r") == 0) {
+         repeats = atoi(argv[i + 1]) ;
+      } else if (strcmp(argv[i], "-t") == 0) {
+         cppDir = argv[i + 1] ;
+      } else {
+         usage() ;
+      }
+   }
+   if (repeats < 1) repeats = 1 ;
+
+   int columns = NUM_ENGINES + (cppDir.empty() ? 0 : 1) ;
+   vector<double> logSpeedup(columns, 0.0) ;
+   vector<int> timed(columns, 0) ;
+   int failures = 0 ;
+
+   cout << "seed " << seed << endl ;
+   cout << setw(6) << "prog" << setw(9) << "kind" << setw(14) << "interp us" ;
+   for (int e = 1 ; e < NUM_ENGINES ; e++) cout << setw(14) << engines[e].m_name ;
+   if (!cppDir.empty()) cout << setw(14) << "c++ (exec)" ;
+   cout << endl ;
+
+   for (int p = 0 ; p < programs ; p++) {
+      ProgramGen gen(seed + p) ;
+      bool mutated = (seed + p) % 2 == 1 ;
+      string script = gen.make(mutated) ;
+
+      vector<EngineRun> runs ;
+      bool translated = false ;
+      string trouble = runAll(script, cppDir, repeats, runs, translated) ;
+
+      cout << setw(6) << p << setw(9) << (mutated ? "mutated" : "valid") ;
+      if (trouble.empty()) {
+         cout << fixed << setprecision(1) << setw(14) << runs[0].m_seconds * 1e6 ;
+         for (size_t e = 1 ; e < runs.size() ; e++) {
+            double s = runs[0].m_seconds / runs[e].m_seconds ;
+            logSpeedup[e] += log(s) ;
+            timed[e]++ ;
+            cout << setw(13) << setprecision(2) << s << "x" ;
+         }
+         if (!cppDir.empty() && !translated) cout << setw(14) << "refused" ;
+
+         for (size_t e = 1 ; e < runs.size() ; e++) {
+            string d = differences(runs[0], runs[e]) ;
+            if (d.empty()) continue ;
+            trouble += string(" ") + (e < (size_t) NUM_ENGINES ? engines[e].m_name : "c++") + ":" + d ;
+         }
+      }
+      cout << endl ;
+
+      if (!trouble.empty()) {
+         failures++ ;
+         cout << "  MISMATCH" << trouble << "  (again: sallybench fuzz -s " << seed + p
+              << " -n 1)" << endl ;
+         cerr << "---- program " << p << " ----" << endl << script ;
+         for (size_t e = 0 ; e < runs.size() ; e++) {
+            cerr << "---- " << (e < (size_t) NUM_ENGINES ? engines[e].m_name : "c++")
+                 << ": stack " << runs[e].m_depth << endl << runs[e].m_out << runs[e].m_err ;
+         }
+      }
+   }
+
+   cout << "programs: " << programs << ", mismatches: " << failures << endl ;
+   cout << "geometric mean speedup over the interpreter:" ;
+   for (int e = 1 ; e < columns ; e++) {
+      cout << " " << (e < NUM_ENGINES ? engines[e].m_name : "c++") << " "
+           << setprecision(2) << (timed[e] > 0 ? exp(logSpeedup[e] / timed[e]) : 0.0) << "x" ;
+   }
+   cout << endl ;
+   return failures == 0 ? 0 : 1 ;
+}
+
+
+// -------------------------------------------------------
+
+
+// Hardware counters read around a whole workload with
+// perf_event_open(2): user space only, and inherited by the
+// threads and processes the workload starts. A counter the
+// machine or kernel will not give (no PMU in a VM,
+// perf_event_paranoid too high) is reported as unavailable and
+// the others carry on.
+//
+struct CounterSpec {
+   const char *m_name ;
+   uint32_t m_type ;
+   uint64_t m_config ;
+} ;
+
+static const CounterSpec counterSpecs[] = {
+   { "cycles",        PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES },
+   { "instructions",  PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS },
+   { "branch_misses", PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES },
+   { "l1d_misses",    PERF_TYPE_HW_CACHE, PERF_COUNT_HW_CACHE_L1D
+                                          | (PERF_COUNT_HW_CACHE_OP_READ << 8)
+                                          | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16) },
+} ;
+
+enum { CTR_CYCLES, CTR_INSTRUCTIONS, CTR_BRANCH_MISSES, CTR_L1D_MISSES, NUM_COUNTERS } ;
+
+
+class PerfCounters {
+
+public:
+
+   PerfCounters() ;
+   ~PerfCounters() ;
+
+   void start() ;
+   void stop() ;
+
+   // counts since start(), scaled up if the kernel had to share
+   // the hardware between counters. False if not available.
+   //
+   bool value(int c, double& v) const ;
+
+   const string& whyNot(int c) const { return m_why[c] ; }
+
+private:
+
+   int m_fd[NUM_COUNTERS] ;
+   string m_why[NUM_COUNTERS] ;     // why a counter is not available
+   double m_value[NUM_COUNTERS] ;
+
+} ;
+
+
+PerfCounters::PerfCounters() {
+   for (int c = 0 ; c < NUM_COUNTERS ; c++) {
+      perf_event_attr attr ;
+      memset(&attr, 0, sizeof attr) ;
+      attr.size = sizeof attr ;
+      attr.type = counterSpecs[c].m_type ;
+      attr.config = counterSpecs[c].m_config ;
+      attr.disabled = 1 ;
+      attr.inherit = 1 ;
+      attr.exclude_kernel = 1 ;
+      attr.exclude_hv = 1 ;
+      attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING ;
+
+      m_fd[c] = syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0) ;
+      m_value[c] = 0 ;
+      if (m_fd[c] < 0) m_why[c] = strerror(errno) ;
+   }
+}
+
+
+PerfCounters::~PerfCounters() {
+   for (int c = 0 ; c < NUM_COUNTERS ; c++) {
+      if (m_fd[c] >= 0) close(m_fd[c]) ;
+   }
+}
+
+
+void PerfCounters::start() {
+   for (int c = 0 ; c < NUM_COUNTERS ; c++) {
+      if (m_fd[c] < 0) continue ;
+      ioctl(m_fd[c], PERF_EVENT_IOC_RESET, 0) ;
+      ioctl(m_fd[c], PERF_EVENT_IOC_ENABLE, 0) ;
+   }
+}
+
+
+void PerfCounters::stop() {
+   for (int c = 0 ; c < NUM_COUNTERS ; c++) {
+      if (m_fd[c] < 0) continue ;
+      ioctl(m_fd[c], PERF_EVENT_IOC_DISABLE, 0) ;
+
+      uint64_t got[3] ;      // value, time enabled, time running
+      if (read(m_fd[c], got, sizeof got) != sizeof got) {
+         m_why[c] = "read failed" ;
+         close(m_fd[c]) ;
+         m_fd[c] = -1 ;
+      } else if (got[2] == 0) {
+         m_why[c] = "never scheduled" ;
+      } else {
+         m_value[c] = (double) got[0] * got[1] / got[2] ;
+      }
+   }
+}
+
+
+bool PerfCounters::value(int c, double& v) const {
+   v = m_value[c] ;
+   return m_fd[c] >= 0 && m_why[c].empty() ;
+}
+
+
+// Print the counters, IPC and the counts per token the
+// interpreter ran. Tokens run by the JIT's native code, or in
+// other processes, are not counted, so per-token figures for
+// those workloads come out high.
+//
+static void reportCounters(const PerfCounters& pc, double tokens) {
+   double v[NUM_COUNTERS] ;
+   bool have[NUM_COUNTERS] ;
+
+   cout << "counters:" ;
+   for (int c = 0 ; c < NUM_COUNTERS ; c++) {
+      have[c] = pc.value(c, v[c]) ;
+      cout << " " << counterSpecs[c].m_name << " " ;
+      if (have[c]) {
+         cout << (uint64_t) v[c] ;
+      } else {
+         cout << "unavailable (" << pc.whyNot(c) << ")" ;
+      }
+   }
+   cout << endl ;
+
+   if (have[CTR_CYCLES] && have[CTR_INSTRUCTIONS] && v[CTR_CYCLES] > 0) {
+      cout << "IPC: " << v[CTR_INSTRUCTIONS] / v[CTR_CYCLES] << endl ;
+   }
+   cout << "Sally instructions: " << (uint64_t) tokens << endl ;
+   if (tokens > 0 && (have[0] || have[1] || have[2] || have[3])) {
+      cout << "per Sally instruction:" ;
+      for (int c = 0 ; c < NUM_COUNTERS ; c++) {
+         if (have[c]) cout << " " << counterSpecs[c].m_name << " " << v[c] / tokens ;
+      }
+      cout << endl ;
+   }
+}
+
+
+// The same as one line of JSON appended to path, so runs can be
+// compared over time. Missing counters are null.
+//
+static void appendCounters(const char *path, const PerfCounters& pc, double tokens,
+                           int argc, char *argv[], double seconds, int status) {
+   ofstream out(path, ios::app) ;
+   if (!out) {
+      cerr << "cannot open " << path << endl ;
+      return ;
+   }
+
+   out << "{\"time\": " << (long) time(NULL) << ", \"workload\": \"" ;
+   for (int i = 0 ; i < argc ; i++) out << (i > 0 ? " " : "") << argv[i] ;
+   out << "\", \"status\": " << status << ", \"seconds\": " << seconds
+       << ", \"sally_instructions\": " << (uint64_t) tokens ;
+
+   double v[NUM_COUNTERS] ;
+   bool have[NUM_COUNTERS] ;
+   for (int c = 0 ; c < NUM_COUNTERS ; c++) {
+      have[c] = pc.value(c, v[c]) ;
+      out << ", \"" << counterSpecs[c].m_name << "\": " ;
+      if (have[c]) {
+         out << (uint64_t) v[c] ;
+      } else {
+         out << "null" ;
+      }
+   }
+
+   out << ", \"ipc\": " ;
+   if (have[CTR_CYCLES] && have[CTR_INSTRUCTIONS] && v[CTR_CYCLES] > 0) {
+      out << v[CTR_INSTRUCTIONS] / v[CTR_CYCLES] ;
+   } else {
+      out << "null" ;
+   }
+
+   for (int c = 0 ; c < NUM_COUNTERS ; c++) {
+      out << ", \"" << counterSpecs[c].m_name << "_per_sally_instruction\": " ;
+      if (have[c] && tokens > 0) {
+         out << v[c] / tokens ;
+      } else {
+         out << "null" ;
+      }
+   }
+
+   out << ", \"unavailable\": {" ;
+   bool first = true ;
+   for (int c = 0 ; c < NUM_COUNTERS ; c++) {
+      if (have[c]) continue ;
+      out << (first ? "" : ", ") << "\"" << counterSpecs[c].m_name << "\": \"" << pc.whyNot(c) << "\"" ;
+      first = false ;
+   }
+   out << "}}" << endl ;
+}
+
+
+typedef int (*workload_t)(int argc, char *argv[]) ;
+
+
+int main(int argc, char *argv[]) {
+   bool counters = false ;
+   const char *json = NULL ;
+
+   int first = 1 ;
+   while (first < argc && strncmp(argv[first], "--", 2) == 0) {
+      if (strcmp(argv[first], "--counters") == 0) {
+         counters = true ;
+         first++ ;
+      } else if (strcmp(argv[first], "--counters-json") == 0 && first + 1 < argc) {
+         counters = true ;
+         json = argv[first + 1] ;
+         first += 2 ;
+      } else {
+         usage() ;
+      }
+   }
+   if (first >= argc) usage() ;
+
+   string workload = argv[first] ;
+   workload_t run = NULL ;
+   if (workload == "server") {
+      run = benchServer ;
+   } else if (workload == "setup") {
+      run = benchSetup ;
+   } else if (workload == "fork") {
+      run = benchFork ;
+   } else if (workload == "symtab") {
+      run = benchSymtab ;
+   } else if (workload == "loop") {
+      run = benchLoop ;
+   } else if (workload == "strings") {
+      run = benchStrings ;
+   } else if (workload == "jit") {
+      run = benchJit ;
+   } else if (workload == "array") {
+      run = benchArray ;
+   } else if (workload == "errors") {
+      run = benchErrors ;
+   } else if (workload == "prefetch") {
+      run = benchPrefetch ;
+   } else if (workload == "lex") {
+      run = benchLex ;
+   } else if (workload == "input") {
+      run = benchInput ;
+   } else if (workload == "cache") {
+      run = benchCache ;
+   } else if (workload == "trace") {
+      run = benchTrace ;
+   } else if (workload == "memo") {
+      run = benchMemo ;
+   } else if (workload == "fuzz") {
+      run = benchFuzz ;
+   } else {
+      usage() ;
+   }
+
+   if (!counters) return run(argc - first - 1, argv + first + 1) ;
+
+   PerfCounters pc ;
+   uint64_t tokens = SallyMetrics::processInstructions.load() ;
+   double t0 = now() ;
+
+   pc.start() ;
+   int status = run(argc - first - 1, argv + first + 1) ;
+   pc.stop() ;
+
+   double seconds = now() - t0 ;
+   tokens = SallyMetrics::processInstructions.load() - tokens ;
+
+   reportCounters(pc, tokens) ;
+   if (json != NULL) appendCounters(json, pc, tokens, argc - first, argv + first, seconds, status) ;
+   return status ;
+}
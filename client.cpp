@@ -0,0 +1,48 @@
+// File: client.cpp
+//
+// CMSC 341 Spring 2017 Project 2
+//
+// Command line client for the Sally Forth server.
+// Usage: sallyc SOCKET [file]   (reads the script from stdin
+// when no file is given)
+//
+
+
+#include <iostream>
+#include <fstream>
+#include <sstream>
+using namespace std ;
+
+#include "SallyServer.h"
+
+int main(int argc, char *argv[]) {
+   if (argc < 2) {
+      cerr << "usage: " << argv[0] << " SOCKET [file]" << endl ;
+      return 2 ;
+   }
+
+   ostringstream script ;
+   if (argc >= 3) {
+      ifstream ifile(argv[2]) ;
+      if (!ifile) {
+         cerr << "cannot open " << argv[2] << endl ;
+         return 2 ;
+      }
+      script << ifile.rdbuf() ;
+   } else {
+      script << cin.rdbuf() ;
+   }
+
+   SallyClient client(argv[1]) ;
+   string out, err ;
+
+   bool ok = client.run(script.str(), out, err) ;
+   cout << out ;
+   cerr << err ;
+
+   if (!ok) {
+      cerr << "request to " << argv[1] << " failed" << endl ;
+      return 1 ;
+   }
+   return 0 ;
+}
@@ -6,25 +6,178 @@
 // This version accepts user input for filename of Sally Forth
 // source code.
 //
+// Run as "proj2 --serve SOCKET [--workers N]" to start a
+// long-lived server instead (see SallyServer.h).
+//
+// "proj2 --scenarios SETUP FILE..." runs SETUP once and then
+// runs each FILE starting from the state SETUP left behind.
+//
+// "proj2 --emit-cpp FILE" writes FILE translated to C++ on
+// standard output (see SallyTranspiler.h).
+//
+// "proj2 --jit" prompts for a file name as usual and runs it
+// with hot loops compiled to native code (see SallyJit.h).
+//
+// "proj2 --memo" skips pure DO ... UNTIL loops it has already
+// run from the same stack and variables (see SallyMemo.h).
+//
+// "proj2 --prefetch" reads and lexes the file on a separate
+// thread while it runs (see SallyPrefetch.h). "proj2 --preload"
+// lexes the whole file on all cores before it runs instead.
+// Either can be given along with --jit.
+//
+// "proj2 --trace FILE" traces the run into FILE, written on
+// DUMP, on errors and on SIGUSR1 (see SallyTrace.h). Decode it
+// with sallytrace.
+//
+// "proj2 --metrics FILE" writes the run's counters to FILE as
+// JSON when it ends (see SallyMetrics.h).
+//
+// "proj2 --compile-cache FILE" keeps the lexed paragraphs of the
+// program in FILE, so the next run only lexes the paragraphs that
+// were edited since (see SallyCompileCache.h).
+//
+// Files are mapped into memory, or read as a pipe if they are a
+// FIFO, and run as they are decoded if they are gzip compressed
+// (see SallyInput.h).
+//
 
 
 #include <iostream>
 #include <fstream>
+#include <sstream>
+#include <cstring>
+#include <cstdlib>
 using namespace std ;
 
 #include "Sally.h"
+#include "SallyCompileCache.h"
+#include "SallyServer.h"
+#include "SallyTranspiler.h"
 
-int main() {
-   string fname ;
+// run setup once, then every scenario from a fork of its state
+//
+static int runScenarios(int argc, char *argv[]) {
+   SallyInput *setup = SallyInput::open(argv[0]) ;
+   if (setup == NULL) {
+      cerr << "cannot open " << argv[0] << endl ;
+      return 1 ;
+   }
 
-   cout << "Enter file name: " ;
-   cin >> fname ;
-   ifstream ifile(fname.c_str()) ;
+   // the setup run's end of program report is not interesting,
+   // but anything else it complains about is
+   //
+   ostringstream setupErr ;
+   Sally S(*setup, cout, setupErr) ;
+   S.mainLoop() ;
+   delete setup ;
+   if (setupErr.str().compare(0, 14, "End of Program") != 0) {
+      cerr << setupErr.str() ;
+      return 1 ;
+   }
+
+   SallySnapshot snap ;
+   S.snapshot(snap) ;
+
+   for (int i = 1 ; i < argc ; i++) {
+      SallyInput *scenario = SallyInput::open(argv[i]) ;
+      if (scenario == NULL) {
+         cerr << "cannot open " << argv[i] << endl ;
+         continue ;
+      }
+      S.fork(snap, *scenario) ;
+      S.mainLoop() ;
+      if (!scenario->error().empty()) {
+         cerr << argv[i] << ": " << scenario->error() << endl ;
+      }
+      delete scenario ;
+   }
+   return 0 ;
+}
+
+
+// run one program with the options on the command line
+//
+static int runFile(SallyInput& input, int argc, char *argv[]) {
+   Sally S(input) ;
+   SallyCompileCache cache ;
+   const char *metricsFile = NULL ;
+   const char *cacheFile = NULL ;
+   bool preload = false ;
+   for (int i = 1 ; i < argc ; i++) {
+      if (strcmp(argv[i], "--jit") == 0) S.setJit(true) ;
+      if (strcmp(argv[i], "--memo") == 0) S.setMemo(true) ;
+      if (strcmp(argv[i], "--prefetch") == 0) S.setPrefetch(true) ;
+      if (strcmp(argv[i], "--preload") == 0) preload = true ;
+      if (strcmp(argv[i], "--trace") == 0 && i + 1 < argc && !S.setTrace(argv[++i])) {
+         cerr << "cannot open " << argv[i] << endl ;
+         return 1 ;
+      }
+      if (strcmp(argv[i], "--metrics") == 0 && i + 1 < argc) metricsFile = argv[++i] ;
+      if (strcmp(argv[i], "--compile-cache") == 0 && i + 1 < argc) cacheFile = argv[++i] ;
+   }
 
-   Sally S(ifile) ;
+   // a missing or out of date cache file just starts empty
+   //
+   if (cacheFile != NULL) {
+      cache.load(cacheFile) ;
+      S.setCompileCache(&cache) ;
+   }
+   if (preload) S.preload() ;
 
    S.mainLoop() ;
 
-   ifile.close() ;
+   if (cacheFile != NULL && !cache.save(cacheFile)) {
+      cerr << "cannot write " << cacheFile << endl ;
+   }
+
+   if (metricsFile != NULL) {
+      ofstream metrics(metricsFile) ;
+      S.metrics().writeJson(metrics) ;
+   }
    return 0 ;
 }
+
+
+int main(int argc, char *argv[]) {
+   string fname ;
+
+   if (argc >= 3 && strcmp(argv[1], "--scenarios") == 0) {
+      return runScenarios(argc - 2, argv + 2) ;
+   }
+
+   if (argc >= 3 && strcmp(argv[1], "--emit-cpp") == 0) {
+      ifstream ifile(argv[2]) ;
+      if (!ifile) {
+         cerr << "cannot open " << argv[2] << endl ;
+         return 1 ;
+      }
+      SallyTranspiler translator(ifile) ;
+      return translator.emit(cout, cerr, argv[2]) ? 0 : 1 ;
+   }
+
+   if (argc >= 3 && strcmp(argv[1], "--serve") == 0) {
+      int workers = 1 ;
+      if (argc >= 5 && strcmp(argv[3], "--workers") == 0) {
+         workers = atoi(argv[4]) ;
+      }
+      SallyServer server(argv[2], workers) ;
+      return server.run() ? 0 : 1 ;
+   }
+
+   cout << "Enter file name: " ;
+   cin >> fname ;
+   SallyInput *input = SallyInput::open(fname) ;
+   if (input == NULL) {
+      cerr << "cannot open " << fname << endl ;
+      return 1 ;
+   }
+
+   int status = runFile(*input, argc, argv) ;
+   if (!input->error().empty()) {
+      cerr << fname << ": " << input->error() << endl ;
+      status = 1 ;
+   }
+   delete input ;
+   return status ;
+}
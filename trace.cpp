@@ -0,0 +1,183 @@
+// File: trace.cpp
+//
+// CMSC 341 Spring 2017 Project 2
+//
+// Decoder for Sally Forth trace files (see SallyTrace.h).
+// Usage: sallytrace FILE             every dump, one record a line
+//        sallytrace --folded FILE    time spent in each call stack,
+//                                    as input for flamegraph.pl
+//
+
+
+#include <iostream>
+#include <fstream>
+#include <iomanip>
+#include <map>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <cstring>
+using namespace std ;
+
+#include "SallyTrace.h"
+
+
+// one dump read back from the file
+//
+struct Dump {
+   TraceHeader m_header ;
+   map<uint32_t, string> m_names ;
+   vector<TraceRecord> m_records ;
+   double m_nsPerTick ;
+} ;
+
+
+static bool readDump(istream& in, Dump& d) {
+   TraceHeader& h = d.m_header ;
+
+   if (!in.read((char *) &h, sizeof h)) return false ;
+   if (memcmp(h.m_magic, TRACE_MAGIC, sizeof h.m_magic) != 0
+       || h.m_version != TRACE_VERSION || h.m_recordSize != sizeof(TraceRecord)) {
+      cerr << "not a Sally trace, or from another version" << endl ;
+      return false ;
+   }
+
+   string names(h.m_namesSize, '\0') ;
+   in.read(&names[0], names.size()) ;
+   d.m_names.clear() ;
+   for (size_t at = 0 ; at + 5 <= names.size() ; ) {
+      uint32_t hash ;
+      memcpy(&hash, &names[at], 4) ;
+      size_t len = (unsigned char) names[at + 4] ;
+      d.m_names[hash] = names.substr(at + 5, len) ;
+      at += 5 + len ;
+   }
+
+   uint64_t kept = h.m_count < h.m_capacity ? h.m_count : h.m_capacity ;
+   d.m_records.resize(kept) ;
+   in.read((char *) d.m_records.data(), kept * sizeof(TraceRecord)) ;
+   if (!in) {
+      cerr << "trace file is cut short" << endl ;
+      return false ;
+   }
+
+   uint64_t ticks = h.m_dumpTicks - h.m_startTicks ;
+   d.m_nsPerTick = ticks == 0 ? 1.0 : (double) (h.m_dumpNs - h.m_startNs) / ticks ;
+   return true ;
+}
+
+
+static string wordName(const Dump& d, uint32_t hash) {
+   map<uint32_t, string>::const_iterator it = d.m_names.find(hash) ;
+   if (it != d.m_names.end()) return it->second ;
+
+   ostringstream s ;
+   s << "#" << hex << hash ;
+   return s.str() ;
+}
+
+
+static string opName(const Dump& d, const TraceRecord& r) {
+   if (r.m_op >= 0 && r.m_op < NUM_OPS) return opTable[r.m_op].m_name ;
+   if (r.m_op == TRACE_PUSH) return "(push)" ;
+   if (r.m_op == TRACE_CALL) return wordName(d, r.m_word) ;
+   if (r.m_op == TRACE_RETURN) return "(return)" ;
+   return "?" ;
+}
+
+
+static void printDump(const Dump& d, int number) {
+   const TraceHeader& h = d.m_header ;
+   const char *reasons[] = { "DUMP", "error", "signal" } ;
+
+   cout << "dump " << number << ", context " << h.m_context << ", on "
+        << (h.m_reason <= TRACE_ON_SIGNAL ? reasons[h.m_reason] : "?") ;
+   if (h.m_reason == TRACE_ON_SIGNAL) cout << " " << h.m_signal ;
+   cout << ": last " << d.m_records.size() << " of " << h.m_count << " records" << endl ;
+
+   cout << setw(12) << "us" << setw(7) << "line" << setw(6) << "depth"
+        << "  " << left << setw(12) << "word" << right << setw(12) << "top" << endl ;
+
+   for (size_t i = 0 ; i < d.m_records.size() ; i++) {
+      const TraceRecord& r = d.m_records[i] ;
+      double us = (r.m_time - d.m_records[0].m_time) * d.m_nsPerTick / 1000 ;
+      string word = opName(d, r) ;
+      if (r.m_op == TRACE_CALL) word = "call " + word ;
+
+      cout << fixed << setprecision(3) << setw(12) << us << setw(7) << r.m_line
+           << setw(6) << r.m_depth << "  " << left << setw(12) << word << right
+           << setw(12) << r.m_top << endl ;
+   }
+   cout << endl ;
+}
+
+
+// Add each record's time, up to the next record, to the stack
+// it ran in. Frames from before the oldest record kept are "?".
+// Dumps of one context overlap when the ring has not wrapped
+// since the last one, so records folded already (numbered below
+// done) only rebuild the stack.
+//
+static void foldDump(const Dump& d, uint64_t& done, map<string, double>& folded) {
+   vector<string> frames ;
+   uint64_t first = d.m_header.m_count - d.m_records.size() ;
+
+   for (size_t i = 0 ; i + 1 < d.m_records.size() ; i++) {
+      const TraceRecord& r = d.m_records[i] ;
+      double ns = (d.m_records[i + 1].m_time - r.m_time) * d.m_nsPerTick ;
+
+      frames.resize(r.m_depth, "?") ;
+
+      string stack = "sally" ;
+      for (size_t f = 0 ; f < frames.size() ; f++) stack += ";" + frames[f] ;
+
+      if (r.m_op == TRACE_CALL) {
+         frames.push_back(wordName(d, r.m_word)) ;
+         stack += ";" + frames.back() ;
+      } else {
+         stack += ";" + opName(d, r) ;
+      }
+      if (first + i >= done) folded[stack] += ns ;
+   }
+   if (first + d.m_records.size() > done + 1) done = first + d.m_records.size() - 1 ;
+}
+
+
+int main(int argc, char *argv[]) {
+   bool fold = argc >= 3 && strcmp(argv[1], "--folded") == 0 ;
+
+   if (argc != (fold ? 3 : 2)) {
+      cerr << "usage: " << argv[0] << " [--folded] FILE" << endl ;
+      return 2 ;
+   }
+
+   const char *path = argv[argc - 1] ;
+   ifstream in(path, ios::binary) ;
+   if (!in) {
+      cerr << "cannot open " << path << endl ;
+      return 1 ;
+   }
+
+   Dump d ;
+   map<string, double> folded ;
+   map<uint32_t, uint64_t> done ;     // records folded, per context
+   int number = 0 ;
+
+   while (in.peek() != EOF) {
+      if (!readDump(in, d)) return 1 ;
+      number++ ;
+      if (fold) {
+         foldDump(d, done[d.m_header.m_context], folded) ;
+      } else {
+         printDump(d, number) ;
+      }
+   }
+
+   // flamegraph.pl wants whole numbers: nanoseconds
+   //
+   for (map<string, double>::iterator it = folded.begin() ; it != folded.end() ; ++it) {
+      long long ns = (long long) (it->second + 0.5) ;
+      if (ns > 0) cout << it->first << " " << ns << endl ;
+   }
+   return 0 ;
+}